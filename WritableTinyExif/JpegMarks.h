@@ -92,6 +92,13 @@ enum JPEG_EXIF_TAG {
     
     IFD_FNUMBER             = 0x829d,
     IFD_APERTUREVALUE       = 0x9202,
+    
+    XMP_PACKET              = 0x02bc,
+    USER_COMMENT            = 0x9286,
+    MAKER_NOTE              = 0x927c,
+    INTEROP_IFD_OFFSET      = 0xa005,
+    THUMBNAIL_OFFSET        = 0x0201,
+    THUMBNAIL_LENGTH        = 0x0202,
 };
 
 const uint16_t TYPE_UINT8           = 1;
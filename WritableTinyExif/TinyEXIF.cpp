@@ -35,13 +35,16 @@
 #include "tinyxml2.h"
 #include "JpegMarks.h"
 #include "Utils.h"
+#include "TinyExifStats.hpp"
 
 #include <cstdint>
 #include <cstdio>
 #include <cmath>
 #include <cfloat>
+#include <cstring>
 #include <vector>
 #include <algorithm>
+#include <memory>
 
 #ifdef _MSC_VER
 #include <tchar.h>
@@ -49,6 +52,7 @@
 #include <strings.h>
 #define _tcsncmp         	strncmp
 #define _tcsicmp         	strcasecmp
+#define _tcsnicmp        	strncasecmp
 #endif
 
 
@@ -70,17 +74,6 @@ namespace Tools {
 		return NULL;
 	}
 
-	// split an input string with a delimiter and fill a string vector
-	static void strSplit(const std::string& str, char delim, std::vector<std::string>& values) {
-		values.clear();
-		std::string::size_type start(0), end(0);
-		while (end != std::string::npos) {
-			end = str.find(delim, start);
-			values.emplace_back(str.substr(start, end-start));
-			start = end + 1;
-		}
-	}
-
 	// make sure the given degrees value is between -180 and 180
 	static double NormD180(double d) {
 		return (d = fmod(d+180.0, 360.0)) < 0 ? d+180.0 : d-180.0;
@@ -91,6 +84,9 @@ namespace Tools {
 
 namespace TinyEXIF {
 
+// Largest XMP packet whose memory the per-thread XMP document keeps for the next packet
+static const uint32_t MAX_RETAINED_XMP_LENGTH = 1024*1024;
+
 // Parser helper
 class EntryParser {
 private:
@@ -98,13 +94,14 @@ private:
     const unsigned len;
     const unsigned tiff_header_start;
     const bool alignIntel; // byte alignment (defined in EXIF header)
+    const bool viewStrings; // reference strings inside the buffer instead of copying them
     unsigned offs; // current offset into buffer
     uint16_t tag, format;
     uint32_t length;
 
 public:
-    EntryParser(const uint8_t* _buf, unsigned _len, unsigned _tiff_header_start, bool _alignIntel)
-        : buf(_buf), len(_len), tiff_header_start(_tiff_header_start), alignIntel(_alignIntel), offs(0) {}
+    EntryParser(const uint8_t* _buf, unsigned _len, unsigned _tiff_header_start, bool _alignIntel, bool _viewStrings=false)
+        : buf(_buf), len(_len), tiff_header_start(_tiff_header_start), alignIntel(_alignIntel), viewStrings(_viewStrings), offs(0) {}
 
     void Init(unsigned _offs) {
         offs = _offs - 12;
@@ -125,6 +122,18 @@ public:
     uint32_t GetLength() const { return length; }
     uint32_t GetData() const { return Utils::parse32(buf + offs + 8, alignIntel); }
     uint32_t GetSubIFD() const { return tiff_header_start + GetData(); }
+    // Buffer offset of the value of 'size' bytes per component: inside the entry
+    // when it fits in 4 bytes, else where the entry points; 0 if out of the buffer.
+    uint32_t GetValueOffset(uint32_t size) const {
+        const uint64_t total(uint64_t(size) * length);
+        if (total <= 4)
+            return offs + 8;
+        const uint64_t data(uint64_t(tiff_header_start) + GetData());
+        return data + total <= len ? (uint32_t)data : 0;
+    }
+    bool IsInBuffer(uint32_t offset, uint32_t size) const {
+        return offset <= len && size <= len - offset;
+    }
 
     bool IsShort() const { return format == 3; }
     bool IsLong() const { return format == 4; }
@@ -136,12 +145,29 @@ public:
     std::string FetchString() const {
         return Utils::parseString(buf, length, GetData(), tiff_header_start, len, alignIntel);
     }
+    StringView FetchStringView() const {
+        StringView val;
+        val.data = Utils::parseStringRef(buf, length, offs + 8, tiff_header_start, len, alignIntel, val.length);
+        return val;
+    }
     bool Fetch(std::string& val) const {
         if (format != 2 || length == 0)
             return false;
-        val = FetchString();
+        // assign in place, so a reused EXIFInfo keeps the capacity of its strings
+        const StringView view(FetchStringView());
+        val.assign(view.data != NULL ? view.data : "", view.length);
+        return true;
+    }
+    bool Fetch(StringView& val) const {
+        if (format != 2 || length == 0)
+            return false;
+        val = FetchStringView();
         return true;
     }
+    // fetch either a copy or a reference, depending on the parse mode
+    bool Fetch(std::string& val, StringView& view) const {
+        return viewStrings ? Fetch(view) : Fetch(val);
+    }
     bool Fetch(uint8_t& val) const {
         if ((format != 1 && format != 2 && format != 6) || length == 0)
             return false;
@@ -155,9 +181,10 @@ public:
         return true;
     }
     bool Fetch(uint16_t& val, uint32_t idx) const {
-        if (!IsShort() || length <= idx)
+        const uint32_t data(GetValueOffset(2));
+        if (!IsShort() || length <= idx || data == 0)
             return false;
-        val = Utils::parse16(buf + GetSubIFD() + idx*2, alignIntel);
+        val = Utils::parse16(buf + data + idx*2, alignIntel);
         return true;
     }
     bool Fetch(uint32_t& val) const {
@@ -173,15 +200,17 @@ public:
         return true;
     }
     bool Fetch(double& val) const {
-        if (!IsRational() || length == 0)
+        const uint32_t data(GetValueOffset(8));
+        if (!IsRational() || length == 0 || data == 0)
             return false;
-        val = Utils::parseRational(buf + GetSubIFD(), alignIntel, IsSRational());
+        val = Utils::parseRational(buf + data, alignIntel, IsSRational());
         return true;
     }
     bool Fetch(double& val, uint32_t idx) const {
-        if (!IsRational() || length <= idx)
+        const uint32_t data(GetValueOffset(8));
+        if (!IsRational() || length <= idx || data == 0)
             return false;
-        val = Utils::parseRational(buf + GetSubIFD() + idx*8, alignIntel, IsSRational());
+        val = Utils::parseRational(buf + data + idx*8, alignIntel, IsSRational());
         return true;
     }
 
@@ -195,22 +224,130 @@ public:
 
 };
 
+// Stream passing the requests on to another one until 'budget' bytes were read or skipped
+class EXIFStreamBudget : public EXIFStream {
+public:
+	EXIFStreamBudget(EXIFStream& _stream, uint64_t _budget)
+		: stream(_stream), budget(_budget), exceeded(false) {}
+	bool IsValid() const override {
+		return stream.IsValid();
+	}
+	const uint8_t* GetBuffer(unsigned desiredLength) override {
+		return Spend(desiredLength) ? stream.GetBuffer(desiredLength) : NULL;
+	}
+	bool SkipBuffer(unsigned desiredLength) override {
+		return Spend(desiredLength) && stream.SkipBuffer(desiredLength);
+	}
+	bool Exceeded() const {
+		return exceeded;
+	}
+private:
+	bool Spend(unsigned length) {
+		if (length > budget) {
+			exceeded = true;
+			return false;
+		}
+		budget -= length;
+		return true;
+	}
+	EXIFStream& stream;
+	uint64_t budget;
+	bool exceeded;
+};
+
+// Stream interface over a JPEG image in memory
+class EXIFStreamBuffer : public EXIFStream {
+public:
+	explicit EXIFStreamBuffer(const uint8_t* buf, unsigned len)
+		: it(buf), end(buf+len) {}
+	bool IsValid() const override {
+		return it != NULL;
+	}
+	const uint8_t* GetBuffer(unsigned desiredLength) override {
+		const uint8_t* const itNext(it+desiredLength);
+		if (itNext >= end)
+			return NULL;
+		const uint8_t* const begin(it);
+		it = itNext;
+		return begin;
+	}
+	bool SkipBuffer(unsigned desiredLength) override {
+		return GetBuffer(desiredLength) != NULL;
+	}
+private:
+	const uint8_t* it, * const end;
+};
+
+// Forward only reader of a segment from a stream:
+// fetches only the requested ranges and skips the bytes in between
+class SegmentReader {
+private:
+	EXIFStream& stream;
+	const unsigned length; // segment length
+	unsigned pos; // current offset into the segment
+	bool failed; // the stream could not deliver the requested data
+
+public:
+	SegmentReader(EXIFStream& _stream, unsigned _length)
+		: stream(_stream), length(_length), pos(0), failed(false) {}
+
+	// Return the buffer of the given size at the given segment offset;
+	// offsets before the current position can not be read anymore
+	const uint8_t* Read(unsigned offs, unsigned size) {
+		if (failed || offs < pos || offs > length || size > length - offs)
+			return NULL;
+		if (offs > pos && !stream.SkipBuffer(offs - pos)) {
+			failed = true;
+			return NULL;
+		}
+		pos = offs;
+		const uint8_t* const buf(size ? stream.GetBuffer(size) : NULL);
+		if (buf == NULL) {
+			failed = true;
+			return NULL;
+		}
+		pos += size;
+		return buf;
+	}
+
+	// Skip the rest of the segment
+	bool Finish() {
+		if (failed)
+			return false;
+		if (pos < length && !stream.SkipBuffer(length - pos))
+			return false;
+		pos = length;
+		return true;
+	}
+};
+
+// Check if the marker starts a frame (SOF0-SOF15, except DHT, JPG and DAC)
+static inline bool IsSOFMarker(uint8_t marker) {
+	return marker >= JM_SOF0 && marker <= JM_SOF15 &&
+		marker != JM_DHT && marker != JM_JPG && marker != JM_DAC;
+}
+
+
+ParseLimits::ParseLimits()
+	: MaxIFDs(IFDWalker::MAX_IFDS), MaxEntries(4096), MaxDepth(2),
+	  MaxXMPLength(64*1024*1024), MaxScanBytes(UINT64_MAX) {}
+
 // Constructors
-EXIFInfo::EXIFInfo() : Fields(FIELD_NA) {
+EXIFInfo::EXIFInfo() : viewStrings(false), Fields(FIELD_NA) {
     clear();
 }
-EXIFInfo::EXIFInfo(EXIFStream& stream) {
+EXIFInfo::EXIFInfo(EXIFStream& stream) : viewStrings(false) {
     clear();
 	parseFrom(stream);
 }
-EXIFInfo::EXIFInfo(const uint8_t* data, unsigned length) {
+EXIFInfo::EXIFInfo(const uint8_t* data, unsigned length) : viewStrings(false) {
     clear();
 	parseFrom(data, length);
 }
 
 
 // Parse tag as Image IFD
-void EXIFInfo::parseIFDImage(EntryParser& parser, unsigned& exif_sub_ifd_offset, unsigned& gps_sub_ifd_offset) {
+void EXIFInfo::parseIFDImage(EntryParser& parser) {
 	switch (parser.GetTag()) {
 	case 0x0102:
 		// Bits per sample
@@ -219,17 +356,17 @@ void EXIFInfo::parseIFDImage(EntryParser& parser, unsigned& exif_sub_ifd_offset,
 
 	case 0x010e:
 		// Image description
-		parser.Fetch(ImageDescription);
+		parser.Fetch(ImageDescription, Views.ImageDescription);
 		break;
 
 	case 0x010f:
 		// Camera maker
-		parser.Fetch(Make);
+		parser.Fetch(Make, Views.Make);
 		break;
 
 	case 0x0110:
 		// Camera model
-		parser.Fetch(Model);
+		parser.Fetch(Model, Views.Model);
 		break;
 
 	case 0x0112:
@@ -254,12 +391,12 @@ void EXIFInfo::parseIFDImage(EntryParser& parser, unsigned& exif_sub_ifd_offset,
 
 	case 0x0131:
 		// Software used for image
-		parser.Fetch(Software);
+		parser.Fetch(Software, Views.Software);
 		break;
 
 	case 0x0132:
 		// EXIF/TIFF date/time of image modification
-		parser.Fetch(DateTime);
+		parser.Fetch(DateTime, Views.DateTime);
 		break;
 
 	case 0x1001:
@@ -282,17 +419,12 @@ void EXIFInfo::parseIFDImage(EntryParser& parser, unsigned& exif_sub_ifd_offset,
 
 	case 0x8298:
 		// Copyright information
-		parser.Fetch(Copyright);
+		parser.Fetch(Copyright, Views.Copyright);
 		break;
 
 	case 0x8769:
-		// EXIF SubIFD offset
-		exif_sub_ifd_offset = parser.GetSubIFD();
-		break;
-
 	case 0x8825:
-		// GPS IFS offset
-		gps_sub_ifd_offset = parser.GetSubIFD();
+		// EXIF and GPS SubIFD offsets, followed by IFDWalker
 		break;
 
 	default:
@@ -308,8 +440,9 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 	case 0x02bc:
 		// XMP Metadata (Adobe technote 9-14-02)
 		if (parser.IsUndefined()) {
-			const std::string strXML(parser.FetchString());
-			parseFromXMPSegmentXML(strXML.c_str(), (unsigned)strXML.length());
+			const StringView strXML(parser.FetchStringView());
+			if (!strXML.empty())
+				parseFromXMPSegmentXML(strXML.data, strXML.length);
 		}
 		break;
 
@@ -335,12 +468,27 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 
 	case 0x9003:
 		// Original date and time
-		parser.Fetch(DateTimeOriginal);
+		parser.Fetch(DateTimeOriginal, Views.DateTimeOriginal);
 		break;
 
 	case 0x9004:
 		// Digitization date and time
-		parser.Fetch(DateTimeDigitized);
+		parser.Fetch(DateTimeDigitized, Views.DateTimeDigitized);
+		break;
+
+	case 0x9010:
+		// Offset from UTC of DateTime
+		parser.Fetch(OffsetTime, Views.OffsetTime);
+		break;
+
+	case 0x9011:
+		// Offset from UTC of DateTimeOriginal
+		parser.Fetch(OffsetTimeOriginal, Views.OffsetTimeOriginal);
+		break;
+
+	case 0x9012:
+		// Offset from UTC of DateTimeDigitized
+		parser.Fetch(OffsetTimeDigitized, Views.OffsetTimeDigitized);
 		break;
 
 	case 0x9201:
@@ -392,7 +540,7 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 
 	case 0x9214:
 		// Subject area
-		if (parser.IsShort() && parser.GetLength() > 1) {
+		if (parser.IsShort() && parser.GetLength() > 1 && parser.GetValueOffset(2) != 0) {
 			SubjectArea.resize(parser.GetLength());
 			for (uint32_t i=0; i<parser.GetLength(); ++i)
 				parser.Fetch(SubjectArea[i], i);
@@ -404,9 +552,19 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 		parseIFDMakerNote(parser);
 		break;
 
+	case 0x9290:
+		// Fractions of seconds for DateTime
+		parser.Fetch(SubSecTime, Views.SubSecTime);
+		break;
+
 	case 0x9291:
 		// Fractions of seconds for DateTimeOriginal
-		parser.Fetch(SubSecTimeOriginal);
+		parser.Fetch(SubSecTimeOriginal, Views.SubSecTimeOriginal);
+		break;
+
+	case 0x9292:
+		// Fractions of seconds for DateTimeDigitized
+		parser.Fetch(SubSecTimeDigitized, Views.SubSecTimeDigitized);
 		break;
 
 	case 0xa002:
@@ -467,7 +625,7 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 
 	case 0xa431:
 		// Serial number of the camera
-		parser.Fetch(SerialNumber);
+		parser.Fetch(SerialNumber, Views.SerialNumber);
 		break;
 
 	case 0xa432:
@@ -480,12 +638,12 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 
 	case 0xa433:
 		// Lens make.
-		parser.Fetch(LensInfo.Make);
+		parser.Fetch(LensInfo.Make, Views.LensMake);
 		break;
 
 	case 0xa434:
 		// Lens model.
-		parser.Fetch(LensInfo.Model);
+		parser.Fetch(LensInfo.Model, Views.LensModel);
 		break;
 	}
 }
@@ -494,17 +652,20 @@ void EXIFInfo::parseIFDExif(EntryParser& parser) {
 void EXIFInfo::parseIFDMakerNote(EntryParser& parser) {
 	const unsigned startOff = parser.GetOffset();
 	const uint32_t off = parser.GetSubIFD();
-	if (0 != _tcsicmp(Make.c_str(), "DJI"))
+	if (!isMake("DJI") || !parser.IsInBuffer(off, 2))
 		return;
 	int num_entries = Utils::parse16(parser.GetBuffer()+off, parser.IsIntelAligned());
-	if (uint32_t(2 + 12 * num_entries) > parser.GetLength())
+	if (uint32_t(2 + 12 * num_entries) > parser.GetLength() || !parser.IsInBuffer(off, 2 + 12 * num_entries))
+		return;
+	// the MakerNote IFD is nested in the Exif IFD
+	if (!spendIFD(2, num_entries))
 		return;
 	parser.Init(off+2);
 	parser.ParseTag();
 	--num_entries;
-	std::string maker;
+	StringView maker;
 	if (parser.GetTag() == 1 && parser.Fetch(maker)) {
-		if (0 == _tcsicmp(maker.c_str(), "DJI")) {
+		if (maker.iequals("DJI")) {
 			while (--num_entries >= 0) {
 				parser.ParseTag();
 				switch (parser.GetTag()) {
@@ -589,12 +750,15 @@ void EXIFInfo::parseIFDGPS(EntryParser& parser) {
 		// GPS timestamp
 		if (parser.IsRational() && parser.GetLength() == 3) {
 			double h,m,s;
-			parser.Fetch(h, 0);
-			parser.Fetch(m, 1);
-			parser.Fetch(s, 2);
-			char buffer[256];
-			snprintf(buffer, 256, "%g %g %g", h, m, s);
-			GeoLocation.GPSTimeStamp = buffer;
+			if (parser.Fetch(h, 0) && parser.Fetch(m, 1) && parser.Fetch(s, 2)) {
+				char buffer[256];
+				snprintf(buffer, 256, "%g %g %g", h, m, s);
+				GeoLocation.GPSTimeStamp = buffer;
+				// kept exact, the string keeps only 6 significant digits; a leap second may end the day
+				const double seconds = h*3600 + m*60 + s;
+				if (seconds >= 0 && seconds < 86401)
+					GeoLocation.GPSTimeMicros = llround(seconds * 1e6);
+			}
 		}
 		break;
 
@@ -605,12 +769,12 @@ void EXIFInfo::parseIFDGPS(EntryParser& parser) {
 
 	case 18:
 		// GPS geodetic survey data
-		parser.Fetch(GeoLocation.GPSMapDatum);
+		parser.Fetch(GeoLocation.GPSMapDatum, Views.GPSMapDatum);
 		break;
 
 	case 29:
 		// GPS date-stamp
-		parser.Fetch(GeoLocation.GPSDateStamp);
+		parser.Fetch(GeoLocation.GPSDateStamp, Views.GPSDateStamp);
 		break;
 
 	case 30:
@@ -626,7 +790,14 @@ void EXIFInfo::parseIFDGPS(EntryParser& parser) {
 // parseFromEXIFSegment() or parseFromXMPSegment()
 //
 int EXIFInfo::parseFrom(EXIFStream& stream) {
+	TINYEXIF_STAT_TIMER(STAGE_PARSE);
 	clear();
+	EXIFStreamBudget budget(stream, limits.MaxScanBytes);
+	const int ret(parseJPEG(budget));
+	return limitExceeded || budget.Exceeded() ? (int)PARSE_LIMIT_EXCEEDED : ret;
+}
+
+int EXIFInfo::parseJPEG(EXIFStream& stream) {
 	if (!stream.IsValid())
 		return PARSE_INVALID_JPEG;
 
@@ -637,7 +808,7 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
 		return PARSE_INVALID_JPEG;
 
 	// Scan for JM_APP1 header (bytes 0xFF 0xE1) and parse its length.
-	// Exit if both EXIF and XMP sections were parsed.
+	// Exit once the frame header (SOF) was parsed, as all APPn segments precede it.
 	struct APP1S {
 		uint32_t& val;
 		inline APP1S(uint32_t& v) : val(v) {}
@@ -674,6 +845,7 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
                 
             case JM_SOS: // start of stream: and we're done
             case JM_EOI: // no data? not good
+                finishExtendedXMP();
                 return app1s();
                 
             case JM_APP1:
@@ -692,19 +864,18 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
                     case PARSE_ABSENT_DATA:
                         switch (ret=parseFromXMPSegment(buf, sectionLength)) {
                             case PARSE_ABSENT_DATA:
+                                if ((ret=parseFromExtendedXMPSegment(buf, sectionLength)) != PARSE_SUCCESS && ret != PARSE_ABSENT_DATA)
+                                    return app1s(ret); // some error
                                 break;
                             case PARSE_SUCCESS:
-                                if ((app1s|=FIELD_XMP) == FIELD_ALL)
-                                    return PARSE_SUCCESS;
+                                app1s |= FIELD_XMP;
                                 break;
                             default:
                                 return app1s(ret); // some error
                         }
                         break;
                     case PARSE_SUCCESS:
-                        if ((app1s|=FIELD_EXIF) == FIELD_ALL) {
-                            return PARSE_SUCCESS;
-                        }
+                        app1s |= FIELD_EXIF;
                         break;
                             
                     default:
@@ -713,6 +884,33 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
             }
             break;
                 
+            case JM_SOF0:
+            case JM_SOF1:
+            case JM_SOF2:
+            case JM_SOF3:
+            case JM_SOF5:
+            case JM_SOF6:
+            case JM_SOF7:
+            case JM_SOF9:
+            case JM_SOF10:
+            case JM_SOF11:
+            case JM_SOF13:
+            case JM_SOF14:
+            case JM_SOF15:
+                // frame header: nothing else to look for after it
+                if ((buf=stream.GetBuffer(2)) == NULL) {
+                    return app1s(PARSE_INVALID_JPEG);
+                }
+                sectionLength = Utils::parse16(buf, false);
+                if (sectionLength <= 2 || (buf=stream.GetBuffer(sectionLength-=2)) == NULL) {
+                    return app1s(PARSE_INVALID_JPEG);
+                }
+                if (parseFromSOFSegment(marker, buf, sectionLength) == PARSE_SUCCESS) {
+                    app1s |= FIELD_FRAME;
+                }
+                finishExtendedXMP();
+                return app1s();
+
             default:
                 // skip the section
                 if ((buf=stream.GetBuffer(2)) == NULL ||
@@ -721,33 +919,516 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
                     return app1s(PARSE_INVALID_JPEG);
 		}
 	}
+	finishExtendedXMP();
 	return app1s();
 }
 
 int EXIFInfo::parseFrom(const uint8_t* buf, unsigned len) {
-	class EXIFStreamBuffer : public EXIFStream {
-	public:
-		explicit EXIFStreamBuffer(const uint8_t* buf, unsigned len)
-			: it(buf), end(buf+len) {}
-		bool IsValid() const override {
-			return it != NULL;
-		}
-		const uint8_t* GetBuffer(unsigned desiredLength) override {
-			const uint8_t* const itNext(it+desiredLength);
-			if (itNext >= end)
-				return NULL;
-			const uint8_t* const begin(it);
-			it = itNext;
-			return begin;
+	EXIFStreamBuffer stream(buf, len);
+	return parseFrom(stream);
+}
+
+int EXIFInfo::parseViewFrom(const uint8_t* buf, unsigned len) {
+	viewStrings = true;
+	const int ret(parseFrom(buf, len));
+	viewStrings = false;
+	return ret;
+}
+
+//
+// Probe the orientation and dimensions, reading only the IFD0 and Exif IFD
+// entries of the EXIF segment; the values stored outside the entries and
+// the rest of the segment are skipped.
+//
+static int ProbeEXIFSegment(SegmentReader& reader, uint32_t what, LayoutInfo& info) {
+	const unsigned tiff_header_start = 6;
+	const uint8_t* buf(reader.Read(0, tiff_header_start + 8));
+	if (buf == NULL || !std::equal(buf, buf+tiff_header_start, "Exif\0\0"))
+		return PARSE_ABSENT_DATA;
+	bool alignIntel;
+	if (buf[6] == 'I' && buf[7] == 'I')
+		alignIntel = true;
+	else
+	if (buf[6] == 'M' && buf[7] == 'M')
+		alignIntel = false;
+	else
+		return PARSE_UNKNOWN_BYTEALIGN;
+	if (0x2a != Utils::parse16(buf + 8, alignIntel))
+		return PARSE_CORRUPT_DATA;
+
+	// IFD0, followed by the Exif IFD if the EXIF size was requested
+	unsigned offs = tiff_header_start + Utils::parse32(buf + 10, alignIntel);
+	for (int ifd=0; ifd<2; ++ifd) {
+		if ((buf=reader.Read(offs, 2)) == NULL)
+			return ifd ? PARSE_SUCCESS : PARSE_CORRUPT_DATA;
+		const unsigned num_entries = Utils::parse16(buf, alignIntel);
+		if ((buf=reader.Read(offs + 2, 12 * num_entries)) == NULL)
+			return ifd ? PARSE_SUCCESS : PARSE_CORRUPT_DATA;
+		offs = 0;
+		for (unsigned i=0; i<num_entries; ++i, buf += 12) {
+			const uint16_t format = Utils::parse16(buf + 2, alignIntel);
+			if (Utils::parse32(buf + 4, alignIntel) == 0)
+				continue;
+			switch (Utils::parse16(buf, alignIntel)) {
+			case 0x0112:
+				if (format == 3) {
+					info.Orientation = Utils::parse16(buf + 8, alignIntel);
+					info.Fields |= PROBE_ORIENTATION;
+				}
+				break;
+			case 0xa002:
+				if (format == 3 || format == 4) {
+					info.ImageWidth = format == 3 ? Utils::parse16(buf + 8, alignIntel) : Utils::parse32(buf + 8, alignIntel);
+					info.Fields |= PROBE_EXIF_SIZE;
+				}
+				break;
+			case 0xa003:
+				if (format == 3 || format == 4) {
+					info.ImageHeight = format == 3 ? Utils::parse16(buf + 8, alignIntel) : Utils::parse32(buf + 8, alignIntel);
+					info.Fields |= PROBE_EXIF_SIZE;
+				}
+				break;
+			case 0x8769:
+				if (ifd == 0 && format == 4)
+					offs = tiff_header_start + Utils::parse32(buf + 8, alignIntel);
+				break;
+			}
 		}
-		bool SkipBuffer(unsigned desiredLength) override {
-			return GetBuffer(desiredLength) != NULL;
+		if (offs == 0 || !(what & PROBE_EXIF_SIZE) || (info.ImageWidth && info.ImageHeight))
+			break;
+	}
+	return PARSE_SUCCESS;
+}
+
+int LayoutInfo::probeFrom(EXIFStream& stream, uint32_t what) {
+	Fields      = PROBE_NA;
+	Orientation = 0;
+	ImageWidth  = 0;
+	ImageHeight = 0;
+	FrameWidth  = 0;
+	FrameHeight = 0;
+	if (!stream.IsValid())
+		return PARSE_INVALID_JPEG;
+
+	const uint8_t* buf(stream.GetBuffer(2));
+	if (buf == NULL || buf[0] != JM_START || buf[1] != JM_SOI)
+		return PARSE_INVALID_JPEG;
+
+	// Walk the markers until the EXIF segment and/or the SOF header answered.
+	bool needEXIF = (what & (PROBE_ORIENTATION|PROBE_EXIF_SIZE)) != 0;
+	const bool needFrame = (what & PROBE_FRAME_SIZE) != 0;
+	while ((buf=stream.GetBuffer(2)) != NULL) {
+		if (*buf++ != JM_START)
+			break;
+		uint8_t marker;
+		while ((marker=buf[0]) == JM_START && (buf=stream.GetBuffer(1)) != NULL);
+		switch (marker) {
+		case 0x00:
+		case 0x01:
+		case JM_START:
+		case JM_RST0:
+		case JM_RST1:
+		case JM_RST2:
+		case JM_RST3:
+		case JM_RST4:
+		case JM_RST5:
+		case JM_RST6:
+		case JM_RST7:
+		case JM_SOI:
+			break;
+
+		case JM_SOS: // start of stream: the frame header is missing
+		case JM_EOI:
+			return Fields ? PARSE_SUCCESS : PARSE_ABSENT_DATA;
+
+		default:
+			if ((buf=stream.GetBuffer(2)) == NULL)
+				return PARSE_INVALID_JPEG;
+			uint16_t sectionLength = Utils::parse16(buf, false);
+			if (sectionLength <= 2)
+				return PARSE_INVALID_JPEG;
+			sectionLength -= 2;
+			if (needFrame && IsSOFMarker(marker)) {
+				// precision (1), height (2), width (2)
+				if (sectionLength < 5 || (buf=stream.GetBuffer(5)) == NULL)
+					return PARSE_INVALID_JPEG;
+				FrameHeight = Utils::parse16(buf + 1, false);
+				FrameWidth = Utils::parse16(buf + 3, false);
+				Fields |= PROBE_FRAME_SIZE;
+				return PARSE_SUCCESS; // the SOF header follows all the APPn segments
+			}
+			if (needEXIF && marker == JM_APP1) {
+				SegmentReader reader(stream, sectionLength);
+				const int ret(ProbeEXIFSegment(reader, what, *this));
+				if (!reader.Finish())
+					return PARSE_INVALID_JPEG;
+				if (ret == PARSE_SUCCESS) {
+					needEXIF = false;
+					if (!needFrame)
+						return PARSE_SUCCESS;
+				}
+				break;
+			}
+			if (!stream.SkipBuffer(sectionLength))
+				return PARSE_INVALID_JPEG;
 		}
-	private:
-		const uint8_t* it, * const end;
-	};
+	}
+	return Fields ? PARSE_SUCCESS : PARSE_ABSENT_DATA;
+}
+
+int LayoutInfo::probeFrom(const uint8_t* buf, unsigned len, uint32_t what) {
 	EXIFStreamBuffer stream(buf, len);
-	return parseFrom(stream);
+	return probeFrom(stream, what);
+}
+
+//
+// Detect the container from its magic bytes:
+//   JPEG: 0xFFD8 (SOI marker)
+//   PNG:  0x89 "PNG" 0x0D0A1A0A
+//   WebP: "RIFF" + 4 bytes size + "WEBP"
+//   TIFF: "II" 0x2A00 or "MM" 0x002A (BigTIFF is not supported)
+//
+ContainerFormat SniffContainer(const uint8_t* data, unsigned length) {
+	if (data == NULL)
+		return CONTAINER_UNKNOWN;
+	if (length >= 2 && data[0] == JM_START && data[1] == JM_SOI)
+		return CONTAINER_JPEG;
+	static const uint8_t pngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+	if (length >= 8 && std::equal(data, data+8, pngSignature))
+		return CONTAINER_PNG;
+	if (length >= 12 && std::equal(data, data+4, "RIFF") && std::equal(data+8, data+12, "WEBP"))
+		return CONTAINER_WEBP;
+	if (length >= 8 && (std::equal(data, data+4, "II\x2a\0") || std::equal(data, data+4, "MM\0\x2a")))
+		return CONTAINER_TIFF;
+	return CONTAINER_UNKNOWN;
+}
+
+// Skip the "Exif\0\0" prefix some writers put in front of the PNG/WebP EXIF payload
+static inline const uint8_t* SkipExifPrefix(const uint8_t* buf, unsigned& len) {
+	if (len >= 6 && std::equal(buf, buf+6, "Exif\0\0")) {
+		len -= 6;
+		return buf + 6;
+	}
+	return buf;
+}
+
+// Walk the JPEG segments preceding the image data, looking for the first EXIF and XMP APP1
+static int LocateJPEG(const uint8_t* data, unsigned length, MetadataLocation& location) {
+	unsigned offs = 2;
+	while (offs + 2 <= length) {
+		if (data[offs] != JM_START)
+			return PARSE_INVALID_JPEG;
+		const uint8_t marker(data[offs+1]);
+		if (marker == JM_START) { // fill byte
+			++offs;
+			continue;
+		}
+		offs += 2;
+		if (marker == JM_SOS || marker == JM_EOI)
+			break;
+		if ((marker >= JM_RST0 && marker <= JM_RST7) || marker == 0x01)
+			continue;
+		if (offs + 2 > length)
+			return PARSE_INVALID_JPEG;
+		const unsigned sectionLength(Utils::parse16(data + offs, false));
+		if (sectionLength < 2 || sectionLength > length - offs)
+			return PARSE_INVALID_JPEG;
+		const uint8_t* const buf(data + offs + 2);
+		const unsigned len(sectionLength - 2);
+		if (marker == JM_APP1) {
+			if (location.TIFF == NULL && len >= 6 && std::equal(buf, buf+6, "Exif\0\0")) {
+				location.TIFF = buf + 6;
+				location.TIFFLength = len - 6;
+			} else
+			if (location.XMP == NULL && len >= 29 && std::equal(buf, buf+29, "http://ns.adobe.com/xap/1.0/\0")) {
+				location.XMP = (const char*)(buf + 29);
+				location.XMPLength = len - 29;
+			}
+		}
+		offs += sectionLength;
+	}
+	return PARSE_SUCCESS;
+}
+
+//
+// Walk the PNG chunks:
+//   4 bytes: data length (big endian)
+//   4 bytes: chunk type
+//   N bytes: data
+//   4 bytes: CRC of the type and data
+// The iTXt chunk holding XMP is laid out as
+//   "XML:com.adobe.xmp\0" + compression flag + compression method + language "\0" + translated keyword "\0" + text
+//
+static int LocatePNG(const uint8_t* data, unsigned length, MetadataLocation& location) {
+	static const char xmpKeyword[] = "XML:com.adobe.xmp";
+	unsigned offs = 8;
+	while (offs + 12 <= length) {
+		const uint32_t size(Utils::parse32(data + offs, false));
+		if (size > length - offs - 12)
+			return PARSE_INVALID_JPEG;
+		const uint8_t* const type(data + offs + 4);
+		const uint8_t* const buf(data + offs + 8);
+		if (std::equal(type, type+4, "IHDR") && size >= 8) {
+			location.Width = Utils::parse32(buf, false);
+			location.Height = Utils::parse32(buf + 4, false);
+		} else
+		if (std::equal(type, type+4, "eXIf") && location.TIFF == NULL) {
+			unsigned len(size);
+			location.TIFF = SkipExifPrefix(buf, len);
+			location.TIFFLength = len;
+		} else
+		if (std::equal(type, type+4, "iTXt") && location.XMP == NULL &&
+			size > sizeof(xmpKeyword) + 2 && std::equal(buf, buf+sizeof(xmpKeyword), xmpKeyword) &&
+			buf[sizeof(xmpKeyword)] == 0) { // compressed text is not supported
+			const char* const end((const char*)buf + size);
+			const char* text((const char*)buf + sizeof(xmpKeyword) + 2);
+			for (int i = 0; i < 2 && text < end; ++i) // skip the language tag and the translated keyword
+				text = std::find(text, end, '\0') + 1;
+			if (text <= end) {
+				location.XMP = text;
+				location.XMPLength = (unsigned)(end - text);
+			}
+		} else
+		if (std::equal(type, type+4, "IEND")) {
+			break;
+		}
+		offs += 12 + size;
+	}
+	return PARSE_SUCCESS;
+}
+
+//
+// Walk the WebP RIFF chunks:
+//   4 bytes: FourCC
+//   4 bytes: data size (little endian)
+//   N bytes: data, padded to an even size
+// The canvas size comes from the VP8X chunk, or from the VP8/VP8L bitstream header of a simple file.
+//
+static int LocateWebP(const uint8_t* data, unsigned length, MetadataLocation& location) {
+	const uint32_t riffSize(Utils::parse32(data + 4, true));
+	const unsigned end(riffSize < length - 8 ? riffSize + 8 : length);
+	unsigned offs = 12;
+	while (offs + 8 <= end) {
+		const uint32_t size(Utils::parse32(data + offs + 4, true));
+		if (size > end - offs - 8)
+			return PARSE_INVALID_JPEG;
+		const uint8_t* const fourcc(data + offs);
+		const uint8_t* const buf(data + offs + 8);
+		if (std::equal(fourcc, fourcc+4, "VP8X") && size >= 10) {
+			location.Width = 1 + (buf[4] | (buf[5] << 8) | (buf[6] << 16));
+			location.Height = 1 + (buf[7] | (buf[8] << 8) | (buf[9] << 16));
+		} else
+		if (std::equal(fourcc, fourcc+4, "VP8 ") && size >= 10 && location.Width == 0) {
+			location.Width = Utils::parse16(buf + 6, true) & 0x3FFF;
+			location.Height = Utils::parse16(buf + 8, true) & 0x3FFF;
+		} else
+		if (std::equal(fourcc, fourcc+4, "VP8L") && size >= 5 && location.Width == 0) {
+			const uint32_t bits(Utils::parse32(buf + 1, true));
+			location.Width = 1 + (bits & 0x3FFF);
+			location.Height = 1 + ((bits >> 14) & 0x3FFF);
+		} else
+		if (std::equal(fourcc, fourcc+4, "EXIF") && location.TIFF == NULL) {
+			unsigned len(size);
+			location.TIFF = SkipExifPrefix(buf, len);
+			location.TIFFLength = len;
+		} else
+		if (std::equal(fourcc, fourcc+4, "XMP ") && location.XMP == NULL) {
+			location.XMP = (const char*)buf;
+			location.XMPLength = size;
+		}
+		offs += 8 + size + (size & 1);
+	}
+	return PARSE_SUCCESS;
+}
+
+void MetadataLocation::clear() {
+	Format = CONTAINER_UNKNOWN;
+	TIFF = NULL;
+	TIFFLength = 0;
+	XMP = NULL;
+	XMPLength = 0;
+	Width = 0;
+	Height = 0;
+}
+
+IFDWalker::IFDWalker(const uint8_t* _buf, unsigned _len, unsigned _tiff_header_start, bool _alignIntel, unsigned _maxChain)
+	: buf(_buf), len(_len), tiff_header_start(_tiff_header_start), alignIntel(_alignIntel), maxChain(_maxChain),
+	  chainLength(0), numDirectories(0), current(-1), nextIndex(0), pendingHead(0), pendingTail(0), failedKinds(0)
+{
+	// the offset of IFD0 is the last field of the TIFF header
+	if (maxChain > 0)
+		queue(tiff_header_start + 4, IFD_IMAGE, 0, -1);
+}
+
+uint32_t IFDWalker::typeSize(uint16_t type) {
+	switch (type) {
+	case 1: case 2: case 6: case 7: return 1; // byte, ascii, signed byte, undefined
+	case 3: case 8: return 2;                 // short, signed short
+	case 4: case 9: case 11: return 4;        // long, signed long, float
+	case 5: case 10: case 12: return 8;       // rational, signed rational, double
+	}
+	return 0;
+}
+
+void IFDWalker::queue(unsigned field, IFDKind kind, uint16_t tag, int parent) {
+	// every directory entered or pending takes one of the MAX_IFDS slots
+	if (numDirectories + (pendingTail - pendingHead) >= MAX_IFDS)
+		return;
+	Pointer& pointer(pending[pendingTail++ % MAX_IFDS]);
+	pointer.field = field;
+	pointer.kind = kind;
+	pointer.tag = tag;
+	pointer.parent = parent;
+}
+
+void IFDWalker::queuePointer(unsigned entryOffset, uint16_t tag) {
+	// follow the SubIFD pointers only where EXIF defines them
+	const IFDKind kind(directories[current].Kind);
+	if (kind == IFD_IMAGE && tag == 0x8769)
+		queue(entryOffset + 8, IFD_EXIF, tag, current);
+	else
+	if (kind == IFD_IMAGE && tag == 0x8825)
+		queue(entryOffset + 8, IFD_GPS, tag, current);
+	else
+	if (kind == IFD_EXIF && tag == 0xa005)
+		queue(entryOffset + 8, IFD_INTEROP, tag, current);
+}
+
+bool IFDWalker::nextDirectory() {
+	if (current >= 0) {
+		// the entries not read by the caller may still point to SubIFDs
+		const IFDDirectory& dir(directories[current]);
+		for (; nextIndex < dir.Entries; ++nextIndex) {
+			const unsigned offs(dir.Offset + 2 + 12 * nextIndex);
+			queuePointer(offs, Utils::parse16(buf + offs, alignIntel));
+		}
+		if ((dir.Kind == IFD_IMAGE || dir.Kind == IFD_THUMBNAIL || dir.Kind == IFD_CHAINED) && chainLength < maxChain)
+			queue(dir.NextField, chainLength == 1 ? IFD_THUMBNAIL : IFD_CHAINED, 0, current);
+		current = -1;
+	}
+	while (pendingHead < pendingTail) {
+		const Pointer pointer(pending[pendingHead++ % MAX_IFDS]);
+		if (pointer.field > len || len - pointer.field < 4)
+			continue;
+		const uint32_t offset(Utils::parse32(buf + pointer.field, alignIntel));
+		if (offset == 0) {
+			// no directory, which ends the chain but is invalid for IFD0
+			if (pointer.kind == IFD_IMAGE)
+				failedKinds |= 1u << pointer.kind;
+			continue;
+		}
+		// a directory overlapping the TIFF header or the end of the buffer is corrupt
+		const uint64_t offs(uint64_t(tiff_header_start) + offset);
+		if (offset < 8 || offs + 2 > len ||
+			offs + 2 + 12u * Utils::parse16(buf + offs, alignIntel) + 4 > len) {
+			failedKinds |= 1u << pointer.kind;
+			continue;
+		}
+		bool visited(false);
+		for (int i = 0; i < numDirectories && !visited; ++i)
+			visited = directories[i].Offset == offs;
+		if (visited)
+			continue;
+		IFDDirectory& dir(directories[numDirectories]);
+		dir.Kind = pointer.kind;
+		dir.Offset = (unsigned)offs;
+		dir.Entries = Utils::parse16(buf + offs, alignIntel);
+		dir.PointerTag = pointer.tag;
+		dir.Parent = pointer.parent;
+		dir.NextField = dir.Offset + 2 + 12u * dir.Entries;
+		dir.Depth = pointer.parent < 0 ? 0 : directories[pointer.parent].Depth + (pointer.tag != 0 ? 1 : 0);
+		if (pointer.tag == 0)
+			++chainLength;
+		current = numDirectories++;
+		nextIndex = 0;
+		return true;
+	}
+	return false;
+}
+
+bool IFDWalker::nextEntry(IFDEntry& entry) {
+	if (current < 0 || nextIndex >= directories[current].Entries)
+		return false;
+	const unsigned offs(directories[current].Offset + 2 + 12 * nextIndex++);
+	entry.Directory = current;
+	entry.Kind = directories[current].Kind;
+	entry.Offset = offs;
+	entry.Tag = Utils::parse16(buf + offs, alignIntel);
+	entry.Type = Utils::parse16(buf + offs + 2, alignIntel);
+	entry.Count = Utils::parse32(buf + offs + 4, alignIntel);
+	const uint64_t size(uint64_t(typeSize(entry.Type)) * entry.Count);
+	entry.Size = size > 0xffffffffu ? 0xffffffffu : (uint32_t)size;
+	if (size <= 4) {
+		entry.Value = buf + offs + 8;
+	} else {
+		const uint64_t data(uint64_t(tiff_header_start) + Utils::parse32(buf + offs + 8, alignIntel));
+		entry.Value = data + size <= len ? buf + data : NULL;
+	}
+	queuePointer(offs, entry.Tag);
+	return true;
+}
+
+int MetadataLocation::locateIn(const uint8_t* data, unsigned length) {
+	clear();
+	int ret;
+	switch (Format = SniffContainer(data, length)) {
+	case CONTAINER_JPEG:
+		ret = LocateJPEG(data, length, *this);
+		break;
+	case CONTAINER_PNG:
+		ret = LocatePNG(data, length, *this);
+		break;
+	case CONTAINER_WEBP:
+		ret = LocateWebP(data, length, *this);
+		break;
+	case CONTAINER_TIFF:
+		TIFF = data;
+		TIFFLength = length;
+		return PARSE_SUCCESS;
+	default:
+		return PARSE_INVALID_JPEG;
+	}
+	if (ret != PARSE_SUCCESS)
+		return ret;
+	return TIFF != NULL || XMP != NULL ? PARSE_SUCCESS : PARSE_ABSENT_DATA;
+}
+
+//
+// Parse the metadata of any supported container: JPEG goes through parseFrom(),
+// keeping the frame header and extended XMP support; the other containers
+// carry the same TIFF structure and XMP packet in their own chunks.
+//
+int EXIFInfo::parseFromContainer(const uint8_t* buf, unsigned len) {
+	if (SniffContainer(buf, len) == CONTAINER_JPEG)
+		return parseFrom(buf, len);
+	TINYEXIF_STAT_TIMER(STAGE_PARSE);
+	clear();
+	// look only at the first MaxScanBytes bytes,
+	// metadata not found or broken within them is over the budget
+	const bool truncated(len > limits.MaxScanBytes);
+	if (truncated)
+		len = (unsigned)limits.MaxScanBytes;
+	MetadataLocation location;
+	int ret(location.locateIn(buf, len));
+	if (ret != PARSE_SUCCESS)
+		return truncated ? PARSE_LIMIT_EXCEEDED : ret;
+	if (location.TIFF != NULL) {
+		if ((ret=parseFromTIFF(location.TIFF, location.TIFFLength)) != PARSE_SUCCESS)
+			return truncated ? PARSE_LIMIT_EXCEEDED : ret;
+		Fields |= FIELD_EXIF;
+	}
+	if (location.XMP != NULL) {
+		switch (ret=parseFromXMPSegmentXML(location.XMP, location.XMPLength)) {
+		case PARSE_SUCCESS:
+			Fields |= FIELD_XMP;
+			break;
+		case PARSE_ABSENT_DATA:
+			break;
+		default:
+			return ret;
+		}
+	}
+	return Fields & FIELD_ALL ? PARSE_SUCCESS : PARSE_ABSENT_DATA;
 }
 
 //
@@ -771,6 +1452,28 @@ int EXIFInfo::parseFromEXIFSegment(const uint8_t* buf, unsigned len) {
 		return PARSE_ABSENT_DATA;
 	if (!std::equal(buf, buf+offs, "Exif\0\0"))
 		return PARSE_ABSENT_DATA;
+	return parseTIFF(buf, len, offs);
+}
+
+//
+// Parsing function for a bare TIFF structure, the payload of the PNG eXIf
+// and WebP EXIF chunks or a whole TIFF file.
+//
+// PARAM: 'buf' start of the TIFF header, which must be the bytes "II" or "MM".
+// PARAM: 'len' length of buffer
+//
+int EXIFInfo::parseFromTIFF(const uint8_t* buf, unsigned len) {
+	if (!buf || len < 2)
+		return PARSE_ABSENT_DATA;
+	return parseTIFF(buf, len, 0);
+}
+
+//
+// Parse the TIFF header and the IFDs; all the offsets stored in the
+// structure are relative to 'tiff_header_start'.
+//
+int EXIFInfo::parseTIFF(const uint8_t* buf, unsigned len, unsigned tiff_header_start) {
+	unsigned offs = tiff_header_start; // current offset into buffer
 
 	// Now parsing the TIFF header. The first two bytes are either "II" or
 	// "MM" for Intel or Motorola byte alignment. Sanity check by parsing
@@ -793,72 +1496,73 @@ int EXIFInfo::parseFromEXIFSegment(const uint8_t* buf, unsigned len) {
 		alignIntel = false; // 0: Motorola byte alignment
 	else
 		return PARSE_UNKNOWN_BYTEALIGN;
-	EntryParser parser(buf, len, offs, alignIntel);
+	EntryParser parser(buf, len, offs, alignIntel, viewStrings);
 	offs += 2;
 	if (0x2a != Utils::parse16(buf + offs, alignIntel))
 		return PARSE_CORRUPT_DATA;
-	offs += 2;
-	const unsigned first_ifd_offset = Utils::parse32(buf + offs, alignIntel);
-	offs += first_ifd_offset - 4;
-	if (offs >= len)
-		return PARSE_CORRUPT_DATA;
 
-	// Now parsing the first Image File Directory (IFD0, for the main image).
-	// An IFD consists of a variable number of 12-byte directory entries. The
-	// first two bytes of the IFD section contain the number of directory
-	// entries in the section. The last 4 bytes of the IFD contain an offset
-	// to the next IFD, which means this IFD must contain exactly 6 + 12 * num
-	// bytes of data.
-	if (offs + 2 > len)
-		return PARSE_CORRUPT_DATA;
-	int num_entries = Utils::parse16(buf + offs, alignIntel);
-	if (offs + 6 + 12 * num_entries > len)
-		return PARSE_CORRUPT_DATA;
-    
-//    std::cout << "IFD1, thumbnail offset:" << Utils::parse32(buf + offs + 2 + (12 * num_entries), alignIntel) << std::endl;
-    
-	unsigned exif_sub_ifd_offset = len;
-	unsigned gps_sub_ifd_offset  = len;
-	parser.Init(offs+2);
-	while (--num_entries >= 0) {
-		parser.ParseTag();
-		parseIFDImage(parser, exif_sub_ifd_offset, gps_sub_ifd_offset);
-	}
-
-	// Jump to the EXIF SubIFD if it exists and parse all the information
-	// there. Note that it's possible that the EXIF SubIFD doesn't exist.
-	// The EXIF SubIFD contains most of the interesting information that a
-	// typical user might want.
-	if (exif_sub_ifd_offset + 4 <= len) {
-		offs = exif_sub_ifd_offset;
-		num_entries = Utils::parse16(buf + offs, alignIntel);
-		if (offs + 6 + 12 * num_entries > len)
-			return PARSE_CORRUPT_DATA;
-		parser.Init(offs+2);
-		while (--num_entries >= 0) {
-			parser.ParseTag();
-			parseIFDExif(parser);
+	// Now walking the Image File Directories: IFD0 (for the main image), then
+	// the EXIF SubIFD and the GPS SubIFD if IFD0 points to them. The EXIF
+	// SubIFD contains most of the interesting information that a typical user
+	// might want. An IFD consists of a variable number of 12-byte directory
+	// entries, preceded by their 2-byte count and followed by the 4-byte offset
+	// to the next IFD; IFDWalker checks each of them fits in the buffer.
+	IFDWalker walker(buf, len, tiff_header_start, alignIntel, 1);
+	while (walker.nextDirectory()) {
+		const IFDDirectory& dir(walker.directory());
+		if ((unsigned)walker.count() > limits.MaxIFDs) {
+			limitExceeded = true;
+			return PARSE_LIMIT_EXCEEDED;
 		}
-	}
-
-	// Jump to the GPS SubIFD if it exists and parse all the information
-	// there. Note that it's possible that the GPS SubIFD doesn't exist.
-	if (gps_sub_ifd_offset + 4 <= len) {
-		offs = gps_sub_ifd_offset;
-		num_entries = Utils::parse16(buf + offs, alignIntel);
-		if (offs + 6 + 12 * num_entries > len)
-			return PARSE_CORRUPT_DATA;
-		parser.Init(offs+2);
-		while (--num_entries >= 0) {
+		if (!spendIFD(dir.Depth, dir.Entries))
+			return PARSE_LIMIT_EXCEEDED;
+		parser.Init(dir.Offset+2);
+		for (int num_entries = dir.Entries; --num_entries >= 0; ) {
 			parser.ParseTag();
-			parseIFDGPS(parser);
+			switch (dir.Kind) {
+			case IFD_IMAGE: parseIFDImage(parser); break;
+			case IFD_EXIF:  parseIFDExif(parser); break;
+			case IFD_GPS:   parseIFDGPS(parser); break;
+			default: break;
+			}
 		}
-		GeoLocation.parseCoords();
+		if (limitExceeded) // by the MakerNote
+			return PARSE_LIMIT_EXCEEDED;
+		if (dir.Kind == IFD_GPS)
+			GeoLocation.parseCoords();
 	}
+	if (walker.failed(IFD_IMAGE) || walker.failed(IFD_EXIF) || walker.failed(IFD_GPS))
+		return PARSE_CORRUPT_DATA;
 
 	return PARSE_SUCCESS;
 }
 
+//
+// Parsing function for a frame header (SOF0-SOF15 segment), following the marker and length:
+//   1 byte:  sample precision
+//   2 bytes: number of lines (height)
+//   2 bytes: number of samples per line (width)
+//   1 byte:  number of image components
+//   3 bytes for each component
+//
+// PARAM: 'marker' the SOF marker of the segment.
+// PARAM: 'buf' start of the frame header.
+// PARAM: 'len' length of buffer
+//
+int EXIFInfo::parseFromSOFSegment(uint8_t marker, const uint8_t* buf, unsigned len) {
+	if (!buf || !IsSOFMarker(marker))
+		return PARSE_ABSENT_DATA;
+	if (len < 6 || len < 6u + 3u * buf[5])
+		return PARSE_CORRUPT_DATA;
+	Frame.Marker      = marker;
+	Frame.Precision   = buf[0];
+	Frame.Height      = Utils::parse16(buf + 1, false);
+	Frame.Width       = Utils::parse16(buf + 3, false);
+	Frame.Components  = buf[5];
+	Frame.Progressive = marker == JM_SOF2 || marker == JM_SOF6 || marker == JM_SOF10 || marker == JM_SOF14;
+	return PARSE_SUCCESS;
+}
+
 //
 // Main parsing function for a XMP segment.
 // Do a sanity check by looking for bytes "http://ns.adobe.com/xap/1.0/\0".
@@ -878,14 +1582,34 @@ int EXIFInfo::parseFromXMPSegment(const uint8_t* buf, unsigned len) {
 		return PARSE_CORRUPT_DATA;
 	return parseFromXMPSegmentXML((const char*)(buf + offs), len - offs);
 }
+//
+// XMP packets are parsed into a document owned by the calling thread, which keeps
+// its character buffer and node pools between packets; a document grown by an
+// unusually large packet (extended XMP) is released instead of being kept.
+//
 int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len) {
+	thread_local std::unique_ptr<tinyxml2::XMLDocument> doc;
+	if (!doc) {
+		doc.reset(new tinyxml2::XMLDocument);
+		doc->SetRetainMemory(true);
+	}
+	const int ret(parseFromXMPSegmentXML(szXML, len, *doc));
+	if (len > MAX_RETAINED_XMP_LENGTH)
+		doc.reset();
+	return ret;
+}
+int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len, tinyxml2::XMLDocument& doc) {
+	if (len > limits.MaxXMPLength) {
+		limitExceeded = true;
+		return PARSE_LIMIT_EXCEEDED;
+	}
+
 	// Skip xpacket end section so that tinyxml2 lib parses the section correctly.
 	const char* szEnd(Tools::strrnstr(szXML, "<?xpacket end=", len));
 	if (szEnd != NULL)
 		len = (unsigned)(szEnd - szXML);
 
 	// Try parsing the XML packet.
-	tinyxml2::XMLDocument doc;
 	const tinyxml2::XMLElement* document;
 	if (doc.Parse(szXML, len) != tinyxml2::XML_SUCCESS ||
 		((document=doc.FirstChildElement("x:xmpmeta")) == NULL && (document=doc.FirstChildElement("xmp:xmpmeta")) == NULL) ||
@@ -893,6 +1617,22 @@ int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len) {
 		(document=document->FirstChildElement("rdf:Description")) == NULL)
 		return PARSE_ABSENT_DATA;
 
+	// Check if the rest of the packet is stored as extended XMP.
+	{
+	const char* szGUID(document->Attribute("xmpNote:HasExtendedXMP"));
+	if (szGUID == NULL) {
+		const tinyxml2::XMLElement* const element(document->FirstChildElement("xmpNote:HasExtendedXMP"));
+		if (element != NULL)
+			szGUID = element->GetText();
+	}
+	if (szGUID != NULL && strlen(szGUID) == 32 && ExtendedXMPGUID != szGUID) {
+		// chunks of another packet may have been collected already
+		ExtendedXMPGUID = szGUID;
+		ExtendedXMP.clear();
+		extendedXMPRanges.clear();
+	}
+	}
+
 	// Try parsing the XMP content for tiff details.
 	if (Orientation == 0) {
 		uint32_t _Orientation(0);
@@ -939,17 +1679,20 @@ int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len) {
 				if (element == NULL || (szAttribute=element->GetText()) == NULL)
 					return false;
 			}
-			std::vector<std::string> values;
-			Tools::strSplit(szAttribute, '/', values);
-			switch (values.size()) {
-			case 1: value = strtod(values.front().c_str(), NULL); return true;
-			case 2: value = strtod(values.front().c_str(), NULL)/strtod(values.back().c_str(), NULL); return true;
+			// strtod() stops at the slash, so both parts are read in place
+			const char* const szSlash(strchr(szAttribute, '/'));
+			if (szSlash == NULL) {
+				value = strtod(szAttribute, NULL);
+				return true;
 			}
-			return false;
+			if (strchr(szSlash+1, '/') != NULL)
+				return false;
+			value = strtod(szAttribute, NULL)/strtod(szSlash+1, NULL);
+			return true;
 		}
 	};
 	const char* szAbout(document->Attribute("rdf:about"));
-	if (0 == _tcsicmp(Make.c_str(), "DJI") || (szAbout != NULL && 0 == _tcsicmp(szAbout, "DJI Meta Data"))) {
+	if (isMake("DJI") || (szAbout != NULL && 0 == _tcsicmp(szAbout, "DJI Meta Data"))) {
 		ParseXMP::Value(document, "drone-dji:AbsoluteAltitude", GeoLocation.Altitude);
 		ParseXMP::Value(document, "drone-dji:RelativeAltitude", GeoLocation.RelativeAltitude);
 		ParseXMP::Value(document, "drone-dji:GimbalRollDegree", GeoLocation.RollDegree);
@@ -959,7 +1702,7 @@ int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len) {
 		ParseXMP::Value(document, "drone-dji:CalibratedOpticalCenterX", Calibration.OpticalCenterX);
 		ParseXMP::Value(document, "drone-dji:CalibratedOpticalCenterY", Calibration.OpticalCenterY);
 	} else
-	if (0 == _tcsicmp(Make.c_str(), "senseFly") || 0 == _tcsicmp(Make.c_str(), "Sentera")) {
+	if (isMake("senseFly") || isMake("Sentera")) {
 		ParseXMP::Value(document, "Camera:Roll", GeoLocation.RollDegree);
 		if (ParseXMP::Value(document, "Camera:Pitch", GeoLocation.PitchDegree)) {
 			// convert to DJI format: senseFly uses pitch 0 as NADIR, whereas DJI -90
@@ -969,7 +1712,7 @@ int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len) {
 		ParseXMP::Value(document, "Camera:GPSXYAccuracy", GeoLocation.AccuracyXY);
 		ParseXMP::Value(document, "Camera:GPSZAccuracy", GeoLocation.AccuracyZ);
 	} else
-	if (0 == _tcsicmp(Make.c_str(), "PARROT")) {
+	if (isMake("PARROT")) {
 		ParseXMP::Value(document, "Camera:Roll", GeoLocation.RollDegree) ||
 		ParseXMP::Value(document, "drone-parrot:CameraRollDegree", GeoLocation.RollDegree);
 		if (ParseXMP::Value(document, "Camera:Pitch", GeoLocation.PitchDegree) ||
@@ -985,6 +1728,97 @@ int EXIFInfo::parseFromXMPSegmentXML(const char* szXML, unsigned len) {
 	return PARSE_SUCCESS;
 }
 
+int EXIFInfo::parseFromExtendedXMPSegment(const uint8_t* buf, unsigned len) {
+	// header, GUID, full length and offset of this chunk
+	const unsigned header = 35;
+	unsigned offs = header + 32 + 4 + 4;
+	if (!buf || len < header)
+		return PARSE_ABSENT_DATA;
+	if (!std::equal(buf, buf+header, "http://ns.adobe.com/xmp/extension/\0"))
+		return PARSE_ABSENT_DATA;
+	if (offs > len)
+		return PARSE_CORRUPT_DATA;
+	const char* const guid((const char*)(buf + header));
+	const uint32_t fullLength(Utils::parse32(buf + header + 32, false));
+	const uint32_t offset(Utils::parse32(buf + header + 36, false));
+	const uint32_t size(len - offs);
+	if (fullLength == 0 || offset > fullLength || size > fullLength - offset)
+		return PARSE_CORRUPT_DATA;
+	if (fullLength > limits.MaxXMPLength) {
+		limitExceeded = true;
+		return PARSE_LIMIT_EXCEEDED;
+	}
+
+	if (ExtendedXMPGUID.empty()) {
+		// the standard packet was not seen yet, collect the first GUID found
+		ExtendedXMPGUID.assign(guid, 32);
+	} else
+	if (ExtendedXMPGUID.compare(0, std::string::npos, guid, 32) != 0) {
+		// not the extended XMP announced by the standard packet
+		return PARSE_SUCCESS;
+	}
+	if (ExtendedXMP.empty()) {
+		ExtendedXMP.resize(fullLength);
+		extendedXMPRanges.clear();
+	} else
+	if (ExtendedXMP.size() != fullLength) {
+		return PARSE_CORRUPT_DATA;
+	}
+	if (size == 0)
+		return PARSE_SUCCESS;
+	memcpy(&ExtendedXMP[offset], buf + offs, size);
+
+	// merge the range of this chunk with the ranges it overlaps or touches
+	typedef std::pair<uint32_t,uint32_t> Range;
+	Range range(offset, offset + size);
+	std::vector<Range>::iterator first(extendedXMPRanges.begin());
+	while (first != extendedXMPRanges.end() && first->second < range.first)
+		++first;
+	std::vector<Range>::iterator last(first);
+	for (; last != extendedXMPRanges.end() && last->first <= range.second; ++last) {
+		range.first = std::min(range.first, last->first);
+		range.second = std::max(range.second, last->second);
+	}
+	extendedXMPRanges.insert(extendedXMPRanges.erase(first, last), range);
+	return PARSE_SUCCESS;
+}
+
+void EXIFInfo::finishExtendedXMP() {
+	if (ExtendedXMP.empty())
+		return;
+	if (extendedXMPRanges.size() != 1 || extendedXMPRanges[0].first != 0 || extendedXMPRanges[0].second != ExtendedXMP.size()) {
+		// some chunks are missing
+		ExtendedXMP.clear();
+		extendedXMPRanges.clear();
+		return;
+	}
+	if (parseFromXMPSegmentXML(ExtendedXMP.data(), (unsigned)ExtendedXMP.size()) == PARSE_SUCCESS)
+		Fields |= FIELD_EXTENDED_XMP;
+}
+
+bool EXIFInfo::spendIFD(unsigned depth, unsigned entries) {
+	if (depth > limits.MaxDepth || entriesParsed > limits.MaxEntries || entries > limits.MaxEntries - entriesParsed) {
+		limitExceeded = true;
+		return false;
+	}
+	entriesParsed += entries;
+	return true;
+}
+
+bool EXIFInfo::isMake(const char* name) const {
+	if (Make.empty() && !Views.Make.empty())
+		return Views.Make.iequals(name);
+	return 0 == _tcsicmp(Make.c_str(), name);
+}
+
+
+bool StringView::equals(const char* sz) const {
+	return strlen(sz) == length && 0 == _tcsncmp(data, sz, length);
+}
+bool StringView::iequals(const char* sz) const {
+	return strlen(sz) == length && 0 == _tcsnicmp(data, sz, length);
+}
+
 
 void EXIFInfo::Geolocation_t::parseCoords() {
 	// Convert GPS latitude
@@ -1033,6 +1867,181 @@ bool EXIFInfo::Geolocation_t::hasSpeed() const {
 }
 
 
+// The EXIF date and time strings have a fixed layout, so instead of scanning them
+// one character at a time they are loaded as little-endian 64-bit words (byte i of
+// the string in bits 8i..8i+7) and all the digits of a word are validated and
+// converted together, within the register:
+//   "YYYY:MM:DD HH:MM:SS"     "YYYY:MM:DD"
+//    [word 0][word 1]          [word 0]
+//               [word 2]         [word 1]
+static const uint64_t DIGITS_YYYY_MM  = UINT64_C(0x00FFFF00FFFFFFFF); // "YYYY:MM:"
+static const uint64_t DIGITS_XX_XX_XX = UINT64_C(0xFFFF00FFFF00FFFF); // "DD HH:MM", "HH:MM:SS", "YY:MM:DD"
+
+// Load 8 characters as a little-endian word; compilers turn this into a single load.
+static inline uint64_t LoadWord(const char* str) {
+	const uint8_t* p = (const uint8_t*)str;
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+// Check that the bytes of 'word' selected by 'mask' are all '0'..'9' and replace
+// them by their values, clearing the other bytes.
+static inline bool DecodeDigits(uint64_t word, uint64_t mask, uint64_t& digits) {
+	// XOR maps exactly the characters '0'..'9' to 0..9
+	digits = (word ^ UINT64_C(0x3030303030303030)) & mask;
+	// adding 0x76 sets bit 7 of the bytes above 9; the bytes with bit 7 already set
+	// are caught by the OR, so whatever their carry spills does not matter
+	return (((digits + (UINT64_C(0x7676767676767676) & mask)) | digits) & UINT64_C(0x8080808080808080)) == 0;
+}
+
+// Two-digit numbers of decoded digits: byte i becomes 10*digit[i] + digit[i+1].
+static inline uint64_t PairDigits(uint64_t digits) {
+	return digits*10 + (digits >> 8);
+}
+
+static inline unsigned ByteAt(uint64_t word, unsigned i) {
+	return (unsigned)(word >> (i*8)) & 0xFF;
+}
+
+static inline bool IsDateSeparator(char c) {
+	return c == ':' || c == '-';
+}
+
+// Number of days from 1970-01-01 of a valid date of the proleptic Gregorian calendar
+// (Howard Hinnant's days_from_civil).
+static int64_t DaysFromCivil(int year, unsigned month, unsigned day) {
+	year -= month <= 2;
+	const int era = (year >= 0 ? year : year - 399) / 400;
+	const unsigned yoe = (unsigned)(year - era * 400);
+	const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (int64_t)era * 146097 + doe - 719468;
+}
+
+// Validate a date given as the paired digits of "YYYY:MM:" and the day.
+static bool MakeDays(uint64_t yearMonth, unsigned day, int64_t& days) {
+	static const uint8_t DAYS_IN_MONTH[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	const int year = (int)(ByteAt(yearMonth, 0) * 100 + ByteAt(yearMonth, 2));
+	const unsigned month = ByteAt(yearMonth, 5);
+	if (month < 1 || month > 12 || day < 1)
+		return false;
+	const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	if (day > DAYS_IN_MONTH[month-1] + (unsigned)(month == 2 && leap))
+		return false;
+	days = DaysFromCivil(year, month, day);
+	return true;
+}
+
+bool EXIFInfo::parseDate(const char* str, unsigned len, int64_t& days) {
+	if (len != 10 || !IsDateSeparator(str[4]) || str[7] != str[4])
+		return false;
+	uint64_t yearMonth, monthDay;
+	if (!DecodeDigits(LoadWord(str), DIGITS_YYYY_MM, yearMonth) ||
+		!DecodeDigits(LoadWord(str+2), DIGITS_XX_XX_XX, monthDay))
+		return false;
+	return MakeDays(PairDigits(yearMonth), ByteAt(PairDigits(monthDay), 6), days);
+}
+
+bool EXIFInfo::parseDateTime(const char* str, unsigned len, int64_t& micros) {
+	if (len != 19 || !IsDateSeparator(str[4]) || str[7] != str[4] ||
+		(str[10] != ' ' && str[10] != 'T') || str[13] != ':' || str[16] != ':')
+		return false;
+	uint64_t yearMonth, dayHourMinute, time;
+	if (!DecodeDigits(LoadWord(str), DIGITS_YYYY_MM, yearMonth) ||
+		!DecodeDigits(LoadWord(str+8), DIGITS_XX_XX_XX, dayHourMinute) ||
+		!DecodeDigits(LoadWord(str+11), DIGITS_XX_XX_XX, time))
+		return false;
+	dayHourMinute = PairDigits(dayHourMinute);
+	const unsigned hour = ByteAt(dayHourMinute, 3);
+	const unsigned minute = ByteAt(dayHourMinute, 6);
+	const unsigned second = ByteAt(PairDigits(time), 6);
+	int64_t days;
+	// a leap second (60) is counted as the first second of the next minute
+	if (hour > 23 || minute > 59 || second > 60 ||
+		!MakeDays(PairDigits(yearMonth), ByteAt(dayHourMinute, 0), days))
+		return false;
+	micros = (days * 86400 + hour * 3600 + minute * 60 + second) * INT64_C(1000000);
+	return true;
+}
+
+bool EXIFInfo::parseSubSecTime(const char* str, unsigned len, int32_t& micros) {
+	while (len > 0 && str[len-1] == ' ')
+		--len;
+	if (len == 0)
+		return false;
+	int32_t value = 0;
+	for (unsigned i=0; i<len; ++i) {
+		if (str[i] < '0' || str[i] > '9')
+			return false;
+		// digits past the microseconds are dropped
+		if (i < 6)
+			value = value*10 + (str[i] - '0');
+	}
+	for (unsigned i=len; i<6; ++i)
+		value *= 10;
+	micros = value;
+	return true;
+}
+
+bool EXIFInfo::parseOffsetTime(const char* str, unsigned len, int16_t& minutes) {
+	if (len != 6 || (str[0] != '+' && str[0] != '-') || str[3] != ':')
+		return false;
+	for (unsigned i=1; i<6; ++i)
+		if (i != 3 && (str[i] < '0' || str[i] > '9'))
+			return false;
+	const int hours = (str[1] - '0') * 10 + (str[2] - '0');
+	const int mins = (str[4] - '0') * 10 + (str[5] - '0');
+	if (hours > 23 || mins > 59)
+		return false;
+	const int value = hours * 60 + mins;
+	minutes = (int16_t)(str[0] == '-' ? -value : value);
+	return true;
+}
+
+// The copied string, or the view if parsing did not copy it.
+static inline StringView FieldView(const std::string& str, const StringView& view) {
+	return str.empty() ? view : StringView(str.data(), (unsigned)str.size());
+}
+
+// Combine a date and time with its fraction of a second and offset, both optional.
+static bool DecodeTimestamp(const StringView& dateTime, const StringView& subSecTime, const StringView& offsetTime, Timestamp& ts) {
+	int64_t micros;
+	if (!EXIFInfo::parseDateTime(dateTime.data, dateTime.length, micros))
+		return false;
+	int32_t fraction;
+	if (EXIFInfo::parseSubSecTime(subSecTime.data, subSecTime.length, fraction))
+		micros += fraction;
+	int16_t offset;
+	ts.HasOffset = EXIFInfo::parseOffsetTime(offsetTime.data, offsetTime.length, offset);
+	ts.OffsetMinutes = ts.HasOffset ? offset : 0;
+	ts.Micros = micros - (int64_t)ts.OffsetMinutes * 60000000;
+	return true;
+}
+
+bool EXIFInfo::getDateTime(Timestamp& ts) const {
+	return DecodeTimestamp(FieldView(DateTime, Views.DateTime), FieldView(SubSecTime, Views.SubSecTime), FieldView(OffsetTime, Views.OffsetTime), ts);
+}
+bool EXIFInfo::getDateTimeOriginal(Timestamp& ts) const {
+	return DecodeTimestamp(FieldView(DateTimeOriginal, Views.DateTimeOriginal), FieldView(SubSecTimeOriginal, Views.SubSecTimeOriginal), FieldView(OffsetTimeOriginal, Views.OffsetTimeOriginal), ts);
+}
+bool EXIFInfo::getDateTimeDigitized(Timestamp& ts) const {
+	return DecodeTimestamp(FieldView(DateTimeDigitized, Views.DateTimeDigitized), FieldView(SubSecTimeDigitized, Views.SubSecTimeDigitized), FieldView(OffsetTimeDigitized, Views.OffsetTimeDigitized), ts);
+}
+
+bool EXIFInfo::getGPSDateTime(Timestamp& ts) const {
+	const StringView date(FieldView(GeoLocation.GPSDateStamp, Views.GPSDateStamp));
+	int64_t days;
+	if (!parseDate(date.data, date.length, days))
+		return false;
+	if (GeoLocation.GPSTimeMicros < 0)
+		return false;
+	ts.Micros = days * 86400 * INT64_C(1000000) + GeoLocation.GPSTimeMicros;
+	ts.OffsetMinutes = 0;
+	ts.HasOffset = true;
+	return true;
+}
+
+
 void EXIFInfo::clear() {
 	Fields = FIELD_NA;
 
@@ -1045,7 +2054,12 @@ void EXIFInfo::clear() {
 	DateTime          = "";
 	DateTimeOriginal  = "";
 	DateTimeDigitized = "";
+	SubSecTime        = "";
 	SubSecTimeOriginal= "";
+	SubSecTimeDigitized= "";
+	OffsetTime        = "";
+	OffsetTimeOriginal= "";
+	OffsetTimeDigitized= "";
 	Copyright         = "";
 
 	// Shorts / unsigned / double
@@ -1110,6 +2124,7 @@ void EXIFInfo::clear() {
 	GeoLocation.GPSDifferential         = 0;
 	GeoLocation.GPSMapDatum             = "";
 	GeoLocation.GPSTimeStamp            = "";
+	GeoLocation.GPSTimeMicros           = -1;
 	GeoLocation.GPSDateStamp            = "";
 	GeoLocation.LatComponents.degrees   = DBL_MAX;
 	GeoLocation.LatComponents.minutes   = 0;
@@ -1119,6 +2134,26 @@ void EXIFInfo::clear() {
 	GeoLocation.LonComponents.minutes   = 0;
 	GeoLocation.LonComponents.seconds   = 0;
 	GeoLocation.LonComponents.direction = 0;
+
+	// Frame
+	Frame.Marker      = 0;
+	Frame.Precision   = 0;
+	Frame.Width       = 0;
+	Frame.Height      = 0;
+	Frame.Components  = 0;
+	Frame.Progressive = false;
+
+	// Extended XMP
+	ExtendedXMPGUID.clear();
+	ExtendedXMP.clear();
+	extendedXMPRanges.clear();
+
+	// String views
+	Views = StringViews_t();
+
+	// Budgets spent, the limits are kept
+	entriesParsed = 0;
+	limitExceeded = false;
 }
 
 } // namespace TinyEXIF
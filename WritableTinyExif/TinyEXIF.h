@@ -36,6 +36,7 @@
 
 #include <string>
 #include <vector>
+#include <utility>
 
 #define TINYEXIF_MAJOR_VERSION 1
 #define TINYEXIF_MINOR_VERSION 0
@@ -57,6 +58,10 @@
 
 #define IS_DEBUG true
 
+namespace tinyxml2 {
+class XMLDocument;
+}
+
 namespace TinyEXIF {
 
 enum ErrorCode {
@@ -65,17 +70,56 @@ enum ErrorCode {
 	PARSE_UNKNOWN_BYTEALIGN = 2, // Byte alignment specified in EXIF file was unknown (neither Motorola nor Intel)
 	PARSE_ABSENT_DATA       = 3, // No EXIF and/or XMP data found in JPEG file
 	PARSE_CORRUPT_DATA      = 4, // EXIF and/or XMP header was found, but data was corrupted
+	PARSE_LIMIT_EXCEEDED    = 5, // A budget of ParseLimits was exhausted and parsing was aborted
 };
 
 enum FieldCode {
 	FIELD_NA                 = 0, // No EXIF or XMP data
 	FIELD_EXIF               = (1 << 0), // EXIF data available
 	FIELD_XMP                = (1 << 1), // XMP data available
-	FIELD_ALL                = FIELD_EXIF|FIELD_XMP
+	FIELD_ALL                = FIELD_EXIF|FIELD_XMP,
+	FIELD_FRAME              = (1 << 2), // JPEG frame header (SOF) available
+	FIELD_EXTENDED_XMP       = (1 << 3)  // Extended XMP fully reassembled
+};
+
+enum ProbeCode {
+	PROBE_NA                 = 0, // No layout data
+	PROBE_ORIENTATION        = (1 << 0), // EXIF Orientation (tag 0x0112)
+	PROBE_EXIF_SIZE          = (1 << 1), // EXIF PixelXDimension/PixelYDimension (tags 0xa002/0xa003)
+	PROBE_FRAME_SIZE         = (1 << 2), // Frame size from the SOF0-SOF15 header
+	PROBE_ALL                = PROBE_ORIENTATION|PROBE_EXIF_SIZE|PROBE_FRAME_SIZE
+};
+
+enum ContainerFormat {
+	CONTAINER_UNKNOWN        = 0, // Not a supported image container
+	CONTAINER_JPEG           = 1, // JPEG: EXIF and XMP in APP1 segments
+	CONTAINER_PNG            = 2, // PNG: EXIF in the eXIf chunk, XMP in the iTXt chunk "XML:com.adobe.xmp"
+	CONTAINER_WEBP           = 3, // WebP: EXIF and XMP in the RIFF chunks "EXIF" and "XMP "
+	CONTAINER_TIFF           = 4  // TIFF/DNG: the whole file is the TIFF structure
 };
 
 class EntryParser;
 
+//
+// Non-owning reference to a string stored inside the buffer being parsed;
+// valid only as long as that buffer is alive (see EXIFInfo::parseViewFrom)
+//
+struct TINYEXIF_LIB StringView {
+	const char* data;                   // first character (not NULL terminated)
+	unsigned length;                    // number of characters
+
+	StringView() : data(NULL), length(0) {}
+	StringView(const char* _data, unsigned _length) : data(_data), length(_length) {}
+
+	bool empty() const { return length == 0; }
+	unsigned size() const { return length; }
+	std::string str() const { return empty() ? std::string() : std::string(data, length); }
+
+	// Compare with a NULL terminated string, case sensitive or not.
+	bool equals(const char* sz) const;
+	bool iequals(const char* sz) const;
+};
+
 //
 // Interface class responsible for fetching stream data to be parsed
 //
@@ -95,6 +139,197 @@ public:
 	virtual bool SkipBuffer(unsigned desiredLength) = 0;
 };
 
+//
+// Minimal layout information (orientation and dimensions) probed from a JPEG stream;
+// plain data, probing it does not allocate
+//
+struct TINYEXIF_LIB LayoutInfo {
+	// Probing function reading only the bytes needed for the requested values:
+	// the IFD0 and Exif IFD entries of the first EXIF segment and/or the SOF header.
+	// Stops at the first EXIF segment, or at the SOF header if PROBE_FRAME_SIZE is requested.
+	//
+	// PARAM 'stream': Interface to fetch JPEG image stream.
+	// PARAM 'data': A pointer to a JPEG image.
+	// PARAM 'length': The length of the JPEG image.
+	// PARAM 'what': PROBE_* flags of the values needed.
+	// RETURN:  PARSE_SUCCESS (0) if any requested value was found
+	//          error code otherwise, as defined by the PARSE_* macros
+	int probeFrom(EXIFStream& stream, uint32_t what=PROBE_ALL);
+	int probeFrom(const uint8_t* data, unsigned length, uint32_t what=PROBE_ALL);
+
+	uint32_t Fields;                    // PROBE_* flags of the values found
+	uint16_t Orientation;               // Image orientation (see EXIFInfo::Orientation)
+	uint32_t ImageWidth;                // Image width reported in EXIF data
+	uint32_t ImageHeight;               // Image height reported in EXIF data
+	uint16_t FrameWidth;                // Image width from the SOF header
+	uint16_t FrameHeight;               // Image height from the SOF header
+};
+
+//
+// Detect the image container from its magic bytes (at most the first 12 bytes are read).
+//
+TINYEXIF_LIB ContainerFormat SniffContainer(const uint8_t* data, unsigned length);
+
+//
+// Location of the metadata payloads inside an image buffer; plain pointers into
+// the buffer, nothing is copied. The EXIF payload is the bare TIFF structure
+// (any "Exif\0\0" prefix skipped), the XMP payload is the XML packet.
+//
+struct TINYEXIF_LIB MetadataLocation {
+	// Locating function: sniffs the container and walks its segments or chunks
+	// (JPEG APPn, PNG chunks, WebP RIFF chunks) without parsing the payloads.
+	// RETURN:  PARSE_SUCCESS (0) if EXIF and/or XMP was located
+	//          PARSE_INVALID_JPEG if the container is unknown or its structure broken
+	//          PARSE_ABSENT_DATA if the container carries no metadata
+	int locateIn(const uint8_t* data, unsigned length);
+
+	void clear();
+
+	ContainerFormat Format;             // container of the located buffer
+	const uint8_t* TIFF;                // EXIF payload (TIFF header and IFDs), NULL if absent
+	unsigned TIFFLength;                // length of the EXIF payload
+	const char* XMP;                    // XMP packet, NULL if absent
+	unsigned XMPLength;                 // length of the XMP packet
+	uint32_t Width;                     // image size from the PNG IHDR or the WebP VP8X/VP8/VP8L header
+	uint32_t Height;                    // (0 for JPEG and TIFF, see LayoutInfo)
+};
+
+//
+// Directories of a TIFF structure as walked by IFDWalker.
+//
+enum IFDKind {
+	IFD_IMAGE     = 0, // IFD0, the main image
+	IFD_EXIF      = 1, // Exif SubIFD (0x8769 in IFD0)
+	IFD_GPS       = 2, // GPS IFD (0x8825 in IFD0)
+	IFD_INTEROP   = 3, // Interoperability IFD (0xa005 in the Exif SubIFD)
+	IFD_THUMBNAIL = 4, // IFD1, next after IFD0 (the thumbnail in EXIF)
+	IFD_CHAINED   = 5, // any later IFD of the next-IFD chain (pages of a TIFF file)
+};
+
+struct TINYEXIF_LIB IFDDirectory {
+	IFDKind Kind;
+	unsigned Offset;                    // buffer offset of the entry count
+	uint16_t Entries;                   // number of 12-byte entries
+	uint16_t PointerTag;                // tag of the entry pointing here, 0 for the next-IFD chain
+	int Parent;                         // index of the directory holding the pointer, -1 for IFD0
+	unsigned NextField;                 // buffer offset of the 4-byte next-IFD offset
+	unsigned Depth;                     // SubIFD nesting: 0 for IFD0 and the next-IFD chain,
+	                                    // 1 for Exif and GPS, 2 for Interop
+};
+
+struct TINYEXIF_LIB IFDEntry {
+	int Directory;                      // index of the directory (see IFDWalker::directory())
+	IFDKind Kind;                       // kind of that directory
+	unsigned Offset;                    // buffer offset of the 12-byte entry
+	uint16_t Tag;
+	uint16_t Type;
+	uint32_t Count;
+	uint32_t Size;                      // byte size of the value, 0 for unknown types
+	const uint8_t* Value;               // the value: inside the entry when Size <= 4, else at the offset
+	                                    // it holds; NULL if that span is out of the buffer
+};
+
+//
+// Walker over the directories of a TIFF structure (EXIF payload): IFD0, then the
+// Exif, GPS and Interop SubIFDs where EXIF defines their pointers, and the
+// next-IFD chain from IFD0 (IFD1 and, for TIFF files, later pages).
+// Each directory is bounds-checked once when entered, so its entries are read
+// without further checks; directories out of the buffer, visited twice (cycles)
+// or beyond MAX_IFDS are skipped. Nothing is allocated.
+// Pointers are read only when the directory they point to is entered, so a
+// caller may rewrite the offsets of the entries it has seen while walking.
+//
+//	IFDWalker walker(buf, len, tiff_header_start, alignIntel);
+//	while (walker.nextDirectory())
+//		for (IFDEntry entry; walker.nextEntry(entry); ) ...
+//
+class TINYEXIF_LIB IFDWalker {
+public:
+	enum { MAX_IFDS = 16 };
+
+	// PARAM 'buf', 'len': buffer holding the TIFF structure
+	// PARAM 'tiff_header_start': offset of the TIFF header ("II*\0" or "MM\0*") in buf;
+	//                            all IFD and value offsets are relative to it
+	// PARAM 'alignIntel': byte order given by the header
+	// PARAM 'maxChain': number of directories followed on the next-IFD chain,
+	//                   counting IFD0 (1: IFD0 only, 2: IFD0 and IFD1)
+	IFDWalker(const uint8_t* buf, unsigned len, unsigned tiff_header_start, bool alignIntel, unsigned maxChain=2);
+
+	// Enter the next directory, skipping the remaining entries of the current one.
+	// RETURN: false when all directories were walked
+	bool nextDirectory();
+	// Read the next entry of the current directory.
+	// RETURN: false at the end of the directory
+	bool nextEntry(IFDEntry& entry);
+
+	// Current directory, valid after nextDirectory() returned true
+	const IFDDirectory& directory() const { return directories[current]; }
+	// Directories entered so far, in walk order
+	const IFDDirectory& directory(int index) const { return directories[index]; }
+	int count() const { return numDirectories; }
+	// Whether a directory of the given kind was skipped for being out of the buffer
+	bool failed(IFDKind kind) const { return (failedKinds & (1u << kind)) != 0; }
+
+	// Byte size of one value of the given TIFF type, 0 for unknown types
+	static uint32_t typeSize(uint16_t type);
+
+private:
+	struct Pointer {
+		unsigned field;                 // buffer offset of the 4-byte offset to follow
+		IFDKind kind;
+		uint16_t tag;
+		int parent;
+	};
+	void queue(unsigned field, IFDKind kind, uint16_t tag, int parent);
+	void queuePointer(unsigned entryOffset, uint16_t tag);
+
+	const uint8_t* buf;
+	unsigned len;
+	unsigned tiff_header_start;
+	bool alignIntel;
+	unsigned maxChain;
+	unsigned chainLength;
+	IFDDirectory directories[MAX_IFDS];
+	int numDirectories;
+	int current;
+	uint16_t nextIndex;                 // next entry of the current directory
+	Pointer pending[MAX_IFDS];          // directories to enter, first in first out
+	int pendingHead, pendingTail;
+	uint32_t failedKinds;
+};
+
+//
+// Per-file budgets bounding the work spent on a broken or hostile file.
+// Parsing stops with PARSE_LIMIT_EXCEEDED as soon as one is exhausted; the
+// fields parsed until then are kept. The defaults are far above what cameras
+// and editors write, lower them for untrusted input.
+//
+struct TINYEXIF_LIB ParseLimits {
+	ParseLimits();
+
+	unsigned MaxIFDs;                   // directories walked per TIFF structure (never more than IFDWalker::MAX_IFDS)
+	unsigned MaxEntries;                // IFD entries parsed per file, MakerNote entries included
+	unsigned MaxDepth;                  // directory nesting (see IFDDirectory::Depth), the MakerNote being at 2
+	unsigned MaxXMPLength;              // bytes of an XMP packet given to the XML parser, extended XMP included
+	uint64_t MaxScanBytes;              // bytes of the file read or skipped while looking for the metadata
+};
+
+//
+// Capture instant decoded from the EXIF date/time strings (see EXIFInfo::getDateTimeOriginal).
+// Without an offset the camera clock is counted as if it were UTC, which still orders
+// and buckets the photos of one camera correctly but not across time zones.
+//
+struct TINYEXIF_LIB Timestamp {
+	Timestamp() : Micros(0), OffsetMinutes(0), HasOffset(false) {}
+
+	int64_t Micros;                     // microseconds since 1970-01-01 00:00:00 UTC
+	int16_t OffsetMinutes;              // offset of the local time from UTC in minutes, 0 if unknown
+	bool HasOffset;                     // the offset is known, so Micros is a true UTC instant
+
+	// Local wall-clock time, in microseconds since 1970-01-01 00:00:00.
+	int64_t localMicros() const { return Micros + (int64_t)OffsetMinutes*60000000; }
+};
+
 //
 // Class responsible for storing and parsing EXIF & XMP metadata from a JPEG stream
 //
@@ -114,30 +349,112 @@ public:
 	int parseFrom(EXIFStream& stream);
 	int parseFrom(const uint8_t* data, unsigned length);
 
+	// Parsing function for an entire JPEG image buffer, without copying strings.
+	// The string fields are left empty and Views is filled instead, referencing
+	// the trimmed values inside 'data'; the caller must keep the buffer alive
+	// for as long as the views are used. XMP embedded in the EXIF IFD is also
+	// parsed in place.
+	int parseViewFrom(const uint8_t* data, unsigned length);
+
+	// Parsing function for an image buffer of any supported container (see SniffContainer).
+	// JPEG is parsed by parseFrom(); for PNG, WebP and TIFF the payloads found by
+	// MetadataLocation are handed to parseFromTIFF() and parseFromXMPSegmentXML().
+	int parseFromContainer(const uint8_t* data, unsigned length);
+
 	// Parsing function for an EXIF segment. This is used internally by parseFrom()
 	// but can be called for special cases where only the EXIF section is 
 	// available (i.e., a blob starting with the bytes "Exif\0\0").
 	int parseFromEXIFSegment(const uint8_t* buf, unsigned len);
 
+	// Parsing function for a bare TIFF structure (i.e., a blob starting with the
+	// bytes "II*\0" or "MM\0*"), as stored in PNG eXIf and WebP EXIF chunks or
+	// making up a whole TIFF/DNG file.
+	int parseFromTIFF(const uint8_t* buf, unsigned len);
+
 	// Parsing function for an XMP segment. This is used internally by parseFrom()
 	// but can be called for special cases where only the XMP section is 
 	// available (i.e., a blob starting with the bytes "http://ns.adobe.com/xap/1.0/\0").
 	int parseFromXMPSegment(const uint8_t* buf, unsigned len);
 	int parseFromXMPSegmentXML(const char* szXML, unsigned len);
+	// Same as above, parsing into the given document instead of the per-thread one.
+	// A document with SetRetainMemory(true) reused across calls keeps its character
+	// buffer and node pools, so steady-state parsing does not allocate.
+	int parseFromXMPSegmentXML(const char* szXML, unsigned len, tinyxml2::XMLDocument& doc);
+
+	// Parsing function for an extended XMP segment, one chunk of a packet too large
+	// for a single APP1 (i.e., a blob starting with the bytes "http://ns.adobe.com/xmp/extension/\0").
+	// The chunk is copied at its offset into ExtendedXMP, allocated once with the full
+	// length declared by the chunk, and its byte range is recorded: the packet is complete
+	// only when the ranges cover it entirely, so repeated chunks cannot hide missing ones.
+	// Chunks of a GUID different from the one announced by the standard XMP packet
+	// (xmpNote:HasExtendedXMP) are ignored.
+	int parseFromExtendedXMPSegment(const uint8_t* buf, unsigned len);
+
+	// Parsing function for a frame header (SOF0-SOF15 segment). This is used internally
+	// by parseFrom() but can be called for special cases where only the segment is
+	// available (i.e., a blob following the SOF marker and the segment length).
+	int parseFromSOFSegment(uint8_t marker, const uint8_t* buf, unsigned len);
+
+	// Budgets applied while parsing, see ParseLimits. They are spent per file,
+	// counting from the last clear(), which parsing a whole image calls first;
+	// clear() keeps the limits themselves.
+	void setLimits(const ParseLimits& _limits) { limits = _limits; }
+	const ParseLimits& getLimits() const { return limits; }
 
 	// Set all data members to default values.
 	// Should be called before parsing a new stream.
+	// Strings and vectors keep their capacity, so one EXIFInfo reused for a batch
+	// of images parses without allocating once its fields have grown to size
+	// (XMP is parsed into a per-thread document, see parseFromXMPSegmentXML()).
 	void clear();
 
+	// Decode the date/time fields into instants: DateTime, DateTimeOriginal and
+	// DateTimeDigitized are combined with their SubSecTime* fraction and OffsetTime*
+	// offset, the GPS date and time stamps are UTC. The views are used if the strings
+	// were not copied (see parseViewFrom).
+	// RETURN: false if the field is missing or malformed, like the "0000:00:00 00:00:00"
+	//         written by cameras whose clock was never set
+	bool getDateTime(Timestamp& ts) const;
+	bool getDateTimeOriginal(Timestamp& ts) const;
+	bool getDateTimeDigitized(Timestamp& ts) const;
+	bool getGPSDateTime(Timestamp& ts) const;
+
+	// Fixed-format decoders used by the functions above, validating and converting
+	// eight characters at a time.
+	// "YYYY:MM:DD HH:MM:SS" (or "YYYY-MM-DDTHH:MM:SS") into microseconds since the epoch, as UTC.
+	static bool parseDateTime(const char* str, unsigned len, int64_t& micros);
+	// "YYYY:MM:DD" into days since 1970-01-01.
+	static bool parseDate(const char* str, unsigned len, int64_t& days);
+	// SubSecTime digits, the decimal fraction of a second, into microseconds.
+	static bool parseSubSecTime(const char* str, unsigned len, int32_t& micros);
+	// OffsetTime "+HH:MM" or "-HH:MM" into minutes.
+	static bool parseOffsetTime(const char* str, unsigned len, int16_t& minutes);
+
 private:
+	// Parse the markers of a JPEG stream.
+	int parseJPEG(EXIFStream& stream);
+	// Parse the TIFF structure starting at offset 'tiff_header_start' of 'buf'.
+	int parseTIFF(const uint8_t* buf, unsigned len, unsigned tiff_header_start);
 	// Parse tag as Image IFD.
-	void parseIFDImage(EntryParser&, unsigned&, unsigned&);
+	void parseIFDImage(EntryParser&);
 	// Parse tag as Exif IFD.
 	void parseIFDExif(EntryParser&);
 	// Parse tag as GPS IFD.
 	void parseIFDGPS(EntryParser&);
 	// Parse tag as MakerNote IFD.
 	void parseIFDMakerNote(EntryParser&);
+	// Compare camera maker, either copied or referenced.
+	bool isMake(const char* name) const;
+	// Parse the extended XMP once all its chunks were collected.
+	void finishExtendedXMP();
+	// Account a directory of the given depth and number of entries against the limits.
+	bool spendIFD(unsigned depth, unsigned entries);
+
+	bool viewStrings;                   // fill Views instead of the string fields while parsing
+	std::vector<std::pair<uint32_t,uint32_t> > extendedXMPRanges; // [begin, end) byte ranges of the extended XMP collected so far, sorted and merged
+	ParseLimits limits;                 // budgets of each parse
+	unsigned entriesParsed;             // IFD entries parsed since clear()
+	bool limitExceeded;                 // a budget was exhausted since clear()
 
 public:
 	// Data fields
@@ -168,7 +485,12 @@ public:
 	std::string DateTime;               // File change date and time
 	std::string DateTimeOriginal;       // Original file date and time (may not exist)
 	std::string DateTimeDigitized;      // Digitization date and time (may not exist)
+	std::string SubSecTime;             // Sub-second time of DateTime
 	std::string SubSecTimeOriginal;     // Sub-second time that original picture was taken
+	std::string SubSecTimeDigitized;    // Sub-second time of DateTimeDigitized
+	std::string OffsetTime;             // Offset from UTC of DateTime, "+HH:MM" or "-HH:MM" (may not exist)
+	std::string OffsetTimeOriginal;     // Offset from UTC of DateTimeOriginal (may not exist)
+	std::string OffsetTimeDigitized;    // Offset from UTC of DateTimeDigitized (may not exist)
 	std::string Copyright;              // File copyright information
 	double ExposureTime;                // Exposure time in seconds
 	double FNumber;                     // F/stop
@@ -286,6 +608,7 @@ public:
 										// 1: differential correction applied 
 		std::string GPSMapDatum;        // Geodetic survey data (may not exist)
 		std::string GPSTimeStamp;       // Time as UTC (Coordinated Universal Time) (may not exist)
+		int64_t GPSTimeMicros;          // GPSTimeStamp in microseconds since midnight UTC, -1 if not available
 		std::string GPSDateStamp;       // A character string recording date and time information relative to UTC (Coordinated Universal Time) YYYY:MM:DD (may not exist)
 		struct Coord_t {
 			double degrees;
@@ -300,6 +623,37 @@ public:
 		bool hasOrientation() const;    // Return true if (roll,yaw,pitch) is available
 		bool hasSpeed() const;          // Return true if (speedX,speedY,speedZ) is available
 	} GeoLocation;
+	struct TINYEXIF_LIB Frame_t {       // JPEG frame header (SOF0-SOF15), the true image size
+		uint8_t Marker;                 // SOF marker (0xC0-0xCF), 0 if not found
+		uint8_t Precision;              // Sample precision in bits
+		uint16_t Width;                 // Number of samples per line
+		uint16_t Height;                // Number of lines (0: defined later by the DNL marker)
+		uint8_t Components;             // Number of image components
+		bool Progressive;               // Progressive (SOF2, SOF6, SOF10, SOF14) or sequential coding
+	} Frame;
+	std::string ExtendedXMPGUID;        // GUID of the extended XMP (MD5 of the extended packet, 32 hex digits)
+	std::string ExtendedXMP;            // Extended XMP packet reassembled from all chunks (empty if incomplete)
+	struct TINYEXIF_LIB StringViews_t { // String fields referencing the parsed buffer (filled only by parseViewFrom)
+		StringView ImageDescription;
+		StringView Make;
+		StringView Model;
+		StringView SerialNumber;
+		StringView Software;
+		StringView DateTime;
+		StringView DateTimeOriginal;
+		StringView DateTimeDigitized;
+		StringView SubSecTime;
+		StringView SubSecTimeOriginal;
+		StringView SubSecTimeDigitized;
+		StringView OffsetTime;
+		StringView OffsetTimeOriginal;
+		StringView OffsetTimeDigitized;
+		StringView Copyright;
+		StringView LensMake;
+		StringView LensModel;
+		StringView GPSMapDatum;
+		StringView GPSDateStamp;
+	} Views;
 };
 
 } // namespace TinyEXIF
@@ -0,0 +1,759 @@
+//
+//  TinyExifArrow.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifArrow.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace TinyEXIF {
+
+namespace {
+
+// Arrow IPC格式的常量，见Arrow的format/Schema.fbs和Message.fbs
+const uint32_t CONTINUATION_MARKER = 0xFFFFFFFF;
+const char FILE_MAGIC[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+const int16_t METADATA_V5 = 4;
+const int16_t ENDIANNESS_LITTLE = 0;
+const int16_t ENDIANNESS_BIG = 1;
+const int16_t PRECISION_DOUBLE = 2;
+
+// Message.header的类型
+const uint8_t HEADER_SCHEMA = 1;
+const uint8_t HEADER_DICTIONARY_BATCH = 2;
+const uint8_t HEADER_RECORD_BATCH = 3;
+
+// Field.type的类型
+const uint8_t TYPE_INT = 2;
+const uint8_t TYPE_FLOATING_POINT = 3;
+const uint8_t TYPE_UTF8 = 5;
+
+// 字典编号，对应visitColumns中的字典列
+const int DICTIONARY_MAKE = 0;
+const int DICTIONARY_MODEL = 1;
+const int DICTIONARY_SOFTWARE = 2;
+const int DICTIONARY_GPS_MAP_DATUM = 3;
+const int DICTIONARY_COUNT = 4;
+
+// appendFiles每次并行解析的文件数，解析完按顺序追加
+const size_t PARSE_CHUNK = 1024;
+
+const uint8_t ZEROS[8] = {0};
+
+inline size_t padded8(size_t len) {
+    return (len + 7) & ~(size_t)7;
+}
+
+// flatbuffers总是小端
+inline void putLittleEndian(uint8_t *p, uint64_t value, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+template <typename T>
+inline uint64_t bitsOf(T value) {
+    return (uint64_t)value;
+}
+
+inline uint64_t bitsOf(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// 列的值按本机字节序写入，schema中声明本机的字节序
+int16_t hostEndianness() {
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 1 ? ENDIANNESS_LITTLE : ENDIANNESS_BIG;
+}
+
+// 从后往前生成flatbuffer，只支持IPC元数据用到的标量、字符串、表、offset和struct的数组
+// 位置都用距离末尾的字节数表示，扩容时不会改变
+class FlatBuilder {
+public:
+    FlatBuilder() : buffer(512), head(512), minAlign(1), tableStart(0) {}
+
+    uint32_t size() const {
+        return (uint32_t)(buffer.size() - head);
+    }
+
+    // 之后插入len个字节时，插入的数据按alignment对齐
+    void align(size_t len, size_t alignment) {
+        minAlign = std::max(minAlign, alignment);
+        pad((alignment - ((size() + len) & (alignment - 1))) & (alignment - 1));
+    }
+
+    void pad(size_t len) {
+        memset(reserve(len), 0, len);
+    }
+
+    void bytes(const void *data, size_t len) {
+        memcpy(reserve(len), data, len);
+    }
+
+    template <typename T>
+    void scalar(T value) {
+        align(sizeof(T), sizeof(T));
+        putLittleEndian(reserve(sizeof(T)), bitsOf(value), sizeof(T));
+    }
+
+    // 指向target的uoffset
+    void offset(uint32_t target) {
+        align(4, 4);
+        putLittleEndian(reserve(4), size() + 4 - target, 4);
+    }
+
+    uint32_t string(const std::string &value) {
+        align(value.size() + 1, 4);
+        pad(1);
+        bytes(value.data(), value.size());
+        scalar<uint32_t>((uint32_t)value.size());
+        return size();
+    }
+
+    // 之后从最后一个元素开始插入count个元素，然后调用endVector
+    void startVector(size_t count, size_t elementSize, size_t alignment) {
+        align(count * elementSize, 4);
+        align(count * elementSize, alignment);
+    }
+
+    uint32_t endVector(size_t count) {
+        scalar<uint32_t>((uint32_t)count);
+        return size();
+    }
+
+    uint32_t offsetVector(const std::vector<uint32_t> &targets) {
+        startVector(targets.size(), 4, 4);
+        for (size_t i = targets.size(); i > 0; i--) {
+            offset(targets[i - 1]);
+        }
+        return endVector(targets.size());
+    }
+
+    // 表的字段引用的字符串、数组和表要在startTable之前生成
+    void startTable() {
+        fields.clear();
+        tableStart = size();
+    }
+
+    template <typename T>
+    void add(int field, T value) {
+        scalar(value);
+        fields.push_back(std::make_pair(field, size()));
+    }
+
+    void addOffset(int field, uint32_t target) {
+        offset(target);
+        fields.push_back(std::make_pair(field, size()));
+    }
+
+    // 写入指向vtable的soffset，然后在表的前面生成vtable
+    uint32_t endTable() {
+        scalar<int32_t>(0);
+        const uint32_t table = size();
+        int count = 0;
+        for (const std::pair<int, uint32_t> &field : fields) {
+            count = std::max(count, field.first + 1);
+        }
+        std::vector<uint16_t> slots(count, 0);
+        for (const std::pair<int, uint32_t> &field : fields) {
+            slots[field.first] = (uint16_t)(table - field.second);
+        }
+        for (int i = count - 1; i >= 0; i--) {
+            scalar<uint16_t>(slots[i]);
+        }
+        scalar<uint16_t>((uint16_t)(table - tableStart));
+        scalar<uint16_t>((uint16_t)(4 + 2 * count));
+        putLittleEndian(buffer.data() + buffer.size() - table, size() - table, 4);
+        return table;
+    }
+
+    std::vector<uint8_t> finish(uint32_t root) {
+        align(4, minAlign);
+        offset(root);
+        return std::vector<uint8_t>(buffer.begin() + head, buffer.end());
+    }
+
+private:
+    uint8_t* reserve(size_t len) {
+        if (head < len) {
+            const size_t used = size();
+            size_t capacity = buffer.size() * 2;
+            while (capacity < used + len) {
+                capacity *= 2;
+            }
+            std::vector<uint8_t> grown(capacity);
+            memcpy(grown.data() + capacity - used, buffer.data() + head, used);
+            buffer.swap(grown);
+            head = capacity - used;
+        }
+        head -= len;
+        return buffer.data() + head;
+    }
+
+    std::vector<uint8_t> buffer;
+    size_t head;                                    // 已生成的数据从head开始
+    size_t minAlign;
+    uint32_t tableStart;
+    std::vector<std::pair<int, uint32_t> > fields;  // 当前表的字段编号和位置
+};
+
+// FieldNode和Buffer都是两个int64的struct
+typedef std::pair<int64_t, int64_t> Pair64;
+
+uint32_t pairVector(FlatBuilder &fb, const std::vector<Pair64> &pairs) {
+    fb.startVector(pairs.size(), 16, 8);
+    for (size_t i = pairs.size(); i > 0; i--) {
+        uint8_t bytes[16];
+        putLittleEndian(bytes, (uint64_t)pairs[i - 1].first, 8);
+        putLittleEndian(bytes + 8, (uint64_t)pairs[i - 1].second, 8);
+        fb.bytes(bytes, sizeof(bytes));
+    }
+    return fb.endVector(pairs.size());
+}
+
+uint32_t blockVector(FlatBuilder &fb, const std::vector<ArrowExporter::Block> &blocks) {
+    fb.startVector(blocks.size(), 24, 8);
+    for (size_t i = blocks.size(); i > 0; i--) {
+        const ArrowExporter::Block &block = blocks[i - 1];
+        uint8_t bytes[24] = {0};
+        putLittleEndian(bytes, block.offset, 8);
+        putLittleEndian(bytes + 8, block.metaDataLength, 4);
+        putLittleEndian(bytes + 16, block.bodyLength, 8);
+        fb.bytes(bytes, sizeof(bytes));
+    }
+    return fb.endVector(blocks.size());
+}
+
+uint32_t intType(FlatBuilder &fb, int32_t bitWidth, bool isSigned) {
+    fb.startTable();
+    fb.add<int32_t>(0, bitWidth);
+    fb.add<bool>(1, isSigned);
+    return fb.endTable();
+}
+
+uint32_t buildSchema(FlatBuilder &fb, const std::vector<ArrowExporter::Column> &columns) {
+    std::vector<uint32_t> fields;
+    for (const ArrowExporter::Column &column : columns) {
+        const uint32_t name = fb.string(column.name);
+        uint32_t type;
+        if (column.typeId == TYPE_INT) {
+            type = intType(fb, column.bitWidth, column.isSigned);
+        } else if (column.typeId == TYPE_FLOATING_POINT) {
+            fb.startTable();
+            fb.add<int16_t>(0, PRECISION_DOUBLE);
+            type = fb.endTable();
+        } else {
+            fb.startTable();
+            type = fb.endTable();
+        }
+        uint32_t dictionary = 0;
+        if (column.dictionary >= 0) {
+            const uint32_t indexType = intType(fb, 32, true);
+            fb.startTable();
+            fb.add<int64_t>(0, column.dictionary);
+            fb.addOffset(1, indexType);
+            fb.add<bool>(2, false);
+            dictionary = fb.endTable();
+        }
+        const uint32_t children = fb.offsetVector(std::vector<uint32_t>());
+        fb.startTable();
+        fb.addOffset(0, name);
+        fb.add<bool>(1, column.nullable);
+        fb.add<uint8_t>(2, column.typeId);
+        fb.addOffset(3, type);
+        if (dictionary != 0) {
+            fb.addOffset(4, dictionary);
+        }
+        fb.addOffset(5, children);
+        fields.push_back(fb.endTable());
+    }
+    const uint32_t fieldVector = fb.offsetVector(fields);
+    fb.startTable();
+    fb.add<int16_t>(0, hostEndianness());
+    fb.addOffset(1, fieldVector);
+    return fb.endTable();
+}
+
+uint32_t buildRecordBatch(FlatBuilder &fb, int64_t length, const std::vector<Pair64> &nodes, const std::vector<Pair64> &buffers) {
+    const uint32_t nodeVector = pairVector(fb, nodes);
+    const uint32_t bufferVector = pairVector(fb, buffers);
+    fb.startTable();
+    fb.add<int64_t>(0, length);
+    fb.addOffset(1, nodeVector);
+    fb.addOffset(2, bufferVector);
+    return fb.endTable();
+}
+
+std::vector<uint8_t> finishMessage(FlatBuilder &fb, uint8_t headerType, uint32_t header, int64_t bodyLength) {
+    fb.startTable();
+    fb.add<int16_t>(0, METADATA_V5);
+    fb.add<uint8_t>(1, headerType);
+    fb.addOffset(2, header);
+    fb.add<int64_t>(3, bodyLength);
+    return fb.finish(fb.endTable());
+}
+
+// 计算body中每个buffer的位置，每个buffer按8字节对齐
+int64_t layoutBody(const std::vector<const std::vector<uint8_t> *> &body, std::vector<Pair64> &buffers) {
+    int64_t offset = 0;
+    for (const std::vector<uint8_t> *buffer : body) {
+        buffers.push_back(Pair64(offset, (int64_t)buffer->size()));
+        offset += (int64_t)padded8(buffer->size());
+    }
+    return offset;
+}
+
+template <typename T>
+inline void appendValue(std::vector<uint8_t> &values, T value) {
+    const size_t size = values.size();
+    values.resize(size + sizeof(T));
+    memcpy(values.data() + size, &value, sizeof(T));
+}
+
+// 字符串的offset是int32，超出的字符串写为空
+inline void appendString(std::vector<uint8_t> &values, std::vector<uint8_t> &data, const std::string &value) {
+    if (data.size() + value.size() <= INT32_MAX) {
+        data.insert(data.end(), value.begin(), value.end());
+    }
+    appendValue(values, (int32_t)data.size());
+}
+
+ArrowExporter::Column makeColumn(const char *name, uint8_t typeId, uint8_t bitWidth, bool isSigned) {
+    ArrowExporter::Column column;
+    column.name = name;
+    column.typeId = typeId;
+    column.bitWidth = bitWidth;
+    column.isSigned = isSigned;
+    column.nullable = false;
+    column.dictionary = -1;
+    column.nullCount = 0;
+    return column;
+}
+
+// 清空一个batch的数据，保留容量
+void resetColumn(ArrowExporter::Column &column) {
+    column.validity.clear();
+    column.nullCount = 0;
+    column.values.clear();
+    column.data.clear();
+    if (column.typeId == TYPE_UTF8 && column.dictionary < 0) {
+        appendValue(column.values, (int32_t)0);
+    }
+}
+
+// 导出的所有列，按schema中的顺序，visitor对每一列调用一次
+template <typename Visitor>
+void visitColumns(Visitor &v, const std::string &path, int32_t parseCode, const EXIFInfo &info) {
+    v.string("path", path);
+    v.scalar("parse_code", parseCode);
+    v.dictionary("make", DICTIONARY_MAKE, info.Make);
+    v.dictionary("model", DICTIONARY_MODEL, info.Model);
+    v.dictionary("software", DICTIONARY_SOFTWARE, info.Software);
+    v.string("image_description", info.ImageDescription);
+    v.string("copyright", info.Copyright);
+    v.string("lens_make", info.LensInfo.Make);
+    v.string("lens_model", info.LensInfo.Model);
+    v.string("serial_number", info.SerialNumber);
+    v.scalar("image_width", info.ImageWidth);
+    v.scalar("image_height", info.ImageHeight);
+    v.scalar("frame_width", info.Frame.Width);
+    v.scalar("frame_height", info.Frame.Height);
+    v.scalar("orientation", info.Orientation);
+    v.scalar("x_resolution", info.XResolution);
+    v.scalar("y_resolution", info.YResolution);
+    v.scalar("resolution_unit", info.ResolutionUnit);
+    v.string("datetime", info.DateTime);
+    v.string("datetime_original", info.DateTimeOriginal);
+    v.string("datetime_digitized", info.DateTimeDigitized);
+    v.string("subsec_time_original", info.SubSecTimeOriginal);
+    v.scalar("exposure_time", info.ExposureTime);
+    v.scalar("f_number", info.FNumber);
+    v.scalar("exposure_program", info.ExposureProgram);
+    v.scalar("shutter_speed_value", info.ShutterSpeedValue);
+    v.scalar("aperture_value", info.ApertureValue);
+    v.scalar("brightness_value", info.BrightnessValue);
+    v.scalar("subject_distance", info.SubjectDistance);
+    v.scalar("focal_length", info.FocalLength);
+    v.scalar("focal_length_35mm", info.LensInfo.FocalLengthIn35mm);
+    v.scalar("focal_length_min", info.LensInfo.FocalLengthMin);
+    v.scalar("focal_length_max", info.LensInfo.FocalLengthMax);
+    v.scalar("f_stop_min", info.LensInfo.FStopMin);
+    v.scalar("f_stop_max", info.LensInfo.FStopMax);
+    v.scalar("exposure_bias", info.ExposureBiasValue);
+    v.scalar("iso", info.ISOSpeedRatings);
+    v.scalar("flash", info.Flash);
+    v.scalar("metering_mode", info.MeteringMode);
+    v.scalar("light_source", info.LightSource);
+    v.scalar("calibration_focal_length", info.Calibration.FocalLength);
+    v.scalar("calibration_optical_center_x", info.Calibration.OpticalCenterX);
+    v.scalar("calibration_optical_center_y", info.Calibration.OpticalCenterY);
+    const bool hasLatLon = info.GeoLocation.hasLatLon();
+    v.nullable("latitude", info.GeoLocation.Latitude, hasLatLon);
+    v.nullable("longitude", info.GeoLocation.Longitude, hasLatLon);
+    v.nullable("altitude", info.GeoLocation.Altitude, info.GeoLocation.hasAltitude());
+    v.nullable("relative_altitude", info.GeoLocation.RelativeAltitude, info.GeoLocation.hasRelativeAltitude());
+    const bool hasOrientation = info.GeoLocation.hasOrientation();
+    v.nullable("yaw", info.GeoLocation.YawDegree, hasOrientation);
+    v.nullable("pitch", info.GeoLocation.PitchDegree, hasOrientation);
+    v.nullable("roll", info.GeoLocation.RollDegree, hasOrientation);
+    v.scalar("gps_dop", info.GeoLocation.GPSDOP);
+    v.dictionary("gps_map_datum", DICTIONARY_GPS_MAP_DATUM, info.GeoLocation.GPSMapDatum);
+    v.string("gps_date_stamp", info.GeoLocation.GPSDateStamp);
+    v.string("gps_time_stamp", info.GeoLocation.GPSTimeStamp);
+}
+
+// 生成列的类型
+class SchemaVisitor {
+public:
+    explicit SchemaVisitor(std::vector<ArrowExporter::Column> &_columns) : columns(_columns) {}
+
+    void string(const char *name, const std::string &) {
+        add(makeColumn(name, TYPE_UTF8, 0, false));
+    }
+    void dictionary(const char *name, int id, const std::string &) {
+        ArrowExporter::Column column = makeColumn(name, TYPE_UTF8, 0, false);
+        column.dictionary = id;
+        add(column);
+    }
+    void scalar(const char *name, int32_t) {
+        add(makeColumn(name, TYPE_INT, 32, true));
+    }
+    void scalar(const char *name, uint32_t) {
+        add(makeColumn(name, TYPE_INT, 32, false));
+    }
+    void scalar(const char *name, uint16_t) {
+        add(makeColumn(name, TYPE_INT, 16, false));
+    }
+    void scalar(const char *name, double) {
+        add(makeColumn(name, TYPE_FLOATING_POINT, 64, true));
+    }
+    void nullable(const char *name, double, bool) {
+        ArrowExporter::Column column = makeColumn(name, TYPE_FLOATING_POINT, 64, true);
+        column.nullable = true;
+        add(column);
+    }
+
+private:
+    void add(const ArrowExporter::Column &column) {
+        columns.push_back(column);
+        resetColumn(columns.back());
+    }
+
+    std::vector<ArrowExporter::Column> &columns;
+};
+
+// 在当前batch中追加一行
+class RowVisitor {
+public:
+    RowVisitor(std::vector<ArrowExporter::Column> &_columns, std::vector<ArrowExporter::Dictionary> &_dictionaries, uint32_t _row)
+        : columns(_columns), dictionaries(_dictionaries), row(_row), index(0) {}
+
+    void string(const char *, const std::string &value) {
+        ArrowExporter::Column &column = next();
+        appendString(column.values, column.data, value);
+    }
+    void dictionary(const char *, int id, const std::string &value) {
+        ArrowExporter::Dictionary &dictionary = dictionaries[id];
+        std::unordered_map<std::string, int32_t>::const_iterator it = dictionary.index.find(value);
+        int32_t code;
+        if (it != dictionary.index.end()) {
+            code = it->second;
+        } else {
+            code = (int32_t)dictionary.values.size();
+            dictionary.index.insert(std::make_pair(value, code));
+            dictionary.values.push_back(value);
+        }
+        appendValue(next().values, code);
+    }
+    template <typename T>
+    void scalar(const char *, T value) {
+        appendValue(next().values, value);
+    }
+    void nullable(const char *, double value, bool valid) {
+        ArrowExporter::Column &column = next();
+        column.validity.resize(row / 8 + 1);
+        if (valid) {
+            column.validity[row / 8] |= (uint8_t)(1 << (row % 8));
+        } else {
+            value = 0;
+            column.nullCount++;
+        }
+        appendValue(column.values, value);
+    }
+
+private:
+    ArrowExporter::Column& next() {
+        return columns[index++];
+    }
+
+    std::vector<ArrowExporter::Column> &columns;
+    std::vector<ArrowExporter::Dictionary> &dictionaries;
+    const uint32_t row;
+    size_t index;
+};
+
+bool readFile(const std::string &path, std::vector<uint8_t> &data) {
+    std::ifstream in (path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+        return false;
+    }
+    const std::streamoff size = in.tellg();
+    if (size <= 0 || (uint64_t)size > UINT32_MAX) {
+        return false;
+    }
+    data.resize((size_t)size);
+    in.seekg(0);
+    return (bool)in.read((char *)data.data(), size);
+}
+
+}
+
+ArrowExporter::ArrowExporter(uint32_t _batchRows)
+    : batchRows(std::max(1u, _batchRows)), format(ARROW_FILE), position(0), batchLength(0), totalRows(0) {
+}
+
+ArrowExporter::~ArrowExporter() {
+    close();
+}
+
+bool ArrowExporter::open(const std::string &path, ArrowFormat _format) {
+    close();
+    format = _format;
+    position = 0;
+    batchLength = 0;
+    totalRows = 0;
+    columns.clear();
+    dictionaries.assign(DICTIONARY_COUNT, Dictionary());
+    for (Dictionary &dictionary : dictionaries) {
+        dictionary.written = 0;
+    }
+    dictionaryBlocks.clear();
+    batchBlocks.clear();
+    SchemaVisitor visitor(columns);
+    visitColumns(visitor, std::string(), 0, EXIFInfo());
+
+    out.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    if (format == ARROW_FILE && !writeBytes(FILE_MAGIC, sizeof(FILE_MAGIC))) {
+        return false;
+    }
+    return writeSchema();
+}
+
+bool ArrowExporter::append(const std::string &path, const EXIFInfo &info, int parseCode) {
+    if (!out.is_open()) {
+        return false;
+    }
+    RowVisitor visitor(columns, dictionaries, batchLength);
+    visitColumns(visitor, path, parseCode, info);
+    batchLength++;
+    totalRows++;
+    return batchLength < batchRows || writeBatch();
+}
+
+size_t ArrowExporter::appendFiles(const std::vector<std::string> &paths, unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const size_t chunk = std::min(paths.size(), PARSE_CHUNK);
+    std::vector<EXIFInfo> infos(chunk);
+    std::vector<int> codes(chunk);
+    size_t parsed = 0;
+    for (size_t begin = 0; begin < paths.size(); begin += chunk) {
+        const size_t count = std::min(chunk, paths.size() - begin);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < std::min<size_t>(threads, count); i++) {
+            workers.push_back(std::thread([&] {
+                std::vector<uint8_t> data;
+                size_t index;
+                while ((index = next.fetch_add(1)) < count) {
+                    if (readFile(paths[begin + index], data)) {
+                        codes[index] = infos[index].parseFromContainer(data.data(), (unsigned)data.size());
+                    } else { // 读取失败的文件也占一行
+                        infos[index].clear();
+                        codes[index] = PARSE_INVALID_JPEG;
+                    }
+                }
+            }));
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (!append(paths[begin + i], infos[i], codes[i])) {
+                return parsed;
+            }
+            if (codes[i] == PARSE_SUCCESS) {
+                parsed++;
+            }
+        }
+    }
+    return parsed;
+}
+
+bool ArrowExporter::close() {
+    if (!out.is_open()) {
+        return false;
+    }
+    bool ok = writeBatch();
+    if (ok && format == ARROW_FILE) {
+        for (int id = 0; ok && id < (int)dictionaries.size(); id++) {
+            Block block;
+            ok = writeDictionary(id, 0, false, &block);
+            dictionaryBlocks.push_back(block);
+        }
+    }
+    // 结束标记
+    uint8_t eos[8];
+    putLittleEndian(eos, CONTINUATION_MARKER, 4);
+    putLittleEndian(eos + 4, 0, 4);
+    ok = ok && writeBytes(eos, sizeof(eos));
+    if (ok && format == ARROW_FILE) {
+        ok = writeFooter();
+    }
+    out.close();
+    return ok && !out.fail();
+}
+
+bool ArrowExporter::writeSchema() {
+    FlatBuilder fb;
+    const uint32_t schema = buildSchema(fb, columns);
+    return writeMessage(finishMessage(fb, HEADER_SCHEMA, schema, 0), std::vector<const std::vector<uint8_t> *>(), NULL);
+}
+
+bool ArrowExporter::writeBatch() {
+    if (batchLength == 0) {
+        return true;
+    }
+    // 流格式在batch之前写出它用到的字典项，第一个batch之后只写新增的
+    if (format == ARROW_STREAM) {
+        for (int id = 0; id < (int)dictionaries.size(); id++) {
+            Dictionary &dictionary = dictionaries[id];
+            if (batchBlocks.empty() || dictionary.values.size() > dictionary.written) {
+                if (!writeDictionary(id, dictionary.written, !batchBlocks.empty(), NULL)) {
+                    return false;
+                }
+                dictionary.written = dictionary.values.size();
+            }
+        }
+    }
+
+    const std::vector<uint8_t> noValidity;
+    std::vector<Pair64> nodes;
+    std::vector<const std::vector<uint8_t> *> body;
+    for (const Column &column : columns) {
+        nodes.push_back(Pair64(batchLength, column.nullCount));
+        body.push_back(column.nullCount > 0 ? &column.validity : &noValidity);
+        body.push_back(&column.values);
+        if (column.typeId == TYPE_UTF8 && column.dictionary < 0) {
+            body.push_back(&column.data);
+        }
+    }
+    std::vector<Pair64> buffers;
+    const int64_t bodyLength = layoutBody(body, buffers);
+    FlatBuilder fb;
+    const uint32_t batch = buildRecordBatch(fb, batchLength, nodes, buffers);
+    Block block;
+    if (!writeMessage(finishMessage(fb, HEADER_RECORD_BATCH, batch, bodyLength), body, &block)) {
+        return false;
+    }
+    batchBlocks.push_back(block);
+
+    batchLength = 0;
+    for (Column &column : columns) {
+        resetColumn(column);
+    }
+    return true;
+}
+
+bool ArrowExporter::writeDictionary(int id, size_t begin, bool isDelta, Block *block) {
+    const std::vector<std::string> &values = dictionaries[id].values;
+    const std::vector<uint8_t> noValidity;
+    std::vector<uint8_t> offsets;
+    std::vector<uint8_t> data;
+    appendValue(offsets, (int32_t)0);
+    for (size_t i = begin; i < values.size(); i++) {
+        appendString(offsets, data, values[i]);
+    }
+    const int64_t length = (int64_t)(values.size() - begin);
+
+    std::vector<const std::vector<uint8_t> *> body;
+    body.push_back(&noValidity);
+    body.push_back(&offsets);
+    body.push_back(&data);
+    std::vector<Pair64> buffers;
+    const int64_t bodyLength = layoutBody(body, buffers);
+    FlatBuilder fb;
+    const uint32_t batch = buildRecordBatch(fb, length, std::vector<Pair64>(1, Pair64(length, 0)), buffers);
+    fb.startTable();
+    fb.add<int64_t>(0, id);
+    fb.addOffset(1, batch);
+    fb.add<bool>(2, isDelta);
+    const uint32_t dictionaryBatch = fb.endTable();
+    return writeMessage(finishMessage(fb, HEADER_DICTIONARY_BATCH, dictionaryBatch, bodyLength), body, block);
+}
+
+bool ArrowExporter::writeFooter() {
+    FlatBuilder fb;
+    const uint32_t schema = buildSchema(fb, columns);
+    const uint32_t dictionaryVector = blockVector(fb, dictionaryBlocks);
+    const uint32_t batchVector = blockVector(fb, batchBlocks);
+    fb.startTable();
+    fb.add<int16_t>(0, METADATA_V5);
+    fb.addOffset(1, schema);
+    fb.addOffset(2, dictionaryVector);
+    fb.addOffset(3, batchVector);
+    const std::vector<uint8_t> footer = fb.finish(fb.endTable());
+
+    uint8_t length[4];
+    putLittleEndian(length, footer.size(), 4);
+    return writeBytes(footer.data(), footer.size()) &&
+           writeBytes(length, sizeof(length)) &&
+           writeBytes(FILE_MAGIC, 6);
+}
+
+// 消息：0xFFFFFFFF、元数据长度、flatbuffer元数据，补齐到8字节，然后是body
+bool ArrowExporter::writeMessage(const std::vector<uint8_t> &metadata, const std::vector<const std::vector<uint8_t> *> &body, Block *block) {
+    const size_t metadataLength = padded8(metadata.size());
+    uint8_t prefix[8];
+    putLittleEndian(prefix, CONTINUATION_MARKER, 4);
+    putLittleEndian(prefix + 4, metadataLength, 4);
+    if (block != NULL) {
+        block->offset = position;
+        block->metaDataLength = (uint32_t)(sizeof(prefix) + metadataLength);
+        block->bodyLength = 0;
+    }
+    if (!writeBytes(prefix, sizeof(prefix)) ||
+        !writeBytes(metadata.data(), metadata.size()) ||
+        !writeBytes(ZEROS, metadataLength - metadata.size())) {
+        return false;
+    }
+    for (const std::vector<uint8_t> *buffer : body) {
+        const size_t padding = padded8(buffer->size()) - buffer->size();
+        if (!writeBytes(buffer->data(), buffer->size()) || !writeBytes(ZEROS, padding)) {
+            return false;
+        }
+        if (block != NULL) {
+            block->bodyLength += buffer->size() + padding;
+        }
+    }
+    return true;
+}
+
+bool ArrowExporter::writeBytes(const void *data, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    position += len;
+    return (bool)out.write((const char *)data, len);
+}
+}
@@ -0,0 +1,117 @@
+//
+//  TinyExifArrow.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifArrow_hpp
+#define TinyExifArrow_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TinyEXIF.h"
+
+// 导出为Apache Arrow IPC格式
+//
+// 把大量文件的EXIFInfo按列写出，pyarrow/pandas、Polars、DuckDB等可以直接读取和扫描。
+// 不依赖Arrow库，IPC消息的flatbuffers元数据由一个只写的builder生成。
+// 每batchRows行写出一个record batch，内存中只保留当前batch的列。
+// Make、Model、Software和GPSMapDatum使用字典编码，列中保存int32的下标。
+// 只导出常用于检索的字段，SubjectArea、FocalPlane、GPS的速度和精度等字段不导出。
+//
+// ARROW_FILE是IPC文件格式(Feather V2)，带footer可以随机访问，字典在close时一次写出；
+// ARROW_STREAM是IPC流格式，每个batch之前以delta字典写出新增的字典项。
+
+namespace TinyEXIF {
+
+/// 输出格式
+enum ArrowFormat {
+    ARROW_FILE = 0,     // IPC文件格式(.arrow/.feather)
+    ARROW_STREAM = 1    // IPC流格式(.arrows)
+};
+
+class TINYEXIF_LIB ArrowExporter {
+public:
+    /// @param batchRows 每个record batch的行数
+    explicit ArrowExporter(uint32_t batchRows = 64 * 1024);
+    ~ArrowExporter();
+
+    /// 创建输出文件并写入schema
+    /// @param path 输出文件地址
+    /// @param format 输出格式
+    bool open(const std::string &path, ArrowFormat format = ARROW_FILE);
+
+    /// 追加一行，满batchRows行时写出一个record batch
+    /// @param path 图片地址，写入path列
+    /// @param info 解析结果
+    /// @param parseCode 解析的返回值，写入parse_code列
+    bool append(const std::string &path, const EXIFInfo &info, int parseCode);
+
+    /// 解析多个文件并按顺序追加，每次并行解析一个batch的文件
+    /// @param paths 图片地址
+    /// @param threads 解析的线程数，0表示CPU核数
+    /// @return 解析成功的数量
+    size_t appendFiles(const std::vector<std::string> &paths, unsigned threads = 0);
+
+    /// 写出剩余的行，文件格式还要写出字典和footer，然后关闭文件
+    bool close();
+
+    /// 已经追加的行数
+    uint64_t rows() const { return totalRows; }
+
+public:
+    /// 一列的类型和当前batch的数据
+    struct Column {
+        std::string name;
+        uint8_t typeId;                 // Arrow Type union的类型：Int、FloatingPoint或Utf8
+        uint8_t bitWidth;               // 整数的位数
+        bool isSigned;
+        bool nullable;
+        int dictionary;                 // 字典编号，-1表示不使用字典
+        std::vector<uint8_t> validity;  // 有效位图，nullable时使用
+        uint32_t nullCount;
+        std::vector<uint8_t> values;    // 定长的值，字符串是int32的offset
+        std::vector<uint8_t> data;      // 字符串的内容
+    };
+
+    /// 字典编码的列共用的字典
+    struct Dictionary {
+        std::unordered_map<std::string, int32_t> index;
+        std::vector<std::string> values;
+        size_t written;                 // 已经写出的字典项数，流格式中之后的是delta
+    };
+
+    /// IPC文件中一个消息的位置，用于footer
+    struct Block {
+        uint64_t offset;
+        uint32_t metaDataLength;
+        uint64_t bodyLength;
+    };
+
+private:
+    ArrowExporter(const ArrowExporter &);
+    ArrowExporter& operator = (const ArrowExporter &);
+
+    bool writeSchema();
+    bool writeBatch();
+    bool writeDictionary(int id, size_t begin, bool isDelta, Block *block);
+    bool writeFooter();
+    bool writeMessage(const std::vector<uint8_t> &metadata, const std::vector<const std::vector<uint8_t> *> &body, Block *block);
+    bool writeBytes(const void *data, size_t len);
+
+    const uint32_t batchRows;
+    ArrowFormat format;
+    std::ofstream out;
+    uint64_t position;                  // 已经写出的字节数
+    std::vector<Column> columns;
+    std::vector<Dictionary> dictionaries;
+    std::vector<Block> dictionaryBlocks;
+    std::vector<Block> batchBlocks;
+    uint32_t batchLength;               // 当前batch的行数
+    uint64_t totalRows;
+};
+}
+#endif /* TinyExifArrow_hpp */
@@ -0,0 +1,241 @@
+//
+//  TinyExifAsync.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifAsync.hpp"
+#include "TinyExifStats.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+namespace TinyEXIF {
+
+namespace {
+
+// 每次读取前检查取消和超时的文件数据流
+class CancellableFileStream : public EXIFStream {
+public:
+    CancellableFileStream(const std::string &path, const AsyncOptions &_options)
+        : file(path.c_str(), std::ifstream::in | std::ifstream::binary), options(_options), status(ASYNC_SUCCESS) {}
+    bool IsValid() const override {
+        return file.is_open();
+    }
+    const uint8_t* GetBuffer(unsigned desiredLength) override {
+        if (!proceed()) {
+            return NULL;
+        }
+        buffer.resize(desiredLength);
+        if (!file.read((char *)buffer.data(), desiredLength)) {
+            return NULL;
+        }
+        return buffer.data();
+    }
+    bool SkipBuffer(unsigned desiredLength) override {
+        return proceed() && (bool)file.seekg(desiredLength, std::ios::cur);
+    }
+    // 读取被取消或超时时的状态
+    AsyncStatus interrupted() const {
+        return status;
+    }
+private:
+    bool proceed() {
+        if (status == ASYNC_SUCCESS) {
+            status = options.check();
+        }
+        return status == ASYNC_SUCCESS;
+    }
+    std::ifstream file;
+    const AsyncOptions &options;
+    std::vector<uint8_t> buffer;
+    AsyncStatus status;
+};
+
+// 分块读取整个文件，每块之前检查取消和超时
+AsyncStatus readFile(const std::string &path, const AsyncOptions &options, std::vector<uint8_t> &data) {
+    TINYEXIF_STAT_TIMER(STAGE_READ);
+    std::ifstream in (path.c_str(), std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        return ASYNC_FAILED;
+    }
+    const size_t chunkSize = 256 * 1024;
+    data.clear();
+    while (in) {
+        AsyncStatus status = options.check();
+        if (status != ASYNC_SUCCESS) {
+            return status;
+        }
+        const size_t size = data.size();
+        data.resize(size + chunkSize);
+        in.read((char *)data.data() + size, chunkSize);
+        data.resize(size + (size_t)in.gcount());
+        TINYEXIF_STAT_ADD(STAT_BYTES_READ, in.gcount());
+    }
+    return in.eof() ? ASYNC_SUCCESS : ASYNC_FAILED;
+}
+
+AsyncParseResult parseFile(const std::string &path, const AsyncOptions &options) {
+    AsyncParseResult result;
+    if ((result.status = options.check()) != ASYNC_SUCCESS) {
+        return result;
+    }
+    CancellableFileStream stream(path, options);
+    result.info.setLimits(options.limits);
+    result.code = result.info.parseFrom(stream);
+    if (stream.interrupted() != ASYNC_SUCCESS) { // 解析到一半被中断，结果不完整
+        result.status = stream.interrupted();
+        result.info.clear();
+    } else {
+        result.status = result.code == PARSE_SUCCESS ? ASYNC_SUCCESS : ASYNC_FAILED;
+    }
+    return result;
+}
+
+AsyncExifDataResult readExifData(const std::string &path, const AsyncOptions &options) {
+    AsyncExifDataResult result;
+    if ((result.status = options.check()) != ASYNC_SUCCESS) {
+        return result;
+    }
+    uint32_t len = 0;
+    uint8_t *data = ExifWriter::readExifData(path.c_str(), len);
+    if (data == NULL) {
+        result.status = ASYNC_FAILED;
+        return result;
+    }
+    result.data.assign(data, data + len);
+    delete [] data;
+    result.status = ASYNC_SUCCESS;
+    return result;
+}
+
+AsyncStatus writeToFile(ExifWriter &writer, const std::string &path, const std::string &outputPath, const AsyncOptions &options) {
+    std::vector<uint8_t> input;
+    AsyncStatus status = readFile(path, options, input);
+    if (status != ASYNC_SUCCESS) {
+        return status;
+    }
+    std::vector<uint8_t> output;
+    if (!writer.writeToBuffer(input.data(), (uint32_t)input.size(), output)) {
+        return ASYNC_FAILED;
+    }
+    if ((status = options.check()) != ASYNC_SUCCESS) {
+        return status;
+    }
+    TINYEXIF_STAT_TIMER(STAGE_WRITE);
+    TINYEXIF_STAT_ADD(STAT_BYTES_WRITTEN, output.size());
+    std::ofstream out (outputPath.c_str(), std::ios::out | std::ios::binary);
+    if (!out.is_open() || !out.write((const char *)output.data(), output.size())) {
+        return ASYNC_FAILED;
+    }
+    return ASYNC_SUCCESS;
+}
+
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread(&ThreadPoolExecutor::run, this));
+    }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPoolExecutor::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    condition.notify_one();
+}
+
+void ThreadPoolExecutor::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) { // 已经停止，并且没有剩余的任务
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+AsyncStatus AsyncOptions::check() const {
+    if (token.isCancelled()) {
+        return ASYNC_CANCELLED;
+    }
+    if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline) {
+        return ASYNC_DEADLINE_EXCEEDED;
+    }
+    return ASYNC_SUCCESS;
+}
+
+void parseFileAsync(Executor &executor, const std::string &path, const AsyncOptions &options,
+                    std::function<void(AsyncParseResult &)> callback) {
+    executor.post([path, options, callback] {
+        AsyncParseResult result = parseFile(path, options);
+        callback(result);
+    });
+}
+
+std::future<AsyncParseResult> parseFileAsync(Executor &executor, const std::string &path, const AsyncOptions &options) {
+    // std::function要求可以复制，promise通过shared_ptr共享
+    std::shared_ptr<std::promise<AsyncParseResult>> promise = std::make_shared<std::promise<AsyncParseResult>>();
+    executor.post([path, options, promise] {
+        promise->set_value(parseFile(path, options));
+    });
+    return promise->get_future();
+}
+
+void readExifDataAsync(Executor &executor, const std::string &path, const AsyncOptions &options,
+                       std::function<void(AsyncExifDataResult &)> callback) {
+    executor.post([path, options, callback] {
+        AsyncExifDataResult result = readExifData(path, options);
+        callback(result);
+    });
+}
+
+std::future<AsyncExifDataResult> readExifDataAsync(Executor &executor, const std::string &path, const AsyncOptions &options) {
+    std::shared_ptr<std::promise<AsyncExifDataResult>> promise = std::make_shared<std::promise<AsyncExifDataResult>>();
+    executor.post([path, options, promise] {
+        promise->set_value(readExifData(path, options));
+    });
+    return promise->get_future();
+}
+
+void writeToFileAsync(Executor &executor, const ExifWriter &writer, const std::string &path,
+                      const std::string &outputPath, const AsyncOptions &options,
+                      std::function<void(AsyncStatus)> callback) {
+    std::shared_ptr<ExifWriter> copy = std::make_shared<ExifWriter>(writer);
+    executor.post([copy, path, outputPath, options, callback] {
+        callback(writeToFile(*copy, path, outputPath, options));
+    });
+}
+
+std::future<AsyncStatus> writeToFileAsync(Executor &executor, const ExifWriter &writer, const std::string &path,
+                                          const std::string &outputPath, const AsyncOptions &options) {
+    std::shared_ptr<std::promise<AsyncStatus>> promise = std::make_shared<std::promise<AsyncStatus>>();
+    std::shared_ptr<ExifWriter> copy = std::make_shared<ExifWriter>(writer);
+    executor.post([copy, path, outputPath, options, promise] {
+        promise->set_value(writeToFile(*copy, path, outputPath, options));
+    });
+    return promise->get_future();
+}
+}
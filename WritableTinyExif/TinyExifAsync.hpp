@@ -0,0 +1,154 @@
+//
+//  TinyExifAsync.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifAsync_hpp
+#define TinyExifAsync_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TinyEXIF.h"
+#include "TinyExifWriter.hpp"
+
+// 异步接口
+//
+// 解析、读取exif和写入文件都在Executor上执行，调用线程不会阻塞在文件读写上。
+// 每个操作可以带一个取消标记和截止时间，在每次读取文件之前检查，取消或超时后尽快结束，
+// 写入操作在检查通过之后才创建输出文件，不会留下写了一半的文件。
+// 结果可以通过回调(在Executor的线程中调用)或者std::future获取。
+
+namespace TinyEXIF {
+
+enum AsyncStatus {
+    ASYNC_SUCCESS           = 0, // 成功
+    ASYNC_FAILED            = 1, // 操作失败，解析的错误码见AsyncParseResult::code
+    ASYNC_CANCELLED         = 2, // 被取消
+    ASYNC_DEADLINE_EXCEEDED = 3  // 超过截止时间
+};
+
+/// 任务执行器，可以用线程池或者事件循环实现
+class TINYEXIF_LIB Executor {
+public:
+    virtual ~Executor() {}
+
+    /// 提交一个任务，任务按提交的顺序开始执行
+    /// @param task 任务
+    virtual void post(std::function<void()> task) = 0;
+};
+
+/// 固定线程数的线程池，析构时执行完已经提交的任务再退出
+class TINYEXIF_LIB ThreadPoolExecutor : public Executor {
+public:
+    /// @param threadCount 线程数，0表示使用CPU核数
+    explicit ThreadPoolExecutor(unsigned threadCount = 0);
+    ~ThreadPoolExecutor();
+
+    void post(std::function<void()> task) override;
+
+    /// 线程数
+    size_t size() const { return threads.size(); }
+
+private:
+    ThreadPoolExecutor(const ThreadPoolExecutor &);
+    ThreadPoolExecutor& operator = (const ThreadPoolExecutor &);
+
+    void run();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
+
+/// 取消标记，复制后共享同一个状态，在任意线程调用cancel都会通知到所有的副本
+class TINYEXIF_LIB CancellationToken {
+public:
+    CancellationToken() : cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+    /// 取消
+    void cancel() { cancelled->store(true); }
+    /// 是否已经取消
+    bool isCancelled() const { return cancelled->load(); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+/// 异步操作的选项
+struct TINYEXIF_LIB AsyncOptions {
+    CancellationToken token;                                    // 取消标记
+    std::chrono::steady_clock::time_point deadline =            // 截止时间，默认没有限制
+        std::chrono::steady_clock::time_point::max();
+    ParseLimits limits;                                         // 解析时每个文件的预算
+
+    /// 设置从现在开始的超时时间
+    /// @param timeout 超时时间
+    void setTimeout(std::chrono::steady_clock::duration timeout) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+    }
+
+    /// 检查是否取消或超时，返回ASYNC_SUCCESS表示可以继续
+    AsyncStatus check() const;
+};
+
+/// 异步解析的结果
+struct TINYEXIF_LIB AsyncParseResult {
+    AsyncStatus status = ASYNC_FAILED;
+    int code = PARSE_INVALID_JPEG;  // EXIFInfo::parseFrom的返回值
+    EXIFInfo info;
+};
+
+/// 异步读取exif数据的结果
+struct TINYEXIF_LIB AsyncExifDataResult {
+    AsyncStatus status = ASYNC_FAILED;
+    std::vector<uint8_t> data;      // ExifWriter::readExifData读取的APP1段，可以用来构造ExifWriter
+};
+
+/// 异步解析一个图片文件，数据流每次读取前检查取消和超时
+/// @param executor 执行器
+/// @param path 图片地址
+/// @param options 选项
+/// @param callback 完成后在执行器的线程中调用
+void TINYEXIF_LIB parseFileAsync(Executor &executor, const std::string &path, const AsyncOptions &options,
+                                 std::function<void(AsyncParseResult &)> callback);
+std::future<AsyncParseResult> TINYEXIF_LIB parseFileAsync(Executor &executor, const std::string &path,
+                                                          const AsyncOptions &options = AsyncOptions());
+
+/// 异步读取一个图片的exif数据，见ExifWriter::readExifData
+/// @param executor 执行器
+/// @param path 图片地址
+/// @param options 选项
+/// @param callback 完成后在执行器的线程中调用
+void TINYEXIF_LIB readExifDataAsync(Executor &executor, const std::string &path, const AsyncOptions &options,
+                                    std::function<void(AsyncExifDataResult &)> callback);
+std::future<AsyncExifDataResult> TINYEXIF_LIB readExifDataAsync(Executor &executor, const std::string &path,
+                                                                const AsyncOptions &options = AsyncOptions());
+
+/// 异步写入，见ExifWriter::writeToFile。writer被复制，调用后可以继续修改原来的writer。
+/// 源文件分块读取，每块之前检查取消和超时，全部读完并生成输出后才创建输出文件
+/// @param executor 执行器
+/// @param writer 要写入的exif数据
+/// @param path 读取图片地址
+/// @param outputPath 输出的图片地址
+/// @param options 选项
+/// @param callback 完成后在执行器的线程中调用
+void TINYEXIF_LIB writeToFileAsync(Executor &executor, const ExifWriter &writer, const std::string &path,
+                                   const std::string &outputPath, const AsyncOptions &options,
+                                   std::function<void(AsyncStatus)> callback);
+std::future<AsyncStatus> TINYEXIF_LIB writeToFileAsync(Executor &executor, const ExifWriter &writer, const std::string &path,
+                                                       const std::string &outputPath,
+                                                       const AsyncOptions &options = AsyncOptions());
+}
+#endif /* TinyExifAsync_hpp */
@@ -0,0 +1,699 @@
+//
+//  TinyExifCache.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifCache.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __APPLE__
+#define ST_MTIM st_mtimespec
+#else
+#define ST_MTIM st_mtim
+#endif
+
+namespace TinyEXIF {
+
+namespace {
+
+// 缓存文件格式版本，EXIFInfo字段变化时需要增加，旧文件会被重建
+const uint32_t CACHE_VERSION = 5;
+// 缓存文件每次增长的长度
+const uint64_t CACHE_GROW_SIZE = 4 << 20;
+// 失效数据超过这个长度且超过一半时触发压缩
+const uint64_t CACHE_COMPACT_MIN_DEAD = 1 << 20;
+
+struct CacheHeader {
+    char magic[8];          // "TXCACHE\0"
+    uint32_t version;       // CACHE_VERSION
+    uint32_t obsolete;      // 非0表示文件已经被压缩后的新文件替换
+    uint64_t end;           // 已写入数据的结尾
+    uint64_t records;       // 记录总数，包括失效的记录
+    uint64_t deadBytes;     // 失效记录的总长度
+};
+
+struct CacheRecord {
+    uint32_t length;        // 整条记录的长度，8字节对齐
+    int32_t result;         // parseFrom的返回值
+    uint32_t payloadLength; // 序列化数据的长度
+    uint32_t reserved;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    // payload
+};
+
+const char CACHE_MAGIC[8] = {'T', 'X', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+inline uint64_t align8(uint64_t value) {
+    return (value + 7) & ~(uint64_t)7;
+}
+
+inline bool isValidHeader(const CacheHeader *header, uint64_t fileSize) {
+    return memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+        header->version == CACHE_VERSION &&
+        header->end >= sizeof(CacheHeader) && header->end <= fileSize;
+}
+
+inline bool isSameFile(const CacheRecord *rec, const struct stat &st) {
+    return rec->size == (uint64_t)st.st_size &&
+        rec->mtimeSec == (int64_t)st.ST_MTIM.tv_sec &&
+        rec->mtimeNsec == (int64_t)st.ST_MTIM.tv_nsec;
+}
+
+// 序列化输出
+class OutArchive {
+public:
+    explicit OutArchive(std::vector<uint8_t> &_data) : data(_data) {}
+
+    template <typename T>
+    void operator () (const T &value) {
+        const uint8_t *p = (const uint8_t *)&value;
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+    void operator () (const std::string &value) {
+        (*this)((uint32_t)value.length());
+        data.insert(data.end(), value.begin(), value.end());
+    }
+    void operator () (const std::vector<uint16_t> &value) {
+        (*this)((uint32_t)value.size());
+        for (uint16_t v : value)
+            (*this)(v);
+    }
+
+private:
+    std::vector<uint8_t> &data;
+};
+
+// 序列化输入，数据不足时ok为false
+class InArchive {
+public:
+    InArchive(const uint8_t *_data, uint32_t _len) : data(_data), len(_len), offs(0), ok(true) {}
+
+    template <typename T>
+    void operator () (T &value) {
+        if (!ok || len - offs < sizeof(T)) {
+            ok = false;
+            return;
+        }
+        memcpy(&value, data + offs, sizeof(T));
+        offs += sizeof(T);
+    }
+    void operator () (std::string &value) {
+        uint32_t size = 0;
+        (*this)(size);
+        if (!ok || len - offs < size) {
+            ok = false;
+            return;
+        }
+        value.assign((const char *)data + offs, size);
+        offs += size;
+    }
+    void operator () (std::vector<uint16_t> &value) {
+        uint32_t size = 0;
+        (*this)(size);
+        if (!ok || (len - offs) / sizeof(uint16_t) < size) {
+            ok = false;
+            return;
+        }
+        value.resize(size);
+        for (uint16_t &v : value)
+            (*this)(v);
+    }
+
+    bool isOk() const { return ok && offs == len; }
+
+private:
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t offs;
+    bool ok;
+};
+
+// 输入输出共用的字段列表，EXIFInfo增加字段时只需要修改这里并增加CACHE_VERSION
+template <typename Archive, typename Info>
+void serializeFields(Archive &ar, Info &info) {
+    ar(info.Fields);
+    ar(info.ImageWidth);
+    ar(info.ImageHeight);
+    ar(info.RelatedImageWidth);
+    ar(info.RelatedImageHeight);
+    ar(info.ImageDescription);
+    ar(info.Make);
+    ar(info.Model);
+    ar(info.SerialNumber);
+    ar(info.Orientation);
+    ar(info.XResolution);
+    ar(info.YResolution);
+    ar(info.ResolutionUnit);
+    ar(info.BitsPerSample);
+    ar(info.Software);
+    ar(info.DateTime);
+    ar(info.DateTimeOriginal);
+    ar(info.DateTimeDigitized);
+    ar(info.SubSecTime);
+    ar(info.SubSecTimeOriginal);
+    ar(info.SubSecTimeDigitized);
+    ar(info.OffsetTime);
+    ar(info.OffsetTimeOriginal);
+    ar(info.OffsetTimeDigitized);
+    ar(info.Copyright);
+    ar(info.ExposureTime);
+    ar(info.FNumber);
+    ar(info.ExposureProgram);
+    ar(info.ISOSpeedRatings);
+    ar(info.ShutterSpeedValue);
+    ar(info.ApertureValue);
+    ar(info.BrightnessValue);
+    ar(info.ExposureBiasValue);
+    ar(info.SubjectDistance);
+    ar(info.FocalLength);
+    ar(info.Flash);
+    ar(info.MeteringMode);
+    ar(info.LightSource);
+    ar(info.ProjectionType);
+    ar(info.SubjectArea);
+    ar(info.Calibration.FocalLength);
+    ar(info.Calibration.OpticalCenterX);
+    ar(info.Calibration.OpticalCenterY);
+    ar(info.LensInfo.FStopMin);
+    ar(info.LensInfo.FStopMax);
+    ar(info.LensInfo.FocalLengthMin);
+    ar(info.LensInfo.FocalLengthMax);
+    ar(info.LensInfo.DigitalZoomRatio);
+    ar(info.LensInfo.FocalLengthIn35mm);
+    ar(info.LensInfo.FocalPlaneXResolution);
+    ar(info.LensInfo.FocalPlaneYResolution);
+    ar(info.LensInfo.FocalPlaneResolutionUnit);
+    ar(info.LensInfo.Make);
+    ar(info.LensInfo.Model);
+    ar(info.GeoLocation.Latitude);
+    ar(info.GeoLocation.Longitude);
+    ar(info.GeoLocation.Altitude);
+    ar(info.GeoLocation.AltitudeRef);
+    ar(info.GeoLocation.RelativeAltitude);
+    ar(info.GeoLocation.RollDegree);
+    ar(info.GeoLocation.PitchDegree);
+    ar(info.GeoLocation.YawDegree);
+    ar(info.GeoLocation.SpeedX);
+    ar(info.GeoLocation.SpeedY);
+    ar(info.GeoLocation.SpeedZ);
+    ar(info.GeoLocation.AccuracyXY);
+    ar(info.GeoLocation.AccuracyZ);
+    ar(info.GeoLocation.GPSDOP);
+    ar(info.GeoLocation.GPSDifferential);
+    ar(info.GeoLocation.GPSMapDatum);
+    ar(info.GeoLocation.GPSTimeStamp);
+    ar(info.GeoLocation.GPSTimeMicros);
+    ar(info.GeoLocation.GPSDateStamp);
+    ar(info.GeoLocation.LatComponents.degrees);
+    ar(info.GeoLocation.LatComponents.minutes);
+    ar(info.GeoLocation.LatComponents.seconds);
+    ar(info.GeoLocation.LatComponents.direction);
+    ar(info.GeoLocation.LonComponents.degrees);
+    ar(info.GeoLocation.LonComponents.minutes);
+    ar(info.GeoLocation.LonComponents.seconds);
+    ar(info.GeoLocation.LonComponents.direction);
+    ar(info.Frame.Marker);
+    ar(info.Frame.Precision);
+    ar(info.Frame.Width);
+    ar(info.Frame.Height);
+    ar(info.Frame.Components);
+    ar(info.Frame.Progressive);
+    ar(info.ExtendedXMPGUID);
+    ar(info.ExtendedXMP);
+}
+
+// 基于FILE的读取流，用于缓存未命中时解析图片
+class EXIFStreamFILE : public EXIFStream {
+public:
+    explicit EXIFStreamFILE(const char *path) : file(fopen(path, "rb")) {}
+    ~EXIFStreamFILE() {
+        if (file != NULL)
+            fclose(file);
+    }
+    bool IsValid() const override {
+        return file != NULL;
+    }
+    const uint8_t* GetBuffer(unsigned desiredLength) override {
+        buffer.resize(desiredLength);
+        if (fread(buffer.data(), 1, desiredLength, file) != desiredLength)
+            return NULL;
+        return buffer.data();
+    }
+    bool SkipBuffer(unsigned desiredLength) override {
+        return fseek(file, desiredLength, SEEK_CUR) == 0;
+    }
+    // 根据文件头判断容器格式，读取后回到文件开头
+    ContainerFormat sniff() {
+        uint8_t header[12];
+        const size_t length = fread(header, 1, sizeof(header), file);
+        rewind(file);
+        return SniffContainer(header, (unsigned)length);
+    }
+    // 从当前位置读取最多maxLength个字节
+    bool readAll(uint64_t maxLength, std::vector<uint8_t> &data) {
+        data.clear();
+        uint8_t chunk[64 * 1024];
+        while (data.size() < maxLength) {
+            const size_t length = fread(chunk, 1, (size_t)std::min<uint64_t>(sizeof(chunk), maxLength - data.size()), file);
+            data.insert(data.end(), chunk, chunk + length);
+            if (length < sizeof(chunk)) {
+                break;
+            }
+        }
+        return !ferror(file);
+    }
+private:
+    FILE *file;
+    std::vector<uint8_t> buffer;
+};
+
+} // namespace
+
+
+ExifCache::ExifCache() : compacting(false) {
+}
+
+ExifCache::~ExifCache() {
+    close();
+}
+
+bool ExifCache::open(const char *path) {
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+    cachePath = path;
+    return openLocked();
+}
+
+void ExifCache::close() {
+    // 持有threadMutex直到关闭，其它线程的store不会在这期间启动新的压缩
+    std::lock_guard<std::mutex> threadLock(threadMutex);
+    if (compactThread.joinable()) {
+        compactThread.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    closeLocked();
+}
+
+bool ExifCache::openLocked() {
+    // 加锁前文件可能已被其它进程重建或压缩替换，锁住的必须是当前路径上的文件
+    struct stat st;
+    while (true) {
+        fd = ::open(cachePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        flock(fd, LOCK_EX);
+        struct stat current;
+        if (fstat(fd, &st) != 0) {
+            flock(fd, LOCK_UN);
+            closeLocked();
+            return false;
+        }
+        if (::stat(cachePath.c_str(), &current) == 0 && current.st_dev == st.st_dev && current.st_ino == st.st_ino) {
+            break;
+        }
+        flock(fd, LOCK_UN);
+        ::close(fd);
+    }
+
+    // 文件不存在或格式不对时重建
+    CacheHeader header;
+    if (st.st_size < (off_t)sizeof(CacheHeader) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        !isValidHeader(&header, st.st_size)) {
+        const int rebuilt = rebuildLocked(st.st_size);
+        flock(fd, LOCK_UN);
+        ::close(fd);
+        fd = rebuilt;
+        if (fd < 0) {
+            return false;
+        }
+        header.end = sizeof(CacheHeader);
+    } else {
+        flock(fd, LOCK_UN);
+    }
+
+    if (!mapLocked(header.end)) {
+        closeLocked();
+        return false;
+    }
+    index.clear();
+    indexedEnd = sizeof(CacheHeader);
+    indexLocked(__atomic_load_n(&((CacheHeader *)mapping)->end, __ATOMIC_ACQUIRE));
+    return true;
+}
+
+int ExifCache::rebuildLocked(uint64_t fileSize) {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.end = sizeof(CacheHeader);
+
+    // 和压缩一样先写临时文件再rename，原文件可能还被其它进程映射着，截断后访问映射会SIGBUS
+    const std::string tmpPath = cachePath + ".rebuild";
+    int out = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return -1;
+    }
+    if (ftruncate(out, CACHE_GROW_SIZE) != 0 ||
+        pwrite(out, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+        ::close(out);
+        unlink(tmpPath.c_str());
+        return -1;
+    }
+
+    // 其它版本的缓存文件，标记obsolete让映射着它的进程重新打开
+    char magic[sizeof(CACHE_MAGIC)];
+    if (fileSize >= sizeof(CacheHeader) &&
+        pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+        memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0) {
+        // 标记失败时，映射着旧文件的进程继续写旧文件，只是不再和新文件共享
+        const uint32_t obsolete = 1;
+        const bool marked = pwrite(fd, &obsolete, sizeof(obsolete), offsetof(CacheHeader, obsolete)) == (ssize_t)sizeof(obsolete);
+        (void)marked;
+    }
+    return out;
+}
+
+void ExifCache::closeLocked() {
+    if (mapping != NULL) {
+        munmap(mapping, mappingLen);
+        mapping = NULL;
+        mappingLen = 0;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    index.clear();
+    indexedEnd = 0;
+}
+
+bool ExifCache::mapLocked(uint64_t len) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < len) {
+        return false;
+    }
+    if (mapping != NULL) {
+        munmap(mapping, mappingLen);
+        mapping = NULL;
+        mappingLen = 0;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    mapping = (uint8_t *)addr;
+    mappingLen = st.st_size;
+    return true;
+}
+
+bool ExifCache::refreshLocked() {
+    if (mapping == NULL) {
+        return false;
+    }
+    CacheHeader *header = (CacheHeader *)mapping;
+    if (__atomic_load_n(&header->obsolete, __ATOMIC_ACQUIRE)) { // 已被压缩替换，重新打开
+        closeLocked();
+        return openLocked();
+    }
+    uint64_t end = __atomic_load_n(&header->end, __ATOMIC_ACQUIRE);
+    if (end > mappingLen && !mapLocked(end)) {
+        return false;
+    }
+    if (end > indexedEnd) {
+        indexLocked(end);
+    }
+    return true;
+}
+
+void ExifCache::indexLocked(uint64_t end) {
+    uint64_t offset = indexedEnd;
+    while (offset + sizeof(CacheRecord) <= end) {
+        const CacheRecord *rec = (const CacheRecord *)(mapping + offset);
+        if (rec->length < sizeof(CacheRecord) || rec->length > end - offset) {
+            break;
+        }
+        Key key = {rec->dev, rec->ino};
+        index[key] = offset;
+        offset += rec->length;
+    }
+    indexedEnd = end;
+}
+
+bool ExifCache::lookup(const struct stat &st, EXIFInfo &info, int &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!refreshLocked()) {
+        return false;
+    }
+    Key key = {(uint64_t)st.st_dev, (uint64_t)st.st_ino};
+    auto it = index.find(key);
+    if (it == index.end()) {
+        return false;
+    }
+    const CacheRecord *rec = (const CacheRecord *)(mapping + it->second);
+    if (!isSameFile(rec, st)) { // 文件已经被修改
+        return false;
+    }
+    if (rec->payloadLength > rec->length - sizeof(CacheRecord) ||
+        !deserialize((const uint8_t *)(rec + 1), rec->payloadLength, info)) {
+        return false;
+    }
+    result = rec->result;
+    return true;
+}
+
+bool ExifCache::store(const struct stat &st, const EXIFInfo &info, int result) {
+    std::vector<uint8_t> payload;
+    serialize(info, payload);
+    const uint64_t recordLen = align8(sizeof(CacheRecord) + payload.size());
+
+    bool needCompact = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (true) {
+            if (!refreshLocked()) {
+                return false;
+            }
+            // 自己的压缩正在进行时不等待，直接放弃这次写入
+            if (flock(fd, compacting ? (LOCK_EX | LOCK_NB) : LOCK_EX) != 0) {
+                return false;
+            }
+            if (!__atomic_load_n(&((CacheHeader *)mapping)->obsolete, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            flock(fd, LOCK_UN); // 加锁前文件被其它进程压缩替换了
+        }
+
+        // 持有锁之后再同步一次其它进程写入的数据
+        uint64_t end = __atomic_load_n(&((CacheHeader *)mapping)->end, __ATOMIC_ACQUIRE);
+        if (end > mappingLen && !mapLocked(end)) {
+            flock(fd, LOCK_UN);
+            return false;
+        }
+        indexLocked(end);
+
+        const uint64_t newEnd = end + recordLen;
+        if (newEnd > mappingLen) {
+            const uint64_t fileLen = (newEnd + CACHE_GROW_SIZE - 1) / CACHE_GROW_SIZE * CACHE_GROW_SIZE;
+            if (ftruncate(fd, fileLen) != 0 || !mapLocked(newEnd)) {
+                flock(fd, LOCK_UN);
+                return false;
+            }
+        }
+
+        CacheRecord *rec = (CacheRecord *)(mapping + end);
+        memset(rec, 0, recordLen);
+        rec->length = (uint32_t)recordLen;
+        rec->result = result;
+        rec->payloadLength = (uint32_t)payload.size();
+        rec->dev = st.st_dev;
+        rec->ino = st.st_ino;
+        rec->size = st.st_size;
+        rec->mtimeSec = st.ST_MTIM.tv_sec;
+        rec->mtimeNsec = st.ST_MTIM.tv_nsec;
+        memcpy(rec + 1, payload.data(), payload.size());
+
+        CacheHeader *header = (CacheHeader *)mapping;
+        Key key = {rec->dev, rec->ino};
+        auto it = index.find(key);
+        if (it != index.end()) { // 旧记录失效
+            header->deadBytes += ((const CacheRecord *)(mapping + it->second))->length;
+        }
+        header->records++;
+        __atomic_store_n(&header->end, newEnd, __ATOMIC_RELEASE);
+        index[key] = end;
+        indexedEnd = newEnd;
+
+        needCompact = header->deadBytes > CACHE_COMPACT_MIN_DEAD && header->deadBytes * 2 > newEnd;
+        flock(fd, LOCK_UN);
+    }
+
+    if (needCompact) {
+        compactAsync();
+    }
+    return true;
+}
+
+int ExifCache::parseFile(const char *imagePath, EXIFInfo &info) {
+    struct stat st;
+    if (::stat(imagePath, &st) != 0) {
+        info.clear();
+        return PARSE_INVALID_JPEG;
+    }
+
+    int result = PARSE_SUCCESS;
+    if (lookup(st, info, result)) {
+        return result;
+    }
+
+    EXIFStreamFILE stream(imagePath);
+    if (!stream.IsValid()) {
+        info.clear();
+        return PARSE_INVALID_JPEG;
+    }
+    if (stream.sniff() == CONTAINER_JPEG) {
+        result = info.parseFrom(stream); // 只读取元数据所在的段
+    } else {
+        // PNG、WebP和TIFF的元数据位置不固定，读入内存后按容器解析。parseFromContainer只扫描前MaxScanBytes个字节，
+        // 多读一个字节让它能判断是否超出扫描范围
+        std::vector<uint8_t> data;
+        const uint64_t maxLength = std::min<uint64_t>(info.getLimits().MaxScanBytes, UINT32_MAX - 1) + 1;
+        if (!stream.readAll(maxLength, data)) {
+            info.clear();
+            return PARSE_INVALID_JPEG;
+        }
+        result = info.parseFromContainer(data.data(), (unsigned)data.size());
+    }
+    store(st, info, result);
+    return result;
+}
+
+size_t ExifCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    refreshLocked();
+    return index.size();
+}
+
+bool ExifCache::compactAsync() {
+    bool expected = false;
+    if (!compacting.compare_exchange_strong(expected, true)) {
+        return false;
+    }
+    // 可能在任意调用store的线程中执行，与close互斥
+    std::lock_guard<std::mutex> threadLock(threadMutex);
+    if (compactThread.joinable()) {
+        compactThread.join();
+    }
+    compactThread = std::thread(&ExifCache::compact, this);
+    return true;
+}
+
+void ExifCache::compact() {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        path = cachePath;
+    }
+
+    // 使用单独的描述符和映射，压缩期间本进程的查询不受影响
+    int cfd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (cfd < 0) {
+        compacting = false;
+        return;
+    }
+    flock(cfd, LOCK_EX);
+
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(cfd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader)) {
+        addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cfd, 0);
+    }
+    CacheHeader *header = addr != MAP_FAILED ? (CacheHeader *)addr : NULL;
+    if (header != NULL && isValidHeader(header, st.st_size) && !header->obsolete) {
+        const uint8_t *data = (const uint8_t *)addr;
+
+        // 每个文件只保留最后一条记录，按原来的顺序写入
+        std::unordered_map<Key, uint64_t, KeyHash> live;
+        uint64_t offset = sizeof(CacheHeader);
+        while (offset + sizeof(CacheRecord) <= header->end) {
+            const CacheRecord *rec = (const CacheRecord *)(data + offset);
+            if (rec->length < sizeof(CacheRecord) || rec->length > header->end - offset) {
+                break;
+            }
+            Key key = {rec->dev, rec->ino};
+            live[key] = offset;
+            offset += rec->length;
+        }
+        std::vector<uint64_t> offsets;
+        offsets.reserve(live.size());
+        for (const auto &item : live) {
+            offsets.push_back(item.second);
+        }
+        std::sort(offsets.begin(), offsets.end());
+
+        const std::string tmpPath = path + ".compact";
+        int out = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool success = out >= 0;
+        CacheHeader newHeader = *header;
+        newHeader.obsolete = 0;
+        newHeader.records = offsets.size();
+        newHeader.deadBytes = 0;
+        newHeader.end = sizeof(CacheHeader);
+        for (uint64_t recOffset : offsets) {
+            if (!success) {
+                break;
+            }
+            const CacheRecord *rec = (const CacheRecord *)(data + recOffset);
+            success = pwrite(out, rec, rec->length, newHeader.end) == (ssize_t)rec->length;
+            newHeader.end += rec->length;
+        }
+        success = success &&
+            pwrite(out, &newHeader, sizeof(newHeader), 0) == (ssize_t)sizeof(newHeader) &&
+            ftruncate(out, newHeader.end) == 0 &&
+            rename(tmpPath.c_str(), path.c_str()) == 0;
+        if (success) {
+            __atomic_store_n(&header->obsolete, 1, __ATOMIC_RELEASE);
+        } else {
+            unlink(tmpPath.c_str());
+        }
+        if (out >= 0) {
+            ::close(out);
+        }
+    }
+
+    if (addr != MAP_FAILED) {
+        munmap(addr, st.st_size);
+    }
+    flock(cfd, LOCK_UN);
+    ::close(cfd);
+    compacting = false;
+}
+
+void ExifCache::serialize(const EXIFInfo &info, std::vector<uint8_t> &data) {
+    data.clear();
+    OutArchive ar(data);
+    serializeFields(ar, info);
+}
+
+bool ExifCache::deserialize(const uint8_t *data, uint32_t len, EXIFInfo &info) {
+    info.clear();
+    InArchive ar(data, len);
+    serializeFields(ar, info);
+    return ar.isOk();
+}
+}
@@ -0,0 +1,131 @@
+//
+//  TinyExifCache.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifCache_hpp
+#define TinyExifCache_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include "TinyEXIF.h"
+
+struct stat;
+
+// 元数据持久化缓存
+//
+// 每个文件的解析结果以紧凑的二进制形式追加写入一个内存映射文件，key为
+// (st_dev, st_ino, st_size, st_mtim)。文件没有变化时只需要一次stat就能拿到结果，
+// 不用再打开和解析图片。
+// 缓存文件通过MAP_SHARED映射在多个进程间共享，追加写入时使用flock互斥。
+// 同一个(st_dev, st_ino)只有最后一条记录有效，失效记录超过一半时在后台线程压缩，
+// 压缩后的文件rename替换原文件，并在原文件头标记obsolete，其它进程会自动重新打开。
+// 文件损坏或版本不符时同样在临时文件中重建再rename，不截断可能还被映射着的原文件。
+//
+// 文件格式(本机字节序):
+// [CacheHeader][CacheRecord + payload][CacheRecord + payload]...
+
+namespace TinyEXIF {
+
+class TINYEXIF_LIB ExifCache {
+public:
+    ExifCache();
+    ~ExifCache();
+
+    /// 打开缓存文件，不存在时创建
+    /// @param path 缓存文件地址
+    bool open(const char *path);
+
+    /// 关闭缓存文件，会等待后台压缩结束
+    void close();
+
+    /// 解析一个图片文件的EXIF信息，缓存命中时不会打开图片文件
+    /// @param imagePath 图片地址
+    /// @param info 输出的EXIF信息
+    /// @return 与EXIFInfo::parseFrom相同的错误码
+    int parseFile(const char *imagePath, EXIFInfo &info);
+
+    /// 查询缓存
+    /// @param st 图片文件的stat结果
+    /// @param info 命中时输出的EXIF信息
+    /// @param result 命中时输出当时解析的返回值
+    bool lookup(const struct stat &st, EXIFInfo &info, int &result);
+
+    /// 写入缓存
+    /// @param st 图片文件的stat结果
+    /// @param info 解析得到的EXIF信息
+    /// @param result 解析的返回值
+    bool store(const struct stat &st, const EXIFInfo &info, int result);
+
+    /// 在后台线程压缩缓存文件，去掉失效的记录
+    /// @return 已经有压缩在进行时返回false
+    bool compactAsync();
+
+    /// 缓存中有效的记录数量
+    size_t size();
+
+public:
+
+    /// 将EXIFInfo序列化为紧凑的二进制数据
+    /// @param info EXIF信息
+    /// @param data 输出数据
+    static void serialize(const EXIFInfo &info, std::vector<uint8_t> &data);
+
+    /// 从二进制数据恢复EXIFInfo
+    /// @param data 数据
+    /// @param len 数据长度
+    /// @param info 输出的EXIF信息
+    static bool deserialize(const uint8_t *data, uint32_t len, EXIFInfo &info);
+
+private:
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        bool operator == (const Key &other) const { return dev == other.dev && ino == other.ino; }
+    };
+    struct KeyHash {
+        size_t operator () (const Key &key) const { return (size_t)(key.ino * 0x9E3779B97F4A7C15ull ^ key.dev); }
+    };
+
+    // 缓存文件地址
+    std::string cachePath;
+    // 缓存文件描述符
+    int fd = -1;
+    // 映射的起始地址
+    uint8_t *mapping = NULL;
+    // 映射的长度
+    uint64_t mappingLen = 0;
+    // 已经建立索引的数据结尾
+    uint64_t indexedEnd = 0;
+    // (st_dev, st_ino) -> 最后一条记录的位置
+    std::unordered_map<Key, uint64_t, KeyHash> index;
+    // 保护以上成员
+    std::mutex mutex;
+    // 后台压缩线程
+    std::thread compactThread;
+    // 保护compactThread，压缩由触发它的store所在的线程启动，close在另一个线程中等待它结束
+    std::mutex threadMutex;
+    std::atomic<bool> compacting;
+
+    // 映射文件，并从头建立索引
+    bool openLocked();
+    // 在临时文件中生成空的缓存并替换fd对应的原文件，返回新文件的描述符，失败时返回-1
+    int rebuildLocked(uint64_t fileSize);
+    // 解除映射并关闭文件
+    void closeLocked();
+    // 检查其它进程追加的记录或文件被替换的情况
+    bool refreshLocked();
+    // 映射至少len长度的文件
+    bool mapLocked(uint64_t len);
+    // 为indexedEnd到end之间的记录建立索引
+    void indexLocked(uint64_t end);
+    // 压缩线程执行的函数
+    void compact();
+};
+}
+#endif /* TinyExifCache_hpp */
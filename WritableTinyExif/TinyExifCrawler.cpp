@@ -0,0 +1,316 @@
+//
+//  TinyExifCrawler.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifCrawler.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#ifndef _MSC_VER
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace TinyEXIF {
+
+namespace {
+
+// 读取文件头的字节数，WebP需要RIFF头之后的"WEBP"
+const size_t SIGNATURE_LENGTH = 12;
+
+#ifndef _MSC_VER
+
+#ifdef __linux__
+// getdents64返回的目录项，内核的struct linux_dirent64
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+// 列出目录fd中的所有目录项，对每一项调用entry(name, d_type)
+template <typename Entry>
+bool readEntries(int fd, std::vector<char> &buffer, Entry entry) {
+#ifdef __linux__
+    while (true) {
+        const long len = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (len == 0) {
+            return true;
+        }
+        if (len < 0) {
+            return false;
+        }
+        for (long pos = 0; pos < len; ) {
+            const LinuxDirent64 *dirent = (const LinuxDirent64 *)(buffer.data() + pos);
+            entry(dirent->d_name, dirent->d_type);
+            pos += dirent->d_reclen;
+        }
+    }
+#else
+    (void)buffer;
+    // closedir会关闭fd，使用复制的fd，原来的fd还要用于fstatat和openat
+    const int copy = dup(fd);
+    DIR *dir = copy < 0 ? NULL : fdopendir(copy);
+    if (dir == NULL) {
+        if (copy >= 0) {
+            close(copy);
+        }
+        return false;
+    }
+    while (struct dirent *dirent = readdir(dir)) {
+        entry(dirent->d_name, dirent->d_type);
+    }
+    closedir(dir);
+    return true;
+#endif
+}
+
+unsigned char typeOf(mode_t mode) {
+    if (S_ISDIR(mode)) {
+        return DT_DIR;
+    }
+    return S_ISREG(mode) ? DT_REG : DT_UNKNOWN;
+}
+
+#endif
+
+}
+
+// 一次遍历的共享状态
+class Crawler::Walk {
+public:
+    Walk(const CrawlConfig &_config, BatchFunction &_batch) : config(_config), batch(_batch), active(0) {}
+
+    CrawlStats run(const std::vector<std::string> &roots) {
+        std::vector<std::string> files;
+        for (const std::string &root : roots) {
+#ifndef _MSC_VER
+            struct stat st;
+            if (stat(root.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                if (!config.followSymlinks || visit(st)) {
+                    pending.push_back(root);
+                }
+                continue;
+            }
+#endif
+            files.push_back(root);
+        }
+        emit(files, 0);
+
+        unsigned threadCount = config.threads;
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < threadCount && !pending.empty(); i++) {
+            threads.push_back(std::thread(&Walk::work, this));
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+
+        CrawlStats result;
+        result.directories = directories.load();
+        result.files = fileCount.load();
+        result.statCalls = statCalls.load();
+        result.probes = probes.load();
+        return result;
+    }
+
+private:
+    // 领取目录直到没有待遍历的目录，并且没有线程还在列目录(可能放回新的子目录)
+    void work() {
+#ifndef _MSC_VER
+        std::vector<char> buffer(std::max<size_t>(config.bufferSize, 4096));
+        std::vector<std::string> files;
+        std::vector<std::string> subdirs;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [this] { return !pending.empty() || active == 0; });
+            if (pending.empty()) {
+                break;
+            }
+            const std::string dir = pending.back();
+            pending.pop_back();
+            active++;
+            lock.unlock();
+
+            scan(dir, buffer, files, subdirs);
+
+            lock.lock();
+            pending.insert(pending.end(), subdirs.begin(), subdirs.end());
+            subdirs.clear();
+            active--;
+            condition.notify_all();
+        }
+        lock.unlock();
+        emit(files, 0);
+#endif
+    }
+
+#ifndef _MSC_VER
+    void scan(const std::string &dir, std::vector<char> &buffer, std::vector<std::string> &files, std::vector<std::string> &subdirs) {
+        const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        directories++;
+        const std::string prefix = dir.back() == '/' ? dir : dir + "/";
+        std::vector<std::string> candidates; // 需要读取文件头的文件名
+        readEntries(fd, buffer, [&](const char *name, unsigned char type) {
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                return;
+            }
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                struct stat st;
+                statCalls++;
+                if (fstatat(fd, name, &st, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+                    return;
+                }
+                if (type == DT_LNK && S_ISDIR(st.st_mode) && !config.followSymlinks) {
+                    return;
+                }
+                type = typeOf(st.st_mode);
+            }
+            if (type == DT_DIR) {
+                subdirs.push_back(prefix + name);
+            } else if (type == DT_REG) {
+                switch (config.filter) {
+                    case CRAWL_ALL_FILES:
+                        files.push_back(prefix + name);
+                        break;
+                    case CRAWL_IMAGE_EXTENSIONS:
+                        if (hasImageExtension(name)) {
+                            files.push_back(prefix + name);
+                        }
+                        break;
+                    default:
+                        candidates.push_back(name);
+                        break;
+                }
+            }
+        });
+        if (config.followSymlinks) { // 进入符号链接时，普通目录也要记录，链接可能指回这里
+            for (size_t i = 0; i < subdirs.size(); ) {
+                struct stat st;
+                if (stat(subdirs[i].c_str(), &st) == 0 && visit(st)) {
+                    i++;
+                } else {
+                    subdirs.erase(subdirs.begin() + i);
+                }
+            }
+        }
+        for (const std::string &name : candidates) {
+            uint8_t head[SIGNATURE_LENGTH];
+            const int file = openat(fd, name.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+            if (file < 0) {
+                continue;
+            }
+            probes++;
+            const ssize_t len = pread(file, head, sizeof(head), 0);
+            close(file);
+            if (len > 0 && matchesSignature(head, (size_t)len, config.filter)) {
+                files.push_back(prefix + name);
+            }
+        }
+        close(fd);
+        emit(files, config.batchSize);
+    }
+
+    // 是否第一次访问这个目录
+    bool visit(const struct stat &st) {
+        std::lock_guard<std::mutex> lock(visitedMutex);
+        return visited.insert(std::make_pair((uint64_t)st.st_dev, (uint64_t)st.st_ino)).second;
+    }
+#endif
+
+    // 文件数达到minimum时回调，minimum为0时回调剩余的文件
+    void emit(std::vector<std::string> &files, size_t minimum) {
+        if (files.empty() || files.size() < minimum) {
+            return;
+        }
+        fileCount += files.size();
+        batch(files);
+        files.clear();
+    }
+
+    const CrawlConfig &config;
+    BatchFunction &batch;
+    std::vector<std::string> pending;   // 待遍历的目录
+    unsigned active;                    // 正在列目录的线程数
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::set<std::pair<uint64_t, uint64_t> > visited;  // followSymlinks时访问过的(st_dev, st_ino)
+    std::mutex visitedMutex;
+    std::atomic<uint64_t> directories{0};
+    std::atomic<uint64_t> fileCount{0};
+    std::atomic<uint64_t> statCalls{0};
+    std::atomic<uint64_t> probes{0};
+};
+
+Crawler::Crawler(const CrawlConfig &config) : config(config) {
+}
+
+CrawlStats Crawler::crawl(const std::vector<std::string> &roots, BatchFunction batch) {
+    Walk walk(config, batch);
+    return walk.run(roots);
+}
+
+std::vector<std::string> Crawler::collect(const std::vector<std::string> &roots) {
+    std::vector<std::string> files;
+    std::mutex mutex;
+    crawl(roots, [&](std::vector<std::string> &paths) {
+        std::lock_guard<std::mutex> lock(mutex);
+        files.insert(files.end(), paths.begin(), paths.end());
+    });
+    return files;
+}
+
+bool Crawler::matchesSignature(const uint8_t *head, size_t len, CrawlFilter filter) {
+    if (len >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) {
+        return true;
+    }
+    if (filter != CRAWL_IMAGE_SIGNATURE || len < 4) {
+        return false;
+    }
+    static const uint8_t PNG[4] = {0x89, 'P', 'N', 'G'};
+    static const uint8_t TIFF_LE[4] = {'I', 'I', 0x2A, 0x00};
+    static const uint8_t TIFF_BE[4] = {'M', 'M', 0x00, 0x2A};
+    if (memcmp(head, PNG, 4) == 0 || memcmp(head, TIFF_LE, 4) == 0 || memcmp(head, TIFF_BE, 4) == 0) {
+        return true;
+    }
+    return len >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WEBP", 4) == 0;
+}
+
+bool Crawler::hasImageExtension(const char *name) {
+    static const char* const extensions[] = {".jpg", ".jpeg", ".png", ".webp", ".tif", ".tiff", ".dng"};
+    const char *dot = strrchr(name, '.');
+    if (dot == NULL) {
+        return false;
+    }
+    for (const char *extension : extensions) {
+        size_t i = 0;
+        while (dot[i] != 0 && tolower((unsigned char)dot[i]) == extension[i]) {
+            i++;
+        }
+        if (dot[i] == 0 && extension[i] == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+}
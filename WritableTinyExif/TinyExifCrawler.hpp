@@ -0,0 +1,84 @@
+//
+//  TinyExifCrawler.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifCrawler_hpp
+#define TinyExifCrawler_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "TinyEXIF.h"
+
+// 并行遍历目录
+//
+// 批量处理之前先要列出所有文件。多个线程从共享的目录栈中领取目录，列出的子目录放回栈中。
+// Linux上用大buffer的getdents64一次读取很多目录项，其它系统使用readdir；
+// 文件类型取自d_type，只有文件系统不提供类型(DT_UNKNOWN)或者是符号链接时才调用fstatat。
+// 按文件头过滤时，列完一个目录后依次用openat读取其中文件的前12个字节，不用拼接完整路径。
+// 每个目录列完后，累计的文件达到batchSize个时回调一次，可以直接交给ArrowExporter::appendFiles、Pipeline::run等。
+
+namespace TinyEXIF {
+
+/// 文件的过滤方式
+enum CrawlFilter {
+    CRAWL_ALL_FILES = 0,        // 所有普通文件
+    CRAWL_IMAGE_EXTENSIONS,     // 扩展名是.jpg .jpeg .png .webp .tif .tiff .dng，不读取文件
+    CRAWL_JPEG_SIGNATURE,       // 文件以FF D8 FF开头
+    CRAWL_IMAGE_SIGNATURE       // 文件头是JPEG、PNG、WebP或TIFF
+};
+
+/// 遍历的配置
+struct TINYEXIF_LIB CrawlConfig {
+    unsigned threads = 0;                   // 遍历的线程数，0表示CPU核数；网络存储上可以多于核数
+    CrawlFilter filter = CRAWL_IMAGE_EXTENSIONS;
+    size_t bufferSize = 256 * 1024;         // 每个线程getdents64的buffer大小
+    size_t batchSize = 512;                 // 累计到这么多文件时回调，最后一批可能更少
+    bool followSymlinks = false;            // 是否进入指向目录的符号链接，进入时记录访问过的目录避免循环
+};
+
+/// 遍历的统计
+struct TINYEXIF_LIB CrawlStats {
+    uint64_t directories = 0;   // 列出的目录数
+    uint64_t files = 0;         // 回调的文件数
+    uint64_t statCalls = 0;     // d_type不够用时的fstatat次数
+    uint64_t probes = 0;        // 读取文件头的次数
+};
+
+class TINYEXIF_LIB Crawler {
+public:
+    /// 一批文件，在遍历线程中调用，多个线程时需要线程安全。可以修改或swap走paths
+    typedef std::function<void(std::vector<std::string> &paths)> BatchFunction;
+
+    explicit Crawler(const CrawlConfig &config = CrawlConfig());
+
+    /// 遍历，所有目录遍历完并回调后返回。roots中的文件不过滤，直接回调
+    /// @param roots 文件或目录
+    /// @param batch 回调
+    /// @return 统计
+    CrawlStats crawl(const std::vector<std::string> &roots, BatchFunction batch);
+
+    /// 遍历并返回所有的文件，顺序不固定
+    std::vector<std::string> collect(const std::vector<std::string> &roots);
+
+    /// 文件头是否符合过滤方式
+    /// @param head 文件开头的数据
+    /// @param len head的长度，最多使用12个字节
+    /// @param filter CRAWL_JPEG_SIGNATURE或CRAWL_IMAGE_SIGNATURE
+    static bool matchesSignature(const uint8_t *head, size_t len, CrawlFilter filter);
+
+    /// 文件名的扩展名是否是库能解析的图片格式
+    static bool hasImageExtension(const char *name);
+
+private:
+    class Walk;
+
+    const CrawlConfig config;
+};
+}
+
+#endif /* TinyExifCrawler_hpp */
@@ -0,0 +1,377 @@
+//
+//  TinyExifGeoIndex.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifGeoIndex.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace TinyEXIF {
+
+namespace {
+
+// 索引文件格式版本
+const uint32_t GEO_INDEX_VERSION = 1;
+// 最多的层数，nodeSize至少为2，足够2^63个点
+const uint32_t GEO_MAX_LEVELS = 64;
+const uint32_t GEO_MAX_NODE_SIZE = 1024;
+// 地球平均半径，米
+const double EARTH_RADIUS = 6371008.8;
+const double DEGREES_PER_RADIAN = 180.0 / M_PI;
+
+struct GeoIndexHeader {
+    char magic[8];                      // "TXGEOIX\0"
+    uint32_t version;                   // GEO_INDEX_VERSION
+    uint32_t nodeSize;                  // 每个节点的子节点数
+    uint64_t count;                     // 点数
+    uint32_t levels;                    // 层数，包括第0层的点
+    uint32_t reserved;
+    uint64_t levelCount[GEO_MAX_LEVELS];// 每层的节点数
+};
+
+// 第1层以上的节点
+struct GeoIndexNode {
+    float minLatitude;
+    float minLongitude;
+    float maxLatitude;
+    float maxLongitude;
+    int64_t minTime;
+    int64_t maxTime;
+};
+
+const char GEO_INDEX_MAGIC[8] = {'T', 'X', 'G', 'E', 'O', 'I', 'X', '\0'};
+
+// 向外取整到float，节点的范围总是包含子节点
+inline float floorFloat(double value) {
+    const float result = (float)value;
+    return (double)result > value ? std::nextafter(result, -INFINITY) : result;
+}
+
+inline float ceilFloat(double value) {
+    const float result = (float)value;
+    return (double)result < value ? std::nextafter(result, INFINITY) : result;
+}
+
+// 16位网格坐标在Hilbert曲线上的位置
+uint32_t hilbert(uint32_t x, uint32_t y) {
+    const uint32_t n = 1 << 16;
+    uint32_t d = 0;
+    for (uint32_t s = n >> 1; s > 0; s >>= 1) {
+        const uint32_t rx = (x & s) != 0;
+        const uint32_t ry = (y & s) != 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) { // 旋转象限
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+inline uint32_t gridCoordinate(double value, double min, double max) {
+    const double scaled = (value - min) / (max - min) * 65535.0;
+    return (uint32_t)std::min(65535.0, std::max(0.0, scaled));
+}
+
+// 每层的节点数，第0层是点
+std::vector<uint64_t> levelCounts(uint64_t count, uint32_t nodeSize) {
+    std::vector<uint64_t> counts;
+    if (count == 0) {
+        return counts;
+    }
+    counts.push_back(count);
+    while (counts.back() > 1) {
+        counts.push_back((counts.back() + nodeSize - 1) / nodeSize);
+    }
+    return counts;
+}
+
+inline bool inTimeWindow(int64_t time, int64_t begin, int64_t end) {
+    return time >= begin && time <= end;
+}
+
+// 大圆距离，米
+double haversine(double lat1, double lon1, double lat2, double lon2) {
+    const double dLat = (lat2 - lat1) / DEGREES_PER_RADIAN;
+    const double dLon = (lon2 - lon1) / DEGREES_PER_RADIAN;
+    const double a = std::sin(dLat / 2) * std::sin(dLat / 2) +
+        std::cos(lat1 / DEGREES_PER_RADIAN) * std::cos(lat2 / DEGREES_PER_RADIAN) * std::sin(dLon / 2) * std::sin(dLon / 2);
+    return 2 * EARTH_RADIUS * std::asin(std::min(1.0, std::sqrt(a)));
+}
+
+}
+
+bool GeoIndexBuilder::add(uint64_t id, double latitude, double longitude, int64_t time) {
+    if (!(latitude >= -90 && latitude <= 90 && longitude >= -180 && longitude <= 180)) { // 同时排除NaN
+        return false;
+    }
+    GeoEntry entry;
+    entry.latitude = latitude;
+    entry.longitude = longitude;
+    entry.time = time;
+    entry.id = id;
+    entries.push_back(entry);
+    return true;
+}
+
+bool GeoIndexBuilder::add(uint64_t id, const EXIFInfo &info) {
+    if (!info.GeoLocation.hasLatLon()) {
+        return false;
+    }
+    Timestamp timestamp;
+    const int64_t time = info.getDateTimeOriginal(timestamp) || info.getDateTime(timestamp) ? timestamp.Micros : GEO_TIME_UNKNOWN;
+    return add(id, info.GeoLocation.Latitude, info.GeoLocation.Longitude, time);
+}
+
+bool GeoIndexBuilder::write(const std::string &path, uint32_t nodeSize) {
+    nodeSize = std::min(GEO_MAX_NODE_SIZE, std::max(2u, nodeSize));
+
+    // 按Hilbert曲线排序，相邻的点落在同一个节点中
+    std::vector<std::pair<uint32_t, size_t> > keys(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        keys[i].first = hilbert(gridCoordinate(entries[i].longitude, -180, 180), gridCoordinate(entries[i].latitude, -90, 90));
+        keys[i].second = i;
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<GeoEntry> sorted(entries.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        sorted[i] = entries[keys[i].second];
+    }
+    std::vector<std::pair<uint32_t, size_t> >().swap(keys);
+
+    // 从下往上逐层生成节点
+    const std::vector<uint64_t> counts = levelCounts(sorted.size(), nodeSize);
+    std::vector<GeoIndexNode> nodes;
+    size_t childStart = 0;  // 上一层在nodes中的起始位置
+    for (size_t level = 1; level < counts.size(); level++) {
+        const size_t start = nodes.size();
+        for (uint64_t node = 0; node < counts[level]; node++) {
+            const uint64_t first = node * nodeSize;
+            const uint64_t last = std::min(counts[level - 1], first + nodeSize);
+            GeoIndexNode box;
+            if (level == 1) {
+                double minLat = INFINITY, minLon = INFINITY, maxLat = -INFINITY, maxLon = -INFINITY;
+                box.minTime = INT64_MAX;
+                box.maxTime = INT64_MIN;
+                for (uint64_t i = first; i < last; i++) {
+                    const GeoEntry &entry = sorted[i];
+                    minLat = std::min(minLat, entry.latitude);
+                    maxLat = std::max(maxLat, entry.latitude);
+                    minLon = std::min(minLon, entry.longitude);
+                    maxLon = std::max(maxLon, entry.longitude);
+                    box.minTime = std::min(box.minTime, entry.time);
+                    box.maxTime = std::max(box.maxTime, entry.time);
+                }
+                box.minLatitude = floorFloat(minLat);
+                box.maxLatitude = ceilFloat(maxLat);
+                box.minLongitude = floorFloat(minLon);
+                box.maxLongitude = ceilFloat(maxLon);
+            } else {
+                box = nodes[childStart + first];
+                for (uint64_t i = first + 1; i < last; i++) {
+                    const GeoIndexNode &child = nodes[childStart + i];
+                    box.minLatitude = std::min(box.minLatitude, child.minLatitude);
+                    box.maxLatitude = std::max(box.maxLatitude, child.maxLatitude);
+                    box.minLongitude = std::min(box.minLongitude, child.minLongitude);
+                    box.maxLongitude = std::max(box.maxLongitude, child.maxLongitude);
+                    box.minTime = std::min(box.minTime, child.minTime);
+                    box.maxTime = std::max(box.maxTime, child.maxTime);
+                }
+            }
+            nodes.push_back(box);
+        }
+        childStart = start;
+    }
+
+    GeoIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GEO_INDEX_MAGIC, sizeof(GEO_INDEX_MAGIC));
+    header.version = GEO_INDEX_VERSION;
+    header.nodeSize = nodeSize;
+    header.count = sorted.size();
+    header.levels = (uint32_t)counts.size();
+    std::copy(counts.begin(), counts.end(), header.levelCount);
+
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out (tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open() ||
+            !out.write((const char *)&header, sizeof(header)) ||
+            !out.write((const char *)sorted.data(), sorted.size() * sizeof(GeoEntry)) ||
+            !out.write((const char *)nodes.data(), nodes.size() * sizeof(GeoIndexNode)) ||
+            !out.flush()) {
+            remove(tempPath.c_str());
+            return false;
+        }
+    }
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+GeoIndex::GeoIndex() : mapping(NULL), mappingLen(0), entries(NULL), nodes(NULL), count(0), nodeSize(0) {
+}
+
+GeoIndex::~GeoIndex() {
+    close();
+}
+
+bool GeoIndex::open(const std::string &path) {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    GeoIndexHeader header;
+    if (fstat(fd, &st) != 0 ||
+        st.st_size < (off_t)sizeof(GeoIndexHeader) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, GEO_INDEX_MAGIC, sizeof(GEO_INDEX_MAGIC)) != 0 ||
+        header.version != GEO_INDEX_VERSION ||
+        header.nodeSize < 2 || header.nodeSize > GEO_MAX_NODE_SIZE ||
+        header.count > (uint64_t)st.st_size / sizeof(GeoEntry)) {
+        ::close(fd);
+        return false;
+    }
+    // 每层的节点数由点数决定，和文件长度一起校验，查询时不用再检查越界
+    const std::vector<uint64_t> counts = levelCounts(header.count, header.nodeSize);
+    uint64_t nodeCount = 0;
+    bool valid = header.levels == counts.size();
+    for (size_t level = 0; valid && level < counts.size(); level++) {
+        valid = header.levelCount[level] == counts[level];
+        if (level > 0) {
+            nodeCount += counts[level];
+        }
+    }
+    if (!valid || (uint64_t)st.st_size != sizeof(GeoIndexHeader) + header.count * sizeof(GeoEntry) + nodeCount * sizeof(GeoIndexNode)) {
+        ::close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    mapping = (uint8_t *)addr;
+    mappingLen = st.st_size;
+    entries = (const GeoEntry *)(mapping + sizeof(GeoIndexHeader));
+    nodes = mapping + sizeof(GeoIndexHeader) + header.count * sizeof(GeoEntry);
+    count = header.count;
+    nodeSize = header.nodeSize;
+    levelCount = counts;
+    levelStart.assign(counts.size(), 0);
+    for (size_t level = 2; level < counts.size(); level++) {
+        levelStart[level] = levelStart[level - 1] + counts[level - 1];
+    }
+    return true;
+}
+
+void GeoIndex::close() {
+    if (mapping != NULL) {
+        munmap(mapping, mappingLen);
+        mapping = NULL;
+        mappingLen = 0;
+    }
+    entries = NULL;
+    nodes = NULL;
+    count = 0;
+    nodeSize = 0;
+    levelCount.clear();
+    levelStart.clear();
+}
+
+void GeoIndex::queryBox(double minLatitude, double minLongitude, double maxLatitude, double maxLongitude,
+                        int64_t timeBegin, int64_t timeEnd, std::vector<GeoEntry> &results) const {
+    if (minLongitude <= maxLongitude) {
+        search(minLatitude, minLongitude, maxLatitude, maxLongitude, timeBegin, timeEnd, results);
+    } else { // 跨越180度经线，分成两个范围
+        search(minLatitude, minLongitude, maxLatitude, 180, timeBegin, timeEnd, results);
+        search(minLatitude, -180, maxLatitude, maxLongitude, timeBegin, timeEnd, results);
+    }
+}
+
+void GeoIndex::queryRadius(double latitude, double longitude, double radius,
+                           int64_t timeBegin, int64_t timeEnd, std::vector<GeoEntry> &results) const {
+    if (!(radius >= 0)) {
+        return;
+    }
+    // 先用包含圆的经纬度范围查询，再按距离过滤
+    const double angle = radius / EARTH_RADIUS;
+    const double minLatitude = latitude - angle * DEGREES_PER_RADIAN;
+    const double maxLatitude = latitude + angle * DEGREES_PER_RADIAN;
+    const size_t first = results.size();
+    const double ratio = std::sin(angle) / std::cos(latitude / DEGREES_PER_RADIAN);
+    if (angle >= M_PI / 2 || minLatitude <= -90 || maxLatitude >= 90 || !(ratio < 1)) { // 包含极点，经度不限
+        search(minLatitude, -180, maxLatitude, 180, timeBegin, timeEnd, results);
+    } else {
+        const double delta = std::asin(ratio) * DEGREES_PER_RADIAN;
+        double minLongitude = longitude - delta;
+        double maxLongitude = longitude + delta;
+        if (minLongitude < -180) {
+            minLongitude += 360;
+        }
+        if (maxLongitude > 180) {
+            maxLongitude -= 360;
+        }
+        queryBox(minLatitude, minLongitude, maxLatitude, maxLongitude, timeBegin, timeEnd, results);
+    }
+    size_t kept = first;
+    for (size_t i = first; i < results.size(); i++) {
+        if (haversine(latitude, longitude, results[i].latitude, results[i].longitude) <= radius) {
+            results[kept++] = results[i];
+        }
+    }
+    results.resize(kept);
+}
+
+void GeoIndex::search(double minLatitude, double minLongitude, double maxLatitude, double maxLongitude,
+                      int64_t timeBegin, int64_t timeEnd, std::vector<GeoEntry> &results) const {
+    if (count == 0 || minLatitude > maxLatitude || minLongitude > maxLongitude || timeBegin > timeEnd) {
+        return;
+    }
+    const GeoIndexNode *boxes = (const GeoIndexNode *)nodes;
+    // 待检查的(层, 节点)，从根节点开始，深度优先
+    std::vector<std::pair<uint32_t, uint64_t> > stack;
+    stack.push_back(std::make_pair((uint32_t)(levelCount.size() - 1), (uint64_t)0));
+    while (!stack.empty()) {
+        const uint32_t level = stack.back().first;
+        const uint64_t node = stack.back().second;
+        stack.pop_back();
+        if (level == 0) {
+            const GeoEntry &entry = entries[node];
+            if (entry.latitude >= minLatitude && entry.latitude <= maxLatitude &&
+                entry.longitude >= minLongitude && entry.longitude <= maxLongitude &&
+                inTimeWindow(entry.time, timeBegin, timeEnd)) {
+                results.push_back(entry);
+            }
+            continue;
+        }
+        const GeoIndexNode &box = boxes[levelStart[level] + node];
+        if (box.maxLatitude < minLatitude || box.minLatitude > maxLatitude ||
+            box.maxLongitude < minLongitude || box.minLongitude > maxLongitude ||
+            box.maxTime < timeBegin || box.minTime > timeEnd) {
+            continue;
+        }
+        const uint64_t first = node * nodeSize;
+        const uint64_t last = std::min(levelCount[level - 1], first + nodeSize);
+        for (uint64_t child = last; child > first; child--) { // 倒序放入，按文件中的顺序取出
+            stack.push_back(std::make_pair(level - 1, child - 1));
+        }
+    }
+}
+}
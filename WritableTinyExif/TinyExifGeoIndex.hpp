@@ -0,0 +1,112 @@
+//
+//  TinyExifGeoIndex.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifGeoIndex_hpp
+#define TinyExifGeoIndex_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "TinyEXIF.h"
+
+// 地理位置索引
+//
+// 收集大量图片的经纬度和拍摄时间，生成一个静态的packed R-tree文件，查询时内存映射，不需要加载。
+// 点按经纬度的Hilbert曲线顺序排列，每nodeSize个点组成一个节点，逐层向上直到只剩根节点；
+// 节点记录经纬度的范围和时间范围，所以时间窗口也能剪掉整个子树。
+// 经纬度范围以float保存并向外取整，叶子中的点保留double，查询结果是精确的。
+//
+// 文件格式(本机字节序):
+// [GeoIndexHeader][GeoEntry × count][GeoIndexNode × 第1层到根节点]
+
+namespace TinyEXIF {
+
+/// 没有拍摄时间
+const int64_t GEO_TIME_UNKNOWN = INT64_MIN;
+
+/// 索引中的一个点
+struct TINYEXIF_LIB GeoEntry {
+    double latitude;
+    double longitude;
+    int64_t time;           // 拍摄时间，1970-01-01 00:00:00起的微秒数，没有时为GEO_TIME_UNKNOWN
+    uint64_t id;            // 调用方指定的编号，比如文件列表中的序号
+};
+
+class TINYEXIF_LIB GeoIndexBuilder {
+public:
+    /// 添加一个点
+    /// @param id 编号
+    /// @param latitude 纬度
+    /// @param longitude 经度
+    /// @param time 拍摄时间，微秒
+    /// @return 经纬度不是有效的数值或超出范围时返回false
+    bool add(uint64_t id, double latitude, double longitude, int64_t time = GEO_TIME_UNKNOWN);
+
+    /// 添加一个图片的GeoLocation和DateTimeOriginal(没有时使用DateTime)，时间带上SubSecTime和OffsetTime，见EXIFInfo::getDateTimeOriginal
+    /// @return 没有经纬度或经纬度无效时返回false
+    bool add(uint64_t id, const EXIFInfo &info);
+
+    /// 已经添加的点数
+    size_t size() const { return entries.size(); }
+
+    /// 排序并生成索引文件，先写到临时文件再rename，已经打开旧文件的GeoIndex不受影响
+    /// @param path 索引文件地址
+    /// @param nodeSize 每个节点的子节点数
+    bool write(const std::string &path, uint32_t nodeSize = 16);
+
+private:
+    std::vector<GeoEntry> entries;
+};
+
+class TINYEXIF_LIB GeoIndex {
+public:
+    GeoIndex();
+    ~GeoIndex();
+
+    /// 映射索引文件，文件不完整或格式不对时返回false
+    bool open(const std::string &path);
+
+    /// 解除映射
+    void close();
+
+    /// 索引中的点数
+    uint64_t size() const { return count; }
+
+    /// 查询经纬度范围内、时间窗口内的点，追加到results
+    /// @param minLatitude 最小纬度
+    /// @param minLongitude 最小经度，大于maxLongitude时表示范围跨越180度经线
+    /// @param maxLatitude 最大纬度
+    /// @param maxLongitude 最大经度
+    /// @param timeBegin 时间窗口的开始，微秒，包含；为GEO_TIME_UNKNOWN时也返回没有时间的点
+    /// @param timeEnd 时间窗口的结束，微秒，包含
+    /// @param results 查询结果
+    void queryBox(double minLatitude, double minLongitude, double maxLatitude, double maxLongitude,
+                  int64_t timeBegin, int64_t timeEnd, std::vector<GeoEntry> &results) const;
+
+    /// 查询到中心的大圆距离不超过radius米、时间窗口内的点，追加到results
+    void queryRadius(double latitude, double longitude, double radius,
+                     int64_t timeBegin, int64_t timeEnd, std::vector<GeoEntry> &results) const;
+
+private:
+    GeoIndex(const GeoIndex &);
+    GeoIndex& operator = (const GeoIndex &);
+
+    // 查询不跨越180度经线的范围
+    void search(double minLatitude, double minLongitude, double maxLatitude, double maxLongitude,
+                int64_t timeBegin, int64_t timeEnd, std::vector<GeoEntry> &results) const;
+
+    uint8_t *mapping;
+    uint64_t mappingLen;
+    const GeoEntry *entries;
+    const void *nodes;
+    uint64_t count;
+    uint32_t nodeSize;
+    std::vector<uint64_t> levelCount;   // 每层的节点数，第0层是点
+    std::vector<uint64_t> levelStart;   // 每层在nodes中的起始位置，第0层不使用
+};
+}
+
+#endif /* TinyExifGeoIndex_hpp */
@@ -0,0 +1,249 @@
+//
+//  TinyExifICC.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifICC.hpp"
+#include "JpegMarks.h"
+#include "Utils.h"
+
+#include <cstring>
+
+namespace TinyEXIF {
+
+namespace {
+
+const char ICC_HEADER[] = "ICC_PROFILE"; // 包括结尾的'\0'共12个字节
+const unsigned ICC_HEADER_LENGTH = sizeof(ICC_HEADER) + 2;
+// Profile ID在配置文件头中的位置
+const unsigned ICC_PROFILE_ID_OFFSET = 84;
+
+struct ICCChunk {
+    const uint8_t *data;
+    unsigned length;
+};
+
+// 收集到的所有段，按照序号存放
+struct ICCChunks {
+    ICCChunk chunks[256];
+    uint8_t count = 0;
+    uint8_t found = 0;
+
+    // 添加一段，序号或总数不一致时返回false
+    bool add(uint8_t sequence, uint8_t total, const uint8_t *data, unsigned length) {
+        if (sequence == 0 || total == 0 || sequence > total || (count != 0 && count != total)) {
+            return false;
+        }
+        if (count == 0) {
+            count = total;
+            memset(chunks, 0, sizeof(chunks));
+        }
+        if (chunks[sequence].data != NULL) { // 重复的序号
+            return false;
+        }
+        chunks[sequence].data = data;
+        chunks[sequence].length = length;
+        found++;
+        return true;
+    }
+};
+
+}
+
+ICCProfile::ICCProfile() {
+    clear();
+}
+
+void ICCProfile::clear() {
+    hash = 0;
+    hasProfileID = false;
+    chunks = 0;
+    profile = NULL;
+    profileLength = 0;
+    buffer.clear();
+}
+
+const uint8_t* ICCProfile::chunkData(const uint8_t *payload, unsigned length, uint8_t &sequence, uint8_t &count) {
+    if (length < ICC_HEADER_LENGTH || memcmp(payload, ICC_HEADER, sizeof(ICC_HEADER)) != 0) {
+        return NULL;
+    }
+    sequence = payload[sizeof(ICC_HEADER)];
+    count = payload[sizeof(ICC_HEADER) + 1];
+    return payload + ICC_HEADER_LENGTH;
+}
+
+int ICCProfile::parseFrom(const uint8_t *data, unsigned length) {
+    clear();
+    if (data == NULL || length < 4 || data[0] != JM_START || data[1] != JM_SOI) {
+        return PARSE_INVALID_JPEG;
+    }
+
+    // 一次遍历所有的段，APPn都在SOS之前
+    ICCChunks found;
+    unsigned offset = 2;
+    while (offset + 2 <= length) {
+        if (data[offset] != JM_START) {
+            return PARSE_INVALID_JPEG;
+        }
+        uint8_t marker = data[offset + 1];
+        if (marker == JM_START) { // 填充的0xFF
+            offset++;
+            continue;
+        }
+        offset += 2;
+        if (marker == JM_SOS || marker == JM_EOI) {
+            break;
+        }
+        if ((marker >= JM_RST0 && marker <= JM_RST7) || marker == 0x01) {
+            continue;
+        }
+        if (offset + 2 > length) {
+            return PARSE_INVALID_JPEG;
+        }
+        unsigned sectionLength = Utils::parse16(data + offset, false);
+        if (sectionLength < 2 || sectionLength > length - offset) {
+            return PARSE_INVALID_JPEG;
+        }
+        if (marker == JM_APP2) {
+            uint8_t sequence, count;
+            const uint8_t *chunk = chunkData(data + offset + 2, sectionLength - 2, sequence, count);
+            if (chunk != NULL && !found.add(sequence, count, chunk, sectionLength - 2 - ICC_HEADER_LENGTH)) {
+                return PARSE_CORRUPT_DATA;
+            }
+        }
+        offset += sectionLength;
+    }
+
+    if (found.count == 0) {
+        return PARSE_ABSENT_DATA;
+    }
+    if (found.found != found.count) { // 缺少某些段
+        return PARSE_CORRUPT_DATA;
+    }
+    chunks = found.count;
+    if (chunks == 1) { // 只有一段时直接引用
+        profile = found.chunks[1].data;
+        profileLength = found.chunks[1].length;
+        return finish();
+    }
+
+    size_t total = 0;
+    for (unsigned i = 1; i <= found.count; i++) {
+        total += found.chunks[i].length;
+    }
+    buffer.reserve(total);
+    for (unsigned i = 1; i <= found.count; i++) {
+        buffer.insert(buffer.end(), found.chunks[i].data, found.chunks[i].data + found.chunks[i].length);
+    }
+    profile = buffer.data();
+    profileLength = (unsigned)buffer.size();
+    return finish();
+}
+
+int ICCProfile::parseFrom(EXIFStream &stream) {
+    clear();
+    const uint8_t *buf;
+    if (!stream.IsValid() || (buf = stream.GetBuffer(2)) == NULL || buf[0] != JM_START || buf[1] != JM_SOI) {
+        return PARSE_INVALID_JPEG;
+    }
+
+    // 数据流的buffer在下一次读取后失效，每一段都要先拷贝出来
+    ICCChunks found;
+    std::vector<std::vector<uint8_t>> copies(256);
+    while ((buf = stream.GetBuffer(2)) != NULL) {
+        if (buf[0] != JM_START) {
+            return PARSE_INVALID_JPEG;
+        }
+        uint8_t marker = buf[1];
+        while (marker == JM_START && (buf = stream.GetBuffer(1)) != NULL) {
+            marker = buf[0];
+        }
+        if (buf == NULL || marker == JM_SOS || marker == JM_EOI) {
+            break;
+        }
+        if ((marker >= JM_RST0 && marker <= JM_RST7) || marker == 0x01) {
+            continue;
+        }
+        if ((buf = stream.GetBuffer(2)) == NULL) {
+            return PARSE_INVALID_JPEG;
+        }
+        unsigned sectionLength = Utils::parse16(buf, false);
+        if (sectionLength < 2) {
+            return PARSE_INVALID_JPEG;
+        }
+        sectionLength -= 2;
+        if (marker != JM_APP2) {
+            if (!stream.SkipBuffer(sectionLength)) {
+                return PARSE_INVALID_JPEG;
+            }
+            continue;
+        }
+        if ((buf = stream.GetBuffer(sectionLength)) == NULL) {
+            return PARSE_INVALID_JPEG;
+        }
+        uint8_t sequence, count;
+        const uint8_t *chunk = chunkData(buf, sectionLength, sequence, count);
+        if (chunk == NULL) {
+            continue;
+        }
+        unsigned chunkLength = sectionLength - ICC_HEADER_LENGTH;
+        if (!found.add(sequence, count, chunk, chunkLength)) {
+            return PARSE_CORRUPT_DATA;
+        }
+        copies[sequence].assign(chunk, chunk + chunkLength);
+    }
+
+    if (found.count == 0) {
+        return PARSE_ABSENT_DATA;
+    }
+    if (found.found != found.count) {
+        return PARSE_CORRUPT_DATA;
+    }
+    chunks = found.count;
+    if (chunks == 1) {
+        buffer.swap(copies[1]);
+    } else {
+        size_t total = 0;
+        for (unsigned i = 1; i <= found.count; i++) {
+            total += copies[i].size();
+        }
+        buffer.reserve(total);
+        for (unsigned i = 1; i <= found.count; i++) {
+            buffer.insert(buffer.end(), copies[i].begin(), copies[i].end());
+        }
+    }
+    profile = buffer.data();
+    profileLength = (unsigned)buffer.size();
+    return finish();
+}
+
+int ICCProfile::finish() {
+    // 配置文件头128字节，开头4个字节是配置文件长度
+    if (profileLength < 128 || Utils::parse32(profile, false) != profileLength) {
+        const unsigned length = profileLength;
+        clear();
+        return length == 0 ? PARSE_ABSENT_DATA : PARSE_CORRUPT_DATA;
+    }
+
+    // Profile ID是除去几个可变字段之后的MD5，全为0表示没有计算
+    const uint8_t *id = profile + ICC_PROFILE_ID_OFFSET;
+    uint64_t high = 0, low = 0;
+    for (int i = 0; i < 8; i++) {
+        high = (high << 8) | id[i];
+        low = (low << 8) | id[i + 8];
+    }
+    hasProfileID = (high | low) != 0;
+    if (hasProfileID) { // MD5的前64位已经足够分散
+        hash = high;
+        return PARSE_SUCCESS;
+    }
+
+    // FNV-1a
+    hash = 0xcbf29ce484222325ull;
+    for (unsigned i = 0; i < profileLength; i++) {
+        hash ^= profile[i];
+        hash *= 0x100000001b3ull;
+    }
+    return PARSE_SUCCESS;
+}
+}
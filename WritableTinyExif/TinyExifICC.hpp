@@ -0,0 +1,123 @@
+//
+//  TinyExifICC.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifICC_hpp
+#define TinyExifICC_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "TinyEXIF.h"
+
+// ICC颜色配置(APP2段)
+//
+// 较大的配置文件会被拆分到多个APP2段中，每段的格式为：
+// "ICC_PROFILE\0" + 序号(从1开始，1字节) + 总段数(1字节) + 数据
+// 只有一段时直接引用原始数据，不拷贝；多段时按序号拼接到一个buffer中。
+
+namespace TinyEXIF {
+
+class TINYEXIF_LIB ICCProfile {
+public:
+    ICCProfile();
+
+    /// 从内存中的jpeg图片查找ICC配置，一次遍历找到所有的段。
+    /// 只有一段时data()指向图片数据内部，使用期间需要保证图片数据有效
+    /// @param data jpeg图片数据
+    /// @param length 数据长度
+    /// @return 与EXIFInfo::parseFrom相同的错误码，没有ICC配置时返回PARSE_ABSENT_DATA
+    int parseFrom(const uint8_t *data, unsigned length);
+
+    /// 从数据流中查找ICC配置，数据流的buffer不能长期引用，总是会拷贝数据
+    /// @param stream jpeg图片数据流
+    int parseFrom(EXIFStream &stream);
+
+    /// 清空
+    void clear();
+
+    /// 配置文件数据
+    const uint8_t* data() const { return profile; }
+    /// 配置文件长度
+    unsigned length() const { return profileLength; }
+    /// 是否直接引用了图片数据
+    bool isZeroCopy() const { return profile != NULL && buffer.empty(); }
+
+public:
+    // 配置文件内容的hash：配置文件头中有Profile ID(84~99字节，配置文件的MD5)时使用它，否则使用FNV-1a
+    uint64_t hash;
+    // 是否使用了Profile ID
+    bool hasProfileID;
+    // APP2段的数量
+    uint8_t chunks;
+
+private:
+    // 配置文件数据，指向图片数据或者buffer
+    const uint8_t *profile;
+    unsigned profileLength;
+    // 多段时拼接的数据
+    std::vector<uint8_t> buffer;
+
+    // 查找ICC_PROFILE段，返回数据的起始位置
+    static const uint8_t* chunkData(const uint8_t *payload, unsigned length, uint8_t &sequence, uint8_t &count);
+    // 拼接完成后计算hash
+    int finish();
+};
+
+// 进程内共享的ICC配置解析结果缓存，以hash为key。
+// 大部分图片只使用少数几种配置(sRGB、Display P3等)，命中时不需要再解析。
+// T是调用方解析后的配置类型，多线程安全。
+template <typename T>
+class ICCProfileCache {
+public:
+    /// 查找配置的解析结果，没有时调用parse解析并缓存
+    /// @param profile ICC配置
+    /// @param parse 解析函数，参数为(const uint8_t *data, unsigned length)，返回T
+    template <typename Parser>
+    std::shared_ptr<const T> get(const ICCProfile &profile, Parser parse) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = cache.find(profile.hash);
+            if (it != cache.end() && it->second.length == profile.length()) {
+                return it->second.value;
+            }
+        }
+
+        // 在锁外解析，同时解析同一个配置时保留先写入的结果
+        std::shared_ptr<const T> value = std::make_shared<const T>(parse(profile.data(), profile.length()));
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(profile.hash);
+        if (it == cache.end()) {
+            Entry entry = {profile.length(), value};
+            cache.emplace(profile.hash, entry);
+            return value;
+        }
+        // hash冲突时不缓存
+        return it->second.length == profile.length() ? it->second.value : value;
+    }
+
+    /// 缓存的配置数量
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cache.size();
+    }
+
+    /// 清空缓存
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cache.clear();
+    }
+
+private:
+    struct Entry {
+        unsigned length;
+        std::shared_ptr<const T> value;
+    };
+    std::unordered_map<uint64_t, Entry> cache;
+    std::mutex mutex;
+};
+}
+#endif /* TinyExifICC_hpp */
@@ -0,0 +1,302 @@
+//
+//  TinyExifIPTC.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifIPTC.hpp"
+#include "JpegMarks.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+namespace TinyEXIF {
+
+namespace {
+
+const char PHOTOSHOP_HEADER[] = "Photoshop 3.0"; // 包括结尾的'\0'共14个字节
+const char RESOURCE_SIGNATURE[] = "8BIM";
+const uint16_t RESOURCE_IPTC = 0x0404;
+const uint16_t RESOURCE_IPTC_DIGEST = 0x0425;
+const uint8_t IPTC_TAG_MARKER = 0x1C;
+
+// 一个8BIM资源
+struct Resource {
+    uint16_t id;
+    unsigned start;     // 资源的起始位置(从"8BIM"开始)
+    unsigned end;       // 资源的结尾，包括补齐的字节
+    unsigned data;      // 数据起始位置
+    unsigned size;      // 数据长度
+};
+
+// 读取下一个8BIM资源，数据结尾或者损坏时返回false
+bool nextResource(const uint8_t *buf, unsigned len, unsigned offset, Resource &resource) {
+    if (offset + 4 + 2 + 2 + 4 > len || memcmp(buf + offset, RESOURCE_SIGNATURE, 4) != 0) {
+        return false;
+    }
+    resource.start = offset;
+    resource.id = Utils::parse16(buf + offset + 4, false);
+    offset += 6;
+    unsigned nameLength = (1 + buf[offset] + 1) & ~1u; // Pascal字符串，包括长度字节补齐到偶数
+    if (offset + nameLength + 4 > len) {
+        return false;
+    }
+    offset += nameLength;
+    resource.size = Utils::parse32(buf + offset, false);
+    offset += 4;
+    if (resource.size > len - offset) {
+        return false;
+    }
+    resource.data = offset;
+    resource.end = std::min(offset + ((resource.size + 1) & ~1u), len);
+    return true;
+}
+
+bool isPhotoshopSegment(const uint8_t *buf, unsigned len) {
+    return len >= sizeof(PHOTOSHOP_HEADER) && memcmp(buf, PHOTOSHOP_HEADER, sizeof(PHOTOSHOP_HEADER)) == 0;
+}
+
+void appendBigEndian(std::vector<uint8_t> &output, uint32_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        output.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+
+}
+
+IPTCInfo::IPTCInfo() {
+    clear();
+}
+
+void IPTCInfo::clear() {
+    joinedData.reset();
+    Entries.clear();
+    ObjectName = StringView();
+    Headline = StringView();
+    Caption = StringView();
+    Writer = StringView();
+    Byline = StringView();
+    BylineTitle = StringView();
+    Credit = StringView();
+    Source = StringView();
+    CopyrightNotice = StringView();
+    DateCreated = StringView();
+    TimeCreated = StringView();
+    City = StringView();
+    ProvinceState = StringView();
+    Country = StringView();
+    Keywords.clear();
+    CodedCharacterSet = StringView();
+}
+
+StringView IPTCInfo::find(uint8_t record, uint8_t dataset) const {
+    for (const IPTCEntry &entry : Entries) {
+        if (entry.record == record && entry.dataset == dataset) {
+            return entry.value;
+        }
+    }
+    return StringView();
+}
+
+int IPTCInfo::parseFrom(const uint8_t *data, unsigned length) {
+    clear();
+    if (data == NULL || length < 4 || data[0] != JM_START || data[1] != JM_SOI) {
+        return PARSE_INVALID_JPEG;
+    }
+
+    // Photoshop把超过一个段的8BIM资源拆分到连续的多个APP13段中，每段都以"Photoshop 3.0\0"开头，
+    // 资源可能从中间断开。只有一段时直接解析，多段时去掉后面各段的头拼接起来再解析
+    const uint8_t *first = NULL;
+    unsigned firstLength = 0;
+    unsigned offset = 2;
+    while (offset + 2 <= length) {
+        if (data[offset] != JM_START) {
+            return PARSE_INVALID_JPEG;
+        }
+        uint8_t marker = data[offset + 1];
+        if (marker == JM_START) { // 填充的0xFF
+            offset++;
+            continue;
+        }
+        offset += 2;
+        if (marker == JM_SOS || marker == JM_EOI) {
+            break;
+        }
+        if ((marker >= JM_RST0 && marker <= JM_RST7) || marker == 0x01) {
+            continue;
+        }
+        if (offset + 2 > length) {
+            return PARSE_INVALID_JPEG;
+        }
+        unsigned sectionLength = Utils::parse16(data + offset, false);
+        if (sectionLength < 2 || sectionLength > length - offset) {
+            return PARSE_INVALID_JPEG;
+        }
+        const uint8_t *segment = data + offset + 2;
+        const unsigned segmentLength = sectionLength - 2;
+        if (marker == JM_APP13 && isPhotoshopSegment(segment, segmentLength)) {
+            if (first == NULL) {
+                first = segment;
+                firstLength = segmentLength;
+            } else {
+                if (!joinedData) {
+                    joinedData = std::make_shared<std::vector<uint8_t> >(first, first + firstLength);
+                }
+                joinedData->insert(joinedData->end(), segment + sizeof(PHOTOSHOP_HEADER), segment + segmentLength);
+            }
+        }
+        offset += sectionLength;
+    }
+    if (first == NULL) {
+        return PARSE_ABSENT_DATA;
+    }
+    if (!joinedData) {
+        return parseFromAPP13Segment(first, firstLength);
+    }
+    return parseFromAPP13Segment(joinedData->data(), (unsigned)joinedData->size());
+}
+
+int IPTCInfo::parseFromAPP13Segment(const uint8_t *buf, unsigned len) {
+    if (buf == NULL || !isPhotoshopSegment(buf, len)) {
+        return PARSE_ABSENT_DATA;
+    }
+
+    int result = PARSE_ABSENT_DATA;
+    Resource resource;
+    unsigned offset = sizeof(PHOTOSHOP_HEADER);
+    while (offset < len) {
+        if (!nextResource(buf, len, offset, resource)) {
+            return PARSE_CORRUPT_DATA;
+        }
+        if (resource.id == RESOURCE_IPTC) {
+            int ret = parseFromIIM(buf + resource.data, resource.size);
+            if (ret != PARSE_SUCCESS) {
+                return ret;
+            }
+            result = PARSE_SUCCESS;
+        }
+        offset = resource.end;
+    }
+    return result;
+}
+
+int IPTCInfo::parseFromIIM(const uint8_t *buf, unsigned len) {
+    unsigned offset = 0;
+    while (offset < len) {
+        if (buf[offset] != IPTC_TAG_MARKER) {
+            // 结尾可能有补齐的0
+            if (buf[offset] == 0) {
+                break;
+            }
+            return PARSE_CORRUPT_DATA;
+        }
+        if (offset + 5 > len) {
+            return PARSE_CORRUPT_DATA;
+        }
+        uint8_t record = buf[offset + 1];
+        uint8_t dataset = buf[offset + 2];
+        uint32_t size = Utils::parse16(buf + offset + 3, false);
+        offset += 5;
+        if (size & 0x8000) { // 扩展长度，后面size & 0x7FFF个字节是真正的长度
+            unsigned bytes = size & 0x7FFF;
+            if (bytes == 0 || bytes > 4 || offset + bytes > len) {
+                return PARSE_CORRUPT_DATA;
+            }
+            size = 0;
+            for (unsigned i = 0; i < bytes; i++) {
+                size = (size << 8) | buf[offset + i];
+            }
+            offset += bytes;
+        }
+        if (size > len - offset) {
+            return PARSE_CORRUPT_DATA;
+        }
+
+        IPTCEntry entry;
+        entry.record = record;
+        entry.dataset = dataset;
+        entry.value = StringView((const char *)buf + offset, size);
+        Entries.push_back(entry);
+        offset += size;
+
+        if (record == IPTC_ENVELOPE_RECORD && dataset == 90) {
+            CodedCharacterSet = entry.value;
+            continue;
+        }
+        if (record != IPTC_APPLICATION_RECORD) {
+            continue;
+        }
+        switch (dataset) {
+            case IPTC_OBJECT_NAME:       ObjectName = entry.value; break;
+            case IPTC_KEYWORDS:          Keywords.push_back(entry.value); break;
+            case IPTC_DATE_CREATED:      DateCreated = entry.value; break;
+            case IPTC_TIME_CREATED:      TimeCreated = entry.value; break;
+            case IPTC_BYLINE:            if (Byline.empty()) Byline = entry.value; break;
+            case IPTC_BYLINE_TITLE:      BylineTitle = entry.value; break;
+            case IPTC_CITY:              City = entry.value; break;
+            case IPTC_PROVINCE_STATE:    ProvinceState = entry.value; break;
+            case IPTC_COUNTRY:           Country = entry.value; break;
+            case IPTC_HEADLINE:          Headline = entry.value; break;
+            case IPTC_CREDIT:            Credit = entry.value; break;
+            case IPTC_SOURCE:            Source = entry.value; break;
+            case IPTC_COPYRIGHT_NOTICE:  CopyrightNotice = entry.value; break;
+            case IPTC_CAPTION:           Caption = entry.value; break;
+            case IPTC_WRITER:            Writer = entry.value; break;
+            default: break;
+        }
+    }
+    return PARSE_SUCCESS;
+}
+
+void buildIPTCData(const std::vector<IPTCValue> &values, std::vector<uint8_t> &output) {
+    output.clear();
+    for (const IPTCValue &value : values) {
+        output.push_back(IPTC_TAG_MARKER);
+        output.push_back(value.record);
+        output.push_back(value.dataset);
+        uint32_t size = (uint32_t)value.value.size();
+        if (size < 0x8000) {
+            appendBigEndian(output, size, 2);
+        } else { // 扩展长度，使用4个字节
+            appendBigEndian(output, 0x8004, 2);
+            appendBigEndian(output, size, 4);
+        }
+        output.insert(output.end(), value.value.begin(), value.value.end());
+    }
+}
+
+bool buildAPP13Segment(const uint8_t *original, unsigned originalLength, const std::vector<uint8_t> &iptc, std::vector<uint8_t> &output) {
+    output.assign(PHOTOSHOP_HEADER, PHOTOSHOP_HEADER + sizeof(PHOTOSHOP_HEADER));
+
+    // 保留其它的资源，IPTC摘要和新的数据不一致，一起删除
+    if (original != NULL) {
+        Resource resource;
+        unsigned offset = sizeof(PHOTOSHOP_HEADER);
+        while (offset < originalLength) {
+            if (!nextResource(original, originalLength, offset, resource)) {
+                return false;
+            }
+            if (resource.id != RESOURCE_IPTC && resource.id != RESOURCE_IPTC_DIGEST) {
+                output.insert(output.end(), original + resource.start, original + resource.end);
+                if ((resource.end - resource.start) & 1) { // 数据在段尾没有补齐
+                    output.push_back(0);
+                }
+            }
+            offset = resource.end;
+        }
+    }
+
+    if (!iptc.empty()) {
+        output.insert(output.end(), RESOURCE_SIGNATURE, RESOURCE_SIGNATURE + 4);
+        appendBigEndian(output, RESOURCE_IPTC, 2);
+        appendBigEndian(output, 0, 2); // 空的名称
+        appendBigEndian(output, (uint32_t)iptc.size(), 4);
+        output.insert(output.end(), iptc.begin(), iptc.end());
+        if (iptc.size() & 1) {
+            output.push_back(0);
+        }
+    }
+    return true;
+}
+}
@@ -0,0 +1,134 @@
+//
+//  TinyExifIPTC.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifIPTC_hpp
+#define TinyExifIPTC_hpp
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TinyEXIF.h"
+
+// IPTC-IIM(APP13段)
+//
+// APP13段的格式为 "Photoshop 3.0\0" + 多个8BIM资源：
+// "8BIM" + 资源ID(2字节) + 名称(Pascal字符串，补齐到偶数长度) + 数据长度(4字节) + 数据(补齐到偶数长度)
+// IPTC数据在ID为0x0404的资源中，由多个dataset组成：
+// 0x1C + record(1字节) + dataset(1字节) + 长度(2字节，最高位为1时表示后面跟着的长度字节数) + 数据
+// 所有数值都是大端。
+
+namespace TinyEXIF {
+
+// 常用的dataset，都在record 2(Application Record)中
+enum IPTCDataset {
+    IPTC_RECORD_VERSION      = 0,   // 2:00 版本
+    IPTC_OBJECT_NAME         = 5,   // 2:05 标题
+    IPTC_KEYWORDS            = 25,  // 2:25 关键词，可重复
+    IPTC_DATE_CREATED        = 55,  // 2:55 创建日期 CCYYMMDD
+    IPTC_TIME_CREATED        = 60,  // 2:60 创建时间 HHMMSS±HHMM
+    IPTC_BYLINE              = 80,  // 2:80 作者，可重复
+    IPTC_BYLINE_TITLE        = 85,  // 2:85 作者职位
+    IPTC_CITY                = 90,  // 2:90 城市
+    IPTC_PROVINCE_STATE      = 95,  // 2:95 省/州
+    IPTC_COUNTRY             = 101, // 2:101 国家
+    IPTC_HEADLINE            = 105, // 2:105 标题
+    IPTC_CREDIT              = 110, // 2:110 提供者
+    IPTC_SOURCE              = 115, // 2:115 来源
+    IPTC_COPYRIGHT_NOTICE    = 116, // 2:116 版权
+    IPTC_CAPTION             = 120, // 2:120 说明
+    IPTC_WRITER              = 122, // 2:122 说明的作者
+};
+
+// IPTC的record
+const uint8_t IPTC_ENVELOPE_RECORD = 1;
+const uint8_t IPTC_APPLICATION_RECORD = 2;
+
+// 一个dataset
+struct TINYEXIF_LIB IPTCEntry {
+    uint8_t record;     // record号
+    uint8_t dataset;    // dataset号
+    StringView value;   // 数据，指向解析的图片数据内部
+};
+
+// 用于写入的dataset，ExifWriter::setIPTC
+struct TINYEXIF_LIB IPTCValue {
+    uint8_t record;     // record号
+    uint8_t dataset;    // dataset号
+    std::string value;  // 数据
+};
+
+class TINYEXIF_LIB IPTCInfo {
+public:
+    IPTCInfo();
+
+    /// 解析jpeg图片中的IPTC数据，不拷贝数据，所有的值都指向data内部，使用期间需要保证data有效。
+    /// 8BIM资源拆分在多个APP13段中时拼接后解析，这时值指向IPTCInfo持有的拼接数据
+    /// @param data jpeg图片数据
+    /// @param length 数据长度
+    /// @return 与EXIFInfo::parseFrom相同的错误码，没有IPTC数据时返回PARSE_ABSENT_DATA
+    int parseFrom(const uint8_t *data, unsigned length);
+
+    /// 解析一个APP13段(以"Photoshop 3.0\0"开头的数据)
+    /// @param buf 段数据，不包括标记和长度
+    /// @param len 段数据长度
+    int parseFromAPP13Segment(const uint8_t *buf, unsigned len);
+
+    /// 解析0x0404资源中的dataset
+    /// @param buf 资源数据
+    /// @param len 资源数据长度
+    int parseFromIIM(const uint8_t *buf, unsigned len);
+
+    /// 清空
+    void clear();
+
+    /// 查找第一个record:dataset的值
+    /// @param record record号
+    /// @param dataset dataset号
+    StringView find(uint8_t record, uint8_t dataset) const;
+
+public:
+    // 所有的dataset，按照出现的顺序
+    std::vector<IPTCEntry> Entries;
+
+    // 常用的字段，指向图片数据内部
+    StringView ObjectName;
+    StringView Headline;
+    StringView Caption;
+    StringView Writer;
+    StringView Byline;
+    StringView BylineTitle;
+    StringView Credit;
+    StringView Source;
+    StringView CopyrightNotice;
+    StringView DateCreated;
+    StringView TimeCreated;
+    StringView City;
+    StringView ProvinceState;
+    StringView Country;
+    std::vector<StringView> Keywords;
+    // 1:90 字符集，"\x1B%G"表示UTF-8
+    StringView CodedCharacterSet;
+
+private:
+    // 多个APP13段拼接后的数据，复制的IPTCInfo共用，值仍然有效
+    std::shared_ptr<std::vector<uint8_t> > joinedData;
+};
+
+/// 按照dataset生成0x0404资源的数据(IIM)
+/// @param values dataset列表
+/// @param output 输出数据
+void TINYEXIF_LIB buildIPTCData(const std::vector<IPTCValue> &values, std::vector<uint8_t> &output);
+
+/// 生成APP13段的数据(不包括标记和长度)：保留original中除IPTC(0x0404)和IPTC摘要(0x0425)以外的8BIM资源，
+/// 然后添加新的IPTC资源。结果可能超过一个段的长度，由调用者按Photoshop的方式拆分
+/// @param original 原来的APP13段数据，多个段时是拼接后的数据(见IPTCInfo::parseFrom)，没有时传NULL
+/// @param originalLength 原来的数据长度
+/// @param iptc 新的IPTC数据，由buildIPTCData生成
+/// @param output 输出数据
+/// @return 原来的数据损坏时返回false
+bool TINYEXIF_LIB buildAPP13Segment(const uint8_t *original, unsigned originalLength, const std::vector<uint8_t> &iptc, std::vector<uint8_t> &output);
+}
+#endif /* TinyExifIPTC_hpp */
@@ -0,0 +1,316 @@
+//
+//  TinyExifJson.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifJson.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace TinyEXIF {
+
+namespace {
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+void appendString(std::string &output, const std::string &value);
+void appendInteger(std::string &output, int64_t value);
+
+// 写入一个JSON对象的字段
+class JsonObject {
+public:
+    explicit JsonObject(std::string &_output) : output(_output), first(true) {
+        output += '{';
+    }
+
+    void string(const char *key, const std::string &value) {
+        if (!value.empty()) {
+            name(key);
+            appendString(output, value);
+        }
+    }
+    void integer(const char *key, int64_t value) {
+        if (value != 0) {
+            name(key);
+            appendInteger(output, value);
+        }
+    }
+    void number(const char *key, double value) {
+        if (value != 0) {
+            name(key);
+            JsonLineWriter::appendNumber(value, output);
+        }
+    }
+    // 由has*()判断是否存在，0也输出
+    void number(const char *key, double value, bool present) {
+        if (present) {
+            name(key);
+            JsonLineWriter::appendNumber(value, output);
+        }
+    }
+    void integers(const char *key, const std::vector<uint16_t> &values) {
+        if (!values.empty()) {
+            name(key);
+            output += '[';
+            for (size_t i = 0; i < values.size(); i++) {
+                if (i > 0) {
+                    output += ',';
+                }
+                appendInteger(output, values[i]);
+            }
+            output += ']';
+        }
+    }
+    void end() {
+        output += "}\n";
+    }
+
+private:
+    // 字段名都是ASCII，不需要转义
+    void name(const char *key) {
+        output += first ? "\"" : ",\"";
+        output += key;
+        output += "\":";
+        first = false;
+    }
+
+    std::string &output;
+    bool first;
+};
+
+// p开始的合法UTF-8字符的字节数，不合法时返回0
+// 按RFC 3629排除过长编码、代理区和超过U+10FFFF的码点
+size_t utf8Length(const uint8_t *p, const uint8_t *end) {
+    const uint8_t c = p[0];
+    size_t len;
+    uint8_t low = 0x80, high = 0xBF;    // 第二个字节的范围
+    if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) {
+            low = 0xA0;
+        } else if (c == 0xED) {
+            high = 0x9F;
+        }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) {
+            low = 0x90;
+        } else if (c == 0xF4) {
+            high = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    if ((size_t)(end - p) < len || p[1] < low || p[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < len; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+void appendString(std::string &output, const std::string &value) {
+    output += '"';
+    const uint8_t *p = (const uint8_t *)value.data();
+    const uint8_t *end = p + value.size();
+    while (p < end) {
+        // 不需要转义的ASCII整段追加
+        const uint8_t *run = p;
+        while (p < end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\') {
+            p++;
+        }
+        output.append((const char *)run, p - run);
+        if (p == end) {
+            break;
+        }
+        const uint8_t c = *p;
+        if (c >= 0x80) {
+            const size_t len = utf8Length(p, end);
+            if (len > 0) {
+                output.append((const char *)p, len);
+                p += len;
+            } else {
+                output += "\\ufffd";
+                p++;
+            }
+            continue;
+        }
+        switch (c) {
+            case '"': output += "\\\""; break;
+            case '\\': output += "\\\\"; break;
+            case '\n': output += "\\n"; break;
+            case '\r': output += "\\r"; break;
+            case '\t': output += "\\t"; break;
+            default: {
+                const char escaped[6] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xF]};
+                output.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+        p++;
+    }
+    output += '"';
+}
+
+void appendInteger(std::string &output, int64_t value) {
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    output.append(p, buffer + sizeof(buffer) - p);
+}
+
+// 字段表，fieldNames()和selectFields()使用这里的名字
+struct JsonField {
+    const char *name;
+    void (*write)(JsonObject &, const EXIFInfo &);
+};
+
+const JsonField FIELDS[] = {
+    {"ImageWidth", [](JsonObject &o, const EXIFInfo &i) { o.integer("ImageWidth", i.ImageWidth); }},
+    {"ImageHeight", [](JsonObject &o, const EXIFInfo &i) { o.integer("ImageHeight", i.ImageHeight); }},
+    {"RelatedImageWidth", [](JsonObject &o, const EXIFInfo &i) { o.integer("RelatedImageWidth", i.RelatedImageWidth); }},
+    {"RelatedImageHeight", [](JsonObject &o, const EXIFInfo &i) { o.integer("RelatedImageHeight", i.RelatedImageHeight); }},
+    {"FrameWidth", [](JsonObject &o, const EXIFInfo &i) { o.integer("FrameWidth", i.Frame.Width); }},
+    {"FrameHeight", [](JsonObject &o, const EXIFInfo &i) { o.integer("FrameHeight", i.Frame.Height); }},
+    {"ImageDescription", [](JsonObject &o, const EXIFInfo &i) { o.string("ImageDescription", i.ImageDescription); }},
+    {"Make", [](JsonObject &o, const EXIFInfo &i) { o.string("Make", i.Make); }},
+    {"Model", [](JsonObject &o, const EXIFInfo &i) { o.string("Model", i.Model); }},
+    {"SerialNumber", [](JsonObject &o, const EXIFInfo &i) { o.string("SerialNumber", i.SerialNumber); }},
+    {"Orientation", [](JsonObject &o, const EXIFInfo &i) { o.integer("Orientation", i.Orientation); }},
+    {"XResolution", [](JsonObject &o, const EXIFInfo &i) { o.number("XResolution", i.XResolution); }},
+    {"YResolution", [](JsonObject &o, const EXIFInfo &i) { o.number("YResolution", i.YResolution); }},
+    {"ResolutionUnit", [](JsonObject &o, const EXIFInfo &i) { o.integer("ResolutionUnit", i.ResolutionUnit); }},
+    {"BitsPerSample", [](JsonObject &o, const EXIFInfo &i) { o.integer("BitsPerSample", i.BitsPerSample); }},
+    {"Software", [](JsonObject &o, const EXIFInfo &i) { o.string("Software", i.Software); }},
+    {"DateTime", [](JsonObject &o, const EXIFInfo &i) { o.string("DateTime", i.DateTime); }},
+    {"DateTimeOriginal", [](JsonObject &o, const EXIFInfo &i) { o.string("DateTimeOriginal", i.DateTimeOriginal); }},
+    {"DateTimeDigitized", [](JsonObject &o, const EXIFInfo &i) { o.string("DateTimeDigitized", i.DateTimeDigitized); }},
+    {"SubSecTimeOriginal", [](JsonObject &o, const EXIFInfo &i) { o.string("SubSecTimeOriginal", i.SubSecTimeOriginal); }},
+    {"Copyright", [](JsonObject &o, const EXIFInfo &i) { o.string("Copyright", i.Copyright); }},
+    {"ExposureTime", [](JsonObject &o, const EXIFInfo &i) { o.number("ExposureTime", i.ExposureTime); }},
+    {"FNumber", [](JsonObject &o, const EXIFInfo &i) { o.number("FNumber", i.FNumber); }},
+    {"ExposureProgram", [](JsonObject &o, const EXIFInfo &i) { o.integer("ExposureProgram", i.ExposureProgram); }},
+    {"ISOSpeedRatings", [](JsonObject &o, const EXIFInfo &i) { o.integer("ISOSpeedRatings", i.ISOSpeedRatings); }},
+    {"ShutterSpeedValue", [](JsonObject &o, const EXIFInfo &i) { o.number("ShutterSpeedValue", i.ShutterSpeedValue); }},
+    {"ApertureValue", [](JsonObject &o, const EXIFInfo &i) { o.number("ApertureValue", i.ApertureValue); }},
+    {"BrightnessValue", [](JsonObject &o, const EXIFInfo &i) { o.number("BrightnessValue", i.BrightnessValue); }},
+    {"ExposureBiasValue", [](JsonObject &o, const EXIFInfo &i) { o.number("ExposureBiasValue", i.ExposureBiasValue); }},
+    {"SubjectDistance", [](JsonObject &o, const EXIFInfo &i) { o.number("SubjectDistance", i.SubjectDistance); }},
+    {"FocalLength", [](JsonObject &o, const EXIFInfo &i) { o.number("FocalLength", i.FocalLength); }},
+    {"Flash", [](JsonObject &o, const EXIFInfo &i) { o.integer("Flash", i.Flash); }},
+    {"MeteringMode", [](JsonObject &o, const EXIFInfo &i) { o.integer("MeteringMode", i.MeteringMode); }},
+    {"LightSource", [](JsonObject &o, const EXIFInfo &i) { o.integer("LightSource", i.LightSource); }},
+    {"ProjectionType", [](JsonObject &o, const EXIFInfo &i) { o.integer("ProjectionType", i.ProjectionType); }},
+    {"SubjectArea", [](JsonObject &o, const EXIFInfo &i) { o.integers("SubjectArea", i.SubjectArea); }},
+    {"LensMake", [](JsonObject &o, const EXIFInfo &i) { o.string("LensMake", i.LensInfo.Make); }},
+    {"LensModel", [](JsonObject &o, const EXIFInfo &i) { o.string("LensModel", i.LensInfo.Model); }},
+    {"FStopMin", [](JsonObject &o, const EXIFInfo &i) { o.number("FStopMin", i.LensInfo.FStopMin); }},
+    {"FStopMax", [](JsonObject &o, const EXIFInfo &i) { o.number("FStopMax", i.LensInfo.FStopMax); }},
+    {"FocalLengthMin", [](JsonObject &o, const EXIFInfo &i) { o.number("FocalLengthMin", i.LensInfo.FocalLengthMin); }},
+    {"FocalLengthMax", [](JsonObject &o, const EXIFInfo &i) { o.number("FocalLengthMax", i.LensInfo.FocalLengthMax); }},
+    {"DigitalZoomRatio", [](JsonObject &o, const EXIFInfo &i) { o.number("DigitalZoomRatio", i.LensInfo.DigitalZoomRatio); }},
+    {"FocalLengthIn35mm", [](JsonObject &o, const EXIFInfo &i) { o.number("FocalLengthIn35mm", i.LensInfo.FocalLengthIn35mm); }},
+    {"Latitude", [](JsonObject &o, const EXIFInfo &i) { o.number("Latitude", i.GeoLocation.Latitude, i.GeoLocation.hasLatLon()); }},
+    {"Longitude", [](JsonObject &o, const EXIFInfo &i) { o.number("Longitude", i.GeoLocation.Longitude, i.GeoLocation.hasLatLon()); }},
+    {"Altitude", [](JsonObject &o, const EXIFInfo &i) { o.number("Altitude", i.GeoLocation.Altitude, i.GeoLocation.hasAltitude()); }},
+    {"RelativeAltitude", [](JsonObject &o, const EXIFInfo &i) { o.number("RelativeAltitude", i.GeoLocation.RelativeAltitude, i.GeoLocation.hasRelativeAltitude()); }},
+    {"RollDegree", [](JsonObject &o, const EXIFInfo &i) { o.number("RollDegree", i.GeoLocation.RollDegree, i.GeoLocation.hasOrientation()); }},
+    {"PitchDegree", [](JsonObject &o, const EXIFInfo &i) { o.number("PitchDegree", i.GeoLocation.PitchDegree, i.GeoLocation.hasOrientation()); }},
+    {"YawDegree", [](JsonObject &o, const EXIFInfo &i) { o.number("YawDegree", i.GeoLocation.YawDegree, i.GeoLocation.hasOrientation()); }},
+    {"GPSMapDatum", [](JsonObject &o, const EXIFInfo &i) { o.string("GPSMapDatum", i.GeoLocation.GPSMapDatum); }},
+    {"GPSDateStamp", [](JsonObject &o, const EXIFInfo &i) { o.string("GPSDateStamp", i.GeoLocation.GPSDateStamp); }},
+    {"GPSTimeStamp", [](JsonObject &o, const EXIFInfo &i) { o.string("GPSTimeStamp", i.GeoLocation.GPSTimeStamp); }}
+};
+
+const int FIELD_COUNT = sizeof(FIELDS) / sizeof(FIELDS[0]);
+
+}
+
+JsonLineWriter::JsonLineWriter() {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        fields.push_back(i);
+    }
+}
+
+bool JsonLineWriter::selectFields(const std::string &names) {
+    std::vector<int> selected;
+    size_t begin = 0;
+    while (begin <= names.size()) {
+        size_t end = names.find(',', begin);
+        if (end == std::string::npos) {
+            end = names.size();
+        }
+        const std::string name = names.substr(begin, end - begin);
+        begin = end + 1;
+        if (name.empty()) {
+            continue;
+        }
+        int index = 0;
+        while (index < FIELD_COUNT && name != FIELDS[index].name) {
+            index++;
+        }
+        if (index == FIELD_COUNT) {
+            return false;
+        }
+        selected.push_back(index);
+    }
+    fields.swap(selected);
+    return true;
+}
+
+void JsonLineWriter::write(const std::string &path, const EXIFInfo &info, int parseCode, std::string &output) const {
+    JsonObject object(output);
+    object.string("SourceFile", path);
+    object.integer("ParseCode", parseCode);
+    for (int index : fields) {
+        FIELDS[index].write(object, info);
+    }
+    object.end();
+}
+
+std::vector<std::string> JsonLineWriter::fieldNames() {
+    std::vector<std::string> names;
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        names.push_back(FIELDS[i].name);
+    }
+    return names;
+}
+
+// C++14没有std::to_chars。15位有效数字总能还原的值，最近的15位十进制去掉末尾的0就是最短表示；
+// 否则依次尝试16和17位，17位一定能还原。大部分EXIF的值在第一次就能还原。
+// 非规格化数的精度不足15位，从1位开始尝试
+void JsonLineWriter::appendNumber(double value, std::string &output) {
+    if (!std::isfinite(value)) {
+        output += "null";
+        return;
+    }
+    if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0) { // 2^53以内的整数
+        appendInteger(output, (int64_t)value);
+        return;
+    }
+    char buffer[32];
+    int len = 0;
+    for (int precision = std::fabs(value) < DBL_MIN ? 1 : 15; precision <= 17; precision++) {
+        len = snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+        if (strtod(buffer, NULL) == value) {
+            break;
+        }
+    }
+    output.append(buffer, len);
+}
+}
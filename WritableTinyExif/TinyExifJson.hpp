@@ -0,0 +1,52 @@
+//
+//  TinyExifJson.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifJson_hpp
+#define TinyExifJson_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "TinyEXIF.h"
+
+// 输出为JSON Lines
+//
+// 每个文件一行JSON对象，第一个字段是SourceFile，与ExifTool的-json输出一致，
+// 之后是选择的字段，按选择的顺序输出。
+// 数值为0、字符串为空的字段不输出，与EXIFInfo用0表示没有该字段的约定一致；GPS相关字段用has*()判断。
+// 浮点数输出为能还原为同一个double的最短十进制表示，字符串中无效的UTF-8替换为U+FFFD。
+// 结果追加到调用方的std::string中，重复使用同一个string时不再分配内存。
+
+namespace TinyEXIF {
+
+class TINYEXIF_LIB JsonLineWriter {
+public:
+    /// 默认输出所有字段
+    JsonLineWriter();
+
+    /// 选择输出的字段
+    /// @param names 逗号分隔的字段名，见fieldNames()
+    /// @return 有未知的字段名时返回false，不修改原来的选择
+    bool selectFields(const std::string &names);
+
+    /// 追加一行JSON，包括末尾的换行
+    /// @param path 图片地址，写入SourceFile
+    /// @param info 解析结果
+    /// @param parseCode 解析的返回值，不是PARSE_SUCCESS时写入ParseCode
+    /// @param output 输出
+    void write(const std::string &path, const EXIFInfo &info, int parseCode, std::string &output) const;
+
+    /// 所有可以选择的字段名
+    static std::vector<std::string> fieldNames();
+
+    /// 追加double的最短还原表示，非有限值写为null
+    static void appendNumber(double value, std::string &output);
+
+private:
+    std::vector<int> fields;    // 选择的字段在字段表中的下标
+};
+}
+
+#endif /* TinyExifJson_hpp */
@@ -0,0 +1,189 @@
+//
+//  TinyExifPipeline.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifPipeline.hpp"
+#include "TinyExifStats.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+namespace TinyEXIF {
+
+namespace {
+
+// 在各个阶段之间传递的一个文件
+struct Job {
+    size_t index;                       // 任务序号
+    std::vector<uint8_t> input;         // 源文件数据
+    EXIFInfo info;                      // 解析结果
+    std::unique_ptr<ExifWriter> writer; // 使用原有EXIF构造的writer
+    std::vector<uint8_t> output;        // 输出数据
+};
+
+typedef std::unique_ptr<Job> JobPtr;
+typedef BoundedQueue<JobPtr> JobQueue;
+
+bool readFile(const std::string &path, std::vector<uint8_t> &data) {
+    TINYEXIF_STAT_TIMER(STAGE_READ);
+    std::ifstream in (path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+        return false;
+    }
+    const std::streamoff size = in.tellg();
+    if (size <= 0) {
+        return false;
+    }
+    data.resize((size_t)size);
+    in.seekg(0);
+    TINYEXIF_STAT_ADD(STAT_BYTES_READ, size);
+    return (bool)in.read((char *)data.data(), size);
+}
+
+// 一个阶段的所有线程，最后一个线程结束时关闭下一个队列
+class Stage {
+public:
+    Stage(unsigned count, JobQueue *next) : running(std::max(1u, count)), next(next) {}
+
+    template <typename Work>
+    void start(Work work) {
+        const unsigned count = running.load();
+        for (unsigned i = 0; i < count; i++) {
+            threads.push_back(std::thread([this, work] {
+                work();
+                if (running.fetch_sub(1) == 1 && next != NULL) {
+                    next->close();
+                }
+            }));
+        }
+    }
+
+    void join() {
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> running;
+    JobQueue *next;
+};
+
+}
+
+std::vector<uint8_t> BufferPool::acquire() {
+    std::vector<uint8_t> buffer;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!buffers.empty()) {
+        buffer.swap(buffers.back());
+        buffers.pop_back();
+    }
+    return buffer;
+}
+
+void BufferPool::release(std::vector<uint8_t> &buffer) {
+    buffer.clear(); // 保留容量
+    std::lock_guard<std::mutex> lock(mutex);
+    if (buffers.size() < maxBuffers && buffer.capacity() > 0) {
+        buffers.push_back(std::vector<uint8_t>());
+        buffers.back().swap(buffer);
+    }
+}
+
+size_t BufferPool::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return buffers.size();
+}
+
+Pipeline::Pipeline(const PipelineConfig &config) : config(config), pool(config.queueCapacity * 4) {
+}
+
+size_t Pipeline::run(const std::vector<PipelineTask> &tasks, EditFunction edit, std::vector<PipelineResult> *results) {
+    std::vector<PipelineResult> localResults;
+    std::vector<PipelineResult> &out = results ? *results : localResults;
+    out.assign(tasks.size(), PipelineResult());
+
+    JobQueue parseQueue(config.queueCapacity);
+    JobQueue editQueue(config.queueCapacity);
+    JobQueue writeQueue(config.queueCapacity);
+    std::atomic<size_t> nextTask(0);
+    std::atomic<size_t> written(0);
+
+    // 读取：按顺序领取任务，读取到缓存池的buffer中
+    Stage reading(config.readThreads, &parseQueue);
+    reading.start([&] {
+        size_t index;
+        while ((index = nextTask.fetch_add(1)) < tasks.size()) {
+            JobPtr job(new Job());
+            job->index = index;
+            job->input = pool.acquire();
+            if (!readFile(tasks[index].inputPath, job->input)) {
+                pool.release(job->input);
+                continue;
+            }
+            parseQueue.push(job);
+        }
+    });
+
+    // 解析：解析元数据，用原有的EXIF构造writer
+    Stage parsing(config.parseThreads, &editQueue);
+    parsing.start([&] {
+        JobPtr job;
+        while (parseQueue.pop(job)) {
+            job->info.setLimits(config.limits);
+            out[job->index].parseCode = job->info.parseFromContainer(job->input.data(), (unsigned)job->input.size());
+            std::vector<uint8_t> exifData;
+            if (ExifWriter::readExifData(job->input.data(), (uint32_t)job->input.size(), exifData)) {
+                job->writer.reset(new ExifWriter(exifData.data(), (uint32_t)exifData.size()));
+            } else {
+                job->writer.reset(new ExifWriter());
+            }
+            editQueue.push(job);
+        }
+    });
+
+    // 修改：调用修改函数，生成输出数据
+    Stage editing(config.editThreads, &writeQueue);
+    editing.start([&] {
+        JobPtr job;
+        while (editQueue.pop(job)) {
+            bool ok = edit(job->info, *job->writer);
+            if (ok) {
+                job->output = pool.acquire();
+                ok = job->writer->writeToBuffer(job->input.data(), (uint32_t)job->input.size(), job->output);
+            }
+            pool.release(job->input);
+            if (!ok) {
+                pool.release(job->output);
+                continue;
+            }
+            job->writer.reset();
+            writeQueue.push(job);
+        }
+    });
+
+    // 写入：写文件，归还buffer
+    Stage writing(config.writeThreads, NULL);
+    writing.start([&] {
+        JobPtr job;
+        while (writeQueue.pop(job)) {
+            TINYEXIF_STAT_TIMER(STAGE_WRITE);
+            TINYEXIF_STAT_ADD(STAT_BYTES_WRITTEN, job->output.size());
+            std::ofstream file (tasks[job->index].outputPath.c_str(), std::ios::out | std::ios::binary);
+            if (file.is_open() && file.write((const char *)job->output.data(), job->output.size())) {
+                out[job->index].written = true;
+                written++;
+            }
+            pool.release(job->output);
+        }
+    });
+
+    reading.join();
+    parsing.join();
+    editing.join();
+    writing.join();
+    return written.load();
+}
+}
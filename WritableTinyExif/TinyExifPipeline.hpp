@@ -0,0 +1,207 @@
+//
+//  TinyExifPipeline.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifPipeline_hpp
+#define TinyExifPipeline_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TinyEXIF.h"
+#include "TinyExifWriter.hpp"
+
+// 批量处理的流水线
+//
+// 读取 → 解析 → 修改 → 写入 四个阶段各自使用独立的线程，阶段之间用有界队列连接：
+// 读取(IO)和解析、修改(CPU)可以同时进行；写入跟不上时队列被填满，前面的阶段等待，
+// 内存中最多只有队列容量个文件。文件数据的buffer通过BufferPool循环使用。
+
+namespace TinyEXIF {
+
+/// 有界的多生产者多消费者队列(Dmitry Vyukov的算法)，不使用锁。
+/// 每个格子有一个序号，生产者和消费者通过CAS竞争位置，序号表示格子当前可以写入还是读取
+template <typename T>
+class BoundedQueue {
+public:
+    /// @param capacity 容量，向上取整到2的幂
+    explicit BoundedQueue(size_t capacity) : enqueuePos(0), dequeuePos(0), closed(false) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// 尝试放入，队列满时返回false，value不变
+    bool tryPush(T &value) {
+        Cell *cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) { // 格子空闲，抢占这个位置
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) { // 格子还没有被取走，队列已满
+                return false;
+            } else { // 被其它生产者抢先
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// 尝试取出，队列空时返回false
+    bool tryPop(T &value) {
+        Cell *cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) { // 队列空
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// 放入，队列满时等待(背压)
+    void push(T &value) {
+        for (unsigned spins = 0; !tryPush(value); spins++) {
+            backoff(spins);
+        }
+    }
+
+    /// 取出，队列空时等待，队列关闭并且取完后返回false
+    bool pop(T &value) {
+        for (unsigned spins = 0; ; spins++) {
+            if (tryPop(value)) {
+                return true;
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                return tryPop(value); // 关闭之前放入的最后一个
+            }
+            backoff(spins);
+        }
+    }
+
+    /// 关闭队列，所有生产者结束后调用
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+private:
+    BoundedQueue(const BoundedQueue &);
+    BoundedQueue& operator = (const BoundedQueue &);
+
+    // 先让出CPU，等待较久时休眠，避免空转
+    static void backoff(unsigned spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    // 生产者和消费者的位置放在不同的缓存行
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+    std::atomic<bool> closed;
+};
+
+/// 文件数据buffer的缓存池，归还的buffer保留容量，下一个文件直接使用
+class TINYEXIF_LIB BufferPool {
+public:
+    /// @param maxBuffers 最多缓存的buffer数
+    explicit BufferPool(size_t maxBuffers = 64) : maxBuffers(maxBuffers) {}
+
+    /// 取一个空的buffer
+    std::vector<uint8_t> acquire();
+    /// 归还buffer
+    void release(std::vector<uint8_t> &buffer);
+    /// 缓存的buffer数
+    size_t size();
+
+private:
+    std::vector<std::vector<uint8_t>> buffers;
+    std::mutex mutex;   // 每个文件只取还一次，锁的开销可以忽略
+    const size_t maxBuffers;
+};
+
+/// 流水线的配置
+struct TINYEXIF_LIB PipelineConfig {
+    unsigned readThreads = 2;       // 读取文件的线程数，网络存储上可以适当增加
+    unsigned parseThreads = 1;      // 解析EXIF的线程数
+    unsigned editThreads = 1;       // 修改并生成输出的线程数
+    unsigned writeThreads = 2;      // 写入文件的线程数
+    size_t queueCapacity = 32;      // 每个队列的容量
+    ParseLimits limits;             // 解析时每个文件的预算，超出时parseCode为PARSE_LIMIT_EXCEEDED
+};
+
+/// 流水线的任务
+struct TINYEXIF_LIB PipelineTask {
+    std::string inputPath;          // 读取的图片地址
+    std::string outputPath;         // 输出的图片地址
+};
+
+/// 每个任务的结果
+struct TINYEXIF_LIB PipelineResult {
+    int parseCode = PARSE_INVALID_JPEG; // EXIFInfo::parseFromContainer的返回值
+    bool written = false;               // 是否成功写入
+};
+
+class TINYEXIF_LIB Pipeline {
+public:
+    /// 修改函数，参数为解析结果和使用图片原有EXIF构造的writer，返回false时不写入这个文件。
+    /// 在修改阶段的线程中调用，多个线程时需要线程安全
+    typedef std::function<bool(const EXIFInfo &info, ExifWriter &writer)> EditFunction;
+
+    explicit Pipeline(const PipelineConfig &config = PipelineConfig());
+
+    /// 处理所有的任务，全部完成后返回
+    /// @param tasks 任务
+    /// @param edit 修改函数
+    /// @param results 每个任务的结果，可以传NULL
+    /// @return 成功写入的数量
+    size_t run(const std::vector<PipelineTask> &tasks, EditFunction edit, std::vector<PipelineResult> *results = NULL);
+
+    /// buffer缓存池
+    BufferPool& bufferPool() { return pool; }
+
+private:
+    PipelineConfig config;
+    BufferPool pool;
+};
+}
+#endif /* TinyExifPipeline_hpp */
@@ -0,0 +1,194 @@
+//
+//  TinyExifStats.cpp
+//  WritableTinyExif
+//
+
+#include "TinyExifStats.hpp"
+
+#include <atomic>
+#include <cstring>
+
+namespace TinyEXIF {
+
+namespace {
+
+// 计数块中的位置：计数项，之后是每个阶段的耗时和次数
+const int SLOT_COUNT = STAT_COUNTER_COUNT + STAGE_COUNT * 2;
+
+inline int nanosSlot(StatStage stage) { return STAT_COUNTER_COUNT + stage; }
+inline int callsSlot(StatStage stage) { return STAT_COUNTER_COUNT + STAGE_COUNT + stage; }
+
+// 一个线程的计数，只有所属线程写入，其它线程只读
+struct CounterBlock {
+    std::atomic<uint64_t> values[SLOT_COUNT];
+    std::atomic<bool> inUse;
+    CounterBlock *next;     // 加入链表后不再修改
+};
+
+// 所有计数块的链表，只增加不删除，线程退出后计数块留给新的线程使用
+std::atomic<CounterBlock *> blocks(NULL);
+// 已经退出的线程的合计
+std::atomic<uint64_t> retired[SLOT_COUNT];
+
+CounterBlock* claimBlock() {
+    for (CounterBlock *block = blocks.load(std::memory_order_acquire); block != NULL; block = block->next) {
+        bool expected = false;
+        if (!block->inUse.load(std::memory_order_relaxed) &&
+            block->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return block;
+        }
+    }
+    CounterBlock *block = new CounterBlock();
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        block->values[i].store(0, std::memory_order_relaxed);
+    }
+    block->inUse.store(true, std::memory_order_relaxed);
+    block->next = blocks.load(std::memory_order_relaxed);
+    while (!blocks.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return block;
+}
+
+// 线程第一次计数时领取计数块，退出时把计数并入合计并归还
+class ThreadCounters {
+public:
+    ThreadCounters() : block(claimBlock()) {}
+    ~ThreadCounters() {
+        for (int i = 0; i < SLOT_COUNT; i++) {
+            retired[i].fetch_add(block->values[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        block->inUse.store(false, std::memory_order_release);
+    }
+    // 只有当前线程写入，普通的读写即可，不需要lock前缀的指令
+    void add(int slot, uint64_t value) {
+        std::atomic<uint64_t> &target = block->values[slot];
+        target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+private:
+    CounterBlock *block;
+};
+
+ThreadCounters& threadCounters() {
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+struct MetricInfo {
+    const char *name;
+    const char *help;
+};
+
+const MetricInfo COUNTER_METRICS[STAT_COUNTER_COUNT] = {
+    {"expand_buffer_calls_total", "Calls to ExifWriter::expandBuffer."},
+    {"moved_bytes_total", "Bytes copied by ExifWriter::expandBuffer."},
+    {"offset_fixups_total", "IFDs whose offsets ExifWriter::increaseTagOffsetData fixed up."},
+    {"tag_probes_total", "IFD entries compared by ExifWriter::findAttributeEntry."},
+    {"xml_node_allocations_total", "Items allocated from the tinyxml2 memory pools."},
+    {"xml_block_allocations_total", "Blocks the tinyxml2 memory pools allocated from the heap."},
+    {"read_bytes_total", "Bytes read from image files."},
+    {"written_bytes_total", "Bytes written to image files."}
+};
+
+const char *STAGE_NAMES[STAGE_COUNT] = {"open", "read", "parse", "edit", "write"};
+
+void appendHeader(std::string &output, const std::string &name, const char *help) {
+    output += "# HELP " + name + " " + help + "\n";
+    output += "# TYPE " + name + " counter\n";
+}
+
+}
+
+StatsSnapshot::StatsSnapshot() {
+    memset(counters, 0, sizeof(counters));
+    memset(stageNanos, 0, sizeof(stageNanos));
+    memset(stageCalls, 0, sizeof(stageCalls));
+}
+
+namespace Stats {
+
+void add(StatCounter counter, uint64_t value) {
+    threadCounters().add(counter, value);
+}
+
+void addTiming(StatStage stage, uint64_t nanos) {
+    ThreadCounters &counters = threadCounters();
+    counters.add(nanosSlot(stage), nanos);
+    counters.add(callsSlot(stage), 1);
+}
+
+void countXMLAllocation(bool newBlock) {
+    ThreadCounters &counters = threadCounters();
+    counters.add(STAT_XML_NODE_ALLOCS, 1);
+    if (newBlock) {
+        counters.add(STAT_XML_BLOCK_ALLOCS, 1);
+    }
+}
+
+StatsSnapshot snapshot() {
+    uint64_t values[SLOT_COUNT];
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        values[i] = retired[i].load(std::memory_order_relaxed);
+    }
+    for (CounterBlock *block = blocks.load(std::memory_order_acquire); block != NULL; block = block->next) {
+        for (int i = 0; i < SLOT_COUNT; i++) {
+            values[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    StatsSnapshot result;
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        result.counters[i] = values[i];
+    }
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        result.stageNanos[i] = values[nanosSlot((StatStage)i)];
+        result.stageCalls[i] = values[callsSlot((StatStage)i)];
+    }
+    return result;
+}
+
+void reset() {
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        retired[i].store(0, std::memory_order_relaxed);
+    }
+    for (CounterBlock *block = blocks.load(std::memory_order_acquire); block != NULL; block = block->next) {
+        for (int i = 0; i < SLOT_COUNT; i++) {
+            block->values[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool enabled() {
+#ifdef TINYEXIF_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string toPrometheus(const StatsSnapshot &snapshot, const std::string &prefix) {
+    std::string output;
+    char value[64];
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        const std::string name = prefix + "_" + COUNTER_METRICS[i].name;
+        appendHeader(output, name, COUNTER_METRICS[i].help);
+        snprintf(value, sizeof(value), " %llu\n", (unsigned long long)snapshot.counters[i]);
+        output += name + value;
+    }
+
+    const std::string seconds = prefix + "_stage_seconds_total";
+    appendHeader(output, seconds, "Monotonic time spent in each stage.");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        snprintf(value, sizeof(value), "{stage=\"%s\"} %.9f\n", STAGE_NAMES[i], snapshot.stageNanos[i] / 1e9);
+        output += seconds + value;
+    }
+    const std::string calls = prefix + "_stage_calls_total";
+    appendHeader(output, calls, "Number of times each stage ran.");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        snprintf(value, sizeof(value), "{stage=\"%s\"} %llu\n", STAGE_NAMES[i], (unsigned long long)snapshot.stageCalls[i]);
+        output += calls + value;
+    }
+    return output;
+}
+}
+}
@@ -0,0 +1,112 @@
+//
+//  TinyExifStats.hpp
+//  WritableTinyExif
+//
+
+#ifndef TinyExifStats_hpp
+#define TinyExifStats_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include "TinyEXIF.h"
+
+// 运行统计
+//
+// 编译时定义TINYEXIF_STATS后，写入和解析的热点路径记录拷贝、移动、偏移修正等次数和各阶段的耗时；
+// 没有定义时TINYEXIF_STAT_ADD和TINYEXIF_STAT_TIMER展开为空，不产生任何开销。
+// 计数保存在每个线程自己的计数块中，只有所属线程写入，不需要原子的读改写；
+// 汇总时遍历所有计数块，线程退出时计数并入全局的合计，整个过程不加锁。
+
+namespace TinyEXIF {
+
+/// 计数项
+enum StatCounter {
+    STAT_EXPAND_BUFFER = 0,     // ExifWriter::expandBuffer的调用次数
+    STAT_BYTES_MOVED,           // expandBuffer拷贝的字节数
+    STAT_OFFSET_FIXUPS,         // increaseTagOffsetData修正过offset的IFD数
+    STAT_TAG_PROBES,            // findAttributeEntry比较过的entry数
+    STAT_XML_NODE_ALLOCS,       // tinyxml2内存池分配的节点数
+    STAT_XML_BLOCK_ALLOCS,      // tinyxml2内存池向系统申请的块数
+    STAT_BYTES_READ,            // 从文件读取的字节数
+    STAT_BYTES_WRITTEN,         // 写入文件的字节数
+    STAT_COUNTER_COUNT
+};
+
+/// 计时的阶段
+enum StatStage {
+    STAGE_OPEN = 0,             // 打开文件
+    STAGE_READ,                 // 读取文件数据或EXIF段
+    STAGE_PARSE,                // 解析元数据
+    STAGE_EDIT,                 // 修改EXIF
+    STAGE_WRITE,                // 生成并写出输出
+    STAGE_COUNT
+};
+
+/// 某个时刻所有线程的合计
+struct TINYEXIF_LIB StatsSnapshot {
+    uint64_t counters[STAT_COUNTER_COUNT];  // 按StatCounter索引
+    uint64_t stageNanos[STAGE_COUNT];       // 每个阶段的总耗时，纳秒
+    uint64_t stageCalls[STAGE_COUNT];       // 每个阶段的次数
+
+    StatsSnapshot();
+};
+
+namespace Stats {
+
+/// 增加当前线程的计数
+/// @param counter 计数项
+/// @param value 增加的值
+void TINYEXIF_LIB add(StatCounter counter, uint64_t value);
+
+/// 记录当前线程一个阶段的耗时
+/// @param stage 阶段
+/// @param nanos 耗时，纳秒
+void TINYEXIF_LIB addTiming(StatStage stage, uint64_t nanos);
+
+/// tinyxml2内存池每次分配时调用
+/// @param newBlock 是否申请了新的块
+void TINYEXIF_LIB countXMLAllocation(bool newBlock);
+
+/// 所有线程的合计，其它线程可能同时在计数，结果是近似的瞬时值
+StatsSnapshot TINYEXIF_LIB snapshot();
+
+/// 清零所有计数，只在没有其它线程计数时调用
+void TINYEXIF_LIB reset();
+
+/// 是否编译了统计，没有编译时snapshot总是0
+bool TINYEXIF_LIB enabled();
+
+/// 输出为Prometheus的文本格式
+/// @param snapshot 统计结果
+/// @param prefix 指标名的前缀
+std::string TINYEXIF_LIB toPrometheus(const StatsSnapshot &snapshot, const std::string &prefix = "tinyexif");
+
+/// 作用域计时，使用单调时钟，析构时记录耗时
+class TINYEXIF_LIB ScopedTimer {
+public:
+    explicit ScopedTimer(StatStage _stage) : stage(_stage), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        addTiming(stage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer& operator = (const ScopedTimer &);
+
+    StatStage stage;
+    std::chrono::steady_clock::time_point start;
+};
+}
+}
+
+#ifdef TINYEXIF_STATS
+#define TINYEXIF_STAT_ADD(counter, value) ::TinyEXIF::Stats::add(::TinyEXIF::counter, (value))
+#define TINYEXIF_STAT_TIMER(stage) ::TinyEXIF::Stats::ScopedTimer stageTimer(::TinyEXIF::stage)
+#else
+#define TINYEXIF_STAT_ADD(counter, value) ((void)0)
+#define TINYEXIF_STAT_TIMER(stage) ((void)0)
+#endif
+
+#endif /* TinyExifStats_hpp */
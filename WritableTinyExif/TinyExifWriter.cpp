@@ -8,17 +8,411 @@
 #include "TinyExifWriter.hpp"
 #include "JpegMarks.h"
 #include "Utils.h"
+#include "TinyExifStats.hpp"
+#include "tinyxml2.h"
 
 #include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <iterator>
 
 namespace TinyEXIF {
 
+namespace {
+
+// 基于输入流的EXIFStream，用于读取源文件中的SOF
+class EXIFStreamIStream : public EXIFStream {
+public:
+    explicit EXIFStreamIStream(std::istream &_in) : in(_in) {}
+    bool IsValid() const override {
+        return in.good();
+    }
+    const uint8_t* GetBuffer(unsigned desiredLength) override {
+        buffer.resize(desiredLength);
+        if (!in.read((char*)buffer.data(), desiredLength))
+            return NULL;
+        return buffer.data();
+    }
+    bool SkipBuffer(unsigned desiredLength) override {
+        return (bool)in.seekg(desiredLength, std::ios::cur);
+    }
+private:
+    std::istream &in;
+    std::vector<uint8_t> buffer;
+};
+
+// IFD的位置，strip时使用
+struct IFDLocation {
+    uint32_t offset;        // IFD起始index
+    uint16_t entries;       // entry数量
+    uint16_t pointerTag;    // 指向这个IFD的tag，IFD0和IFD1为0
+    int parent;             // 上级IFD的序号，IFD0为-1
+    bool removed;           // 是否整体删除
+    uint16_t removedEntries;// 删除的entry数量
+};
+
+// 要删除的数据范围
+struct ByteRange {
+    uint32_t start;
+    uint32_t length;
+    bool operator < (const ByteRange &other) const { return start < other.start; }
+};
+
+}
+
+// 源数据读取接口，文件和内存使用同一个写入流程
+class SegmentSource {
+public:
+    virtual ~SegmentSource() {}
+    
+    /// 读取指定长度的数据，返回的指针在下一次读取前有效
+    virtual const uint8_t* fetch(uint32_t len) = 0;
+    
+    /// 把剩余的数据全部输出
+    virtual bool copyRest(SegmentSink &out) = 0;
+};
+
+// 输出接口
+class SegmentSink {
+public:
+    virtual ~SegmentSink() {}
+    virtual bool write(const uint8_t *data, uint32_t len) = 0;
+};
+
+namespace {
+
+class FileSource : public SegmentSource {
+public:
+    explicit FileSource(std::istream &_in) : in(_in) {}
+    const uint8_t* fetch(uint32_t len) override {
+        buffer.resize(std::max<uint32_t>(len, 1));
+        if (!in.read((char *)buffer.data(), len)) {
+            return NULL;
+        }
+        TINYEXIF_STAT_ADD(STAT_BYTES_READ, len);
+        return buffer.data();
+    }
+    bool copyRest(SegmentSink &out) override {
+        buffer.resize(64 * 1024);
+        while (in) {
+            in.read((char *)buffer.data(), buffer.size());
+            TINYEXIF_STAT_ADD(STAT_BYTES_READ, in.gcount());
+            if (in.gcount() > 0 && !out.write(buffer.data(), (uint32_t)in.gcount())) {
+                return false;
+            }
+        }
+        return in.eof();
+    }
+private:
+    std::istream &in;
+    std::vector<uint8_t> buffer;
+};
+
+// 内存数据直接返回指针，不拷贝
+class BufferSource : public SegmentSource {
+public:
+    BufferSource(const uint8_t *_data, uint32_t _len) : data(_data), len(_len), pos(0) {}
+    const uint8_t* fetch(uint32_t size) override {
+        if (size > len - pos) {
+            return NULL;
+        }
+        const uint8_t *result = data + pos;
+        pos += size;
+        return result;
+    }
+    bool copyRest(SegmentSink &out) override {
+        const uint32_t size = len - pos;
+        pos = len;
+        return size == 0 || out.write(data + len - size, size);
+    }
+private:
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t pos;
+};
+
+class FileSink : public SegmentSink {
+public:
+    explicit FileSink(std::ostream &_out) : out(_out) {}
+    bool write(const uint8_t *data, uint32_t len) override {
+        TINYEXIF_STAT_ADD(STAT_BYTES_WRITTEN, len);
+        return (bool)out.write((const char *)data, len);
+    }
+private:
+    std::ostream &out;
+};
+
+const uint32_t PHOTOSHOP_HEADER_LENGTH = 14; // "Photoshop 3.0\0"
+
+// 保存Photoshop资源(IPTC)的APP13段
+bool isPhotoshopSegment(uint8_t marker, const uint8_t *payload, uint32_t len) {
+    return marker == JM_APP13 && len >= PHOTOSHOP_HEADER_LENGTH && memcmp(payload, "Photoshop 3.0\0", PHOTOSHOP_HEADER_LENGTH) == 0;
+}
+
+// jpeg中SOS之前的一个段
+struct JpegSegment {
+    uint8_t marker;
+    bool hasLength;     // RSTn等标记没有长度和数据
+    uint32_t offset;    // 数据在读取的数据中的位置，不包括标记和长度
+    uint32_t length;    // 数据长度
+};
+
+// 读取SOI之后到SOS(或EOI)为止的所有段，最后一个是SOS或EOI，源数据停在它的标记之后
+bool readSegments(SegmentSource &in, std::vector<uint8_t> &payloads, std::vector<JpegSegment> &segments) {
+    const uint8_t *data = in.fetch(2);
+    if (data == NULL || data[0] != JM_START || data[1] != JM_SOI) {
+        return false;
+    }
+    while (true) {
+        if ((data = in.fetch(2)) == NULL || data[0] != JM_START) {
+            return false;
+        }
+        uint8_t marker = data[1];
+        while (marker == JM_START) { // 标记前可能有填充的0xFF
+            if ((data = in.fetch(1)) == NULL) {
+                return false;
+            }
+            marker = data[0];
+        }
+        JpegSegment segment = {marker, false, (uint32_t)payloads.size(), 0};
+        if (marker == JM_SOS || marker == JM_EOI) {
+            segments.push_back(segment);
+            return true;
+        }
+        if (!((marker >= JM_RST0 && marker <= JM_RST7) || marker == 0x01)) {
+            if ((data = in.fetch(2)) == NULL) {
+                return false;
+            }
+            const uint16_t sectionLength = Utils::parse16(data, false);
+            if (sectionLength < 2 || (data = in.fetch(sectionLength - 2)) == NULL) {
+                return false;
+            }
+            segment.hasLength = true;
+            segment.length = sectionLength - 2;
+            payloads.insert(payloads.end(), data, data + segment.length);
+        }
+        segments.push_back(segment);
+    }
+}
+
+// 添加一个PNG chunk：长度 + 类型 + 数据 + 类型和数据的CRC，数据可以分为两部分
+void appendPNGChunk(std::vector<uint8_t> &output, const char *type, const uint8_t *data, uint32_t len,
+                    const uint8_t *extra = NULL, uint32_t extraLen = 0) {
+    uint8_t bytes[4];
+    Utils::convertInt32ToByteArray(len + extraLen, bytes, false);
+    output.insert(output.end(), bytes, bytes + 4);
+    output.insert(output.end(), type, type + 4);
+    output.insert(output.end(), data, data + len);
+    output.insert(output.end(), extra, extra + extraLen);
+    uint32_t crc = Utils::crc32((const uint8_t *)type, 4);
+    crc = Utils::crc32(data, len, crc);
+    crc = Utils::crc32(extra, extraLen, crc);
+    Utils::convertInt32ToByteArray(crc, bytes, false);
+    output.insert(output.end(), bytes, bytes + 4);
+}
+
+// 添加一个WebP chunk：FourCC + 长度(小端) + 数据，长度为奇数时补一个0
+void appendWebPChunk(std::vector<uint8_t> &output, const char *fourcc, const uint8_t *data, uint32_t len) {
+    uint8_t bytes[4];
+    Utils::convertInt32ToByteArray(len, bytes, true);
+    output.insert(output.end(), fourcc, fourcc + 4);
+    output.insert(output.end(), bytes, bytes + 4);
+    output.insert(output.end(), data, data + len);
+    if (len & 1) {
+        output.push_back(0);
+    }
+}
+
+// PNG中保存XMP的iTXt chunk的开头：关键字、不压缩、空的语言和翻译关键字
+const char PNG_XMP_HEADER[] = "XML:com.adobe.xmp\0\0\0\0"; // 加上结尾的'\0'共22个字节
+
+// VP8X中的标记
+const uint8_t VP8X_FLAG_ALPHA = 0x10;
+const uint8_t VP8X_FLAG_EXIF = 0x08;
+const uint8_t VP8X_FLAG_XMP = 0x04;
+
+// 追加一个字符的UTF-8编码
+void appendUTF8(std::string &text, uint32_t c) {
+    if (c < 0x80) {
+        text.push_back((char)c);
+    } else if (c < 0x800) {
+        text.push_back((char)(0xC0 | (c >> 6)));
+        text.push_back((char)(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+        text.push_back((char)(0xE0 | (c >> 12)));
+        text.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+        text.push_back((char)(0x80 | (c & 0x3F)));
+    } else {
+        text.push_back((char)(0xF0 | (c >> 18)));
+        text.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+        text.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+        text.push_back((char)(0x80 | (c & 0x3F)));
+    }
+}
+
+// 是否是可以写入XML的UTF-8文本：编码正确，没有\t、\n、\r以外的控制字符
+bool isXMLText(const std::string &text) {
+    const uint8_t *p = (const uint8_t *)text.data();
+    const size_t len = text.size();
+    for (size_t i = 0; i < len; ) {
+        const uint8_t c = p[i];
+        if (c < 0x80) {
+            if (c < 0x20 && c != '\t' && c != '\n' && c != '\r') {
+                return false;
+            }
+            i++;
+            continue;
+        }
+        const size_t extra = c >= 0xF0 && c < 0xF5 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 ? 1 : 0;
+        if (extra == 0 || (c >= 0xE0 && c < 0xF0 && extra != 2) || extra > len - i - 1) {
+            return false;
+        }
+        for (size_t k = 1; k <= extra; k++) {
+            if ((p[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        i += extra + 1;
+    }
+    return true;
+}
+
+// 解码UserComment：8字节的字符编码 + 文本。只支持ASCII、Unicode(UTF-16，没有BOM时字节序与TIFF相同)
+// 和未指定编码(按UTF-8)，去掉结尾的'\0'和空格
+bool decodeUserComment(const uint8_t *value, uint32_t size, bool alignIntel, std::string &text) {
+    if (size < 8) {
+        return false;
+    }
+    const uint8_t *p = value + 8;
+    const uint32_t n = size - 8;
+    text.clear();
+    if (memcmp(value, "ASCII\0\0\0", 8) == 0 || memcmp(value, "\0\0\0\0\0\0\0\0", 8) == 0) {
+        text.assign((const char *)p, n);
+    } else if (memcmp(value, "UNICODE\0", 8) == 0) {
+        bool little = alignIntel;
+        uint32_t i = 0;
+        if (n >= 2 && ((p[0] == 0xFF && p[1] == 0xFE) || (p[0] == 0xFE && p[1] == 0xFF))) {
+            little = p[0] == 0xFF;
+            i = 2;
+        }
+        for (; i + 1 < n; i += 2) {
+            uint32_t c = little ? (p[i] | (p[i + 1] << 8)) : ((p[i] << 8) | p[i + 1]);
+            if (c >= 0xD800 && c < 0xE000) { // 代理对
+                if (c >= 0xDC00 || i + 3 >= n) {
+                    return false;
+                }
+                const uint32_t low = little ? (p[i + 2] | (p[i + 3] << 8)) : ((p[i + 2] << 8) | p[i + 3]);
+                if (low < 0xDC00 || low >= 0xE000) {
+                    return false;
+                }
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                i += 2;
+            }
+            appendUTF8(text, c);
+        }
+    } else {
+        return false;
+    }
+    while (!text.empty() && (text.back() == '\0' || text.back() == ' ')) {
+        text.pop_back();
+    }
+    return isXMLText(text);
+}
+
+// 在XMP中添加一个带exif:UserComment(Lang Alt)的rdf:Description，packet为空时生成一个新的packet
+bool addXMPUserComment(std::string &packet, const std::string &comment) {
+    if (packet.empty()) {
+        packet = "<?xpacket begin=\"\xEF\xBB\xBF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>"
+            "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">"
+            "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\"/>"
+            "</x:xmpmeta><?xpacket end=\"w\"?>";
+    }
+    // 与parseFromXMPSegmentXML相同，tinyxml2不接受根元素之后的xpacket end，解析时去掉，输出时加回
+    std::string trailer;
+    const size_t end = packet.rfind("<?xpacket end=");
+    if (end != std::string::npos) {
+        trailer = packet.substr(end);
+    }
+    tinyxml2::XMLDocument doc;
+    if (doc.Parse(packet.data(), std::min(end, packet.size())) != tinyxml2::XML_SUCCESS) {
+        return false;
+    }
+    tinyxml2::XMLElement *rdf = doc.FirstChildElement("x:xmpmeta");
+    if (rdf == NULL) {
+        rdf = doc.FirstChildElement("xmp:xmpmeta");
+    }
+    rdf = rdf != NULL ? rdf->FirstChildElement("rdf:RDF") : doc.FirstChildElement("rdf:RDF");
+    if (rdf == NULL) {
+        return false;
+    }
+    tinyxml2::XMLElement *description = rdf->InsertNewChildElement("rdf:Description");
+    description->SetAttribute("rdf:about", "");
+    description->SetAttribute("xmlns:exif", "http://ns.adobe.com/exif/1.0/");
+    tinyxml2::XMLElement *item = description->InsertNewChildElement("exif:UserComment")->InsertNewChildElement("rdf:Alt")->InsertNewChildElement("rdf:li");
+    item->SetAttribute("xml:lang", "x-default");
+    item->SetText(comment.c_str());
+    
+    tinyxml2::XMLPrinter printer(NULL, true);
+    doc.Print(&printer);
+    packet.assign(printer.CStr(), printer.CStrSize() - 1);
+    packet += trailer;
+    return true;
+}
+
+// 值的种类，修改属性时value按传入的类型解释，文件中entry的类型必须是同一种
+enum ValueKind {
+    VALUE_OTHER,
+    VALUE_INTEGER,
+    VALUE_STRING,
+    VALUE_REAL
+};
+
+ValueKind valueKind(uint16_t dataType) {
+    switch (dataType) {
+        case TYPE_UINT8:
+        case TYPE_INT8:
+        case TYPE_UINT16:
+        case TYPE_INT16:
+        case TYPE_UINT32:
+        case TYPE_INT32:
+            return VALUE_INTEGER;
+        case TYPE_STRING:
+            return VALUE_STRING;
+        case TYPE_URATIONAL:
+        case TYPE_RATIONAL:
+        case TYPE_FLOAT:
+        case TYPE_DOUBLE:
+            return VALUE_REAL;
+        default:
+            return VALUE_OTHER;
+    }
+}
+
+class BufferSink : public SegmentSink {
+public:
+    explicit BufferSink(std::vector<uint8_t> &_out) : out(_out) {}
+    bool write(const uint8_t *data, uint32_t len) override {
+        out.insert(out.end(), data, data + len);
+        return true;
+    }
+private:
+    std::vector<uint8_t> &out;
+};
+
+}
+
 // Constructors
 ExifWriter::ExifWriter() {
     initOriginExifData();
 }
 
 ExifWriter::ExifWriter(const uint8_t* originData, uint32_t len) {
+    if (originData == NULL || len == 0) {
+        initOriginExifData(); // readExifData没有读到EXIF，与默认构造相同
+        return;
+    }
     bufferLen = len;
     buffer = new uint8_t[bufferLen];
     memcpy(buffer, originData, bufferLen * sizeof(uint8_t)); //内存拷贝
@@ -26,6 +420,43 @@ ExifWriter::ExifWriter(const uint8_t* originData, uint32_t len) {
     alignIntel = len >= 12 && originData[10] == 'I' && originData[11] == 'I';
 }
 
+ExifWriter::ExifWriter(const ExifWriter &other) {
+    bufferLen = other.bufferLen;
+    buffer = new uint8_t[bufferLen];
+    memcpy(buffer, other.buffer, bufferLen * sizeof(uint8_t)); //内存拷贝
+    
+    alignIntel = other.alignIntel;
+    syncPixelDimensions = other.syncPixelDimensions;
+    stripPolicy = other.stripPolicy;
+    xmpSegments = other.xmpSegments;
+    xmpPacket = other.xmpPacket;
+    xmpRelocated = other.xmpRelocated;
+    dropThumbnailOnOverflow = other.dropThumbnailOnOverflow;
+    iptcData = other.iptcData;
+    hasIPTC = other.hasIPTC;
+}
+
+ExifWriter& ExifWriter::operator = (const ExifWriter &other) {
+    if (this != &other) {
+        uint8_t *temp = new uint8_t[other.bufferLen];
+        memcpy(temp, other.buffer, other.bufferLen * sizeof(uint8_t)); //内存拷贝
+        delete [] buffer;
+        buffer = temp;
+        bufferLen = other.bufferLen;
+        
+        alignIntel = other.alignIntel;
+        syncPixelDimensions = other.syncPixelDimensions;
+        stripPolicy = other.stripPolicy;
+        xmpSegments = other.xmpSegments;
+        xmpPacket = other.xmpPacket;
+        xmpRelocated = other.xmpRelocated;
+        dropThumbnailOnOverflow = other.dropThumbnailOnOverflow;
+        iptcData = other.iptcData;
+        hasIPTC = other.hasIPTC;
+    }
+    return *this;
+}
+
 ExifWriter::~ExifWriter() {
     delete [] buffer;
 }
@@ -82,128 +513,902 @@ void ExifWriter::initOriginExifData() {
 
     // 增加exif info信息
 bool ExifWriter::addExifInfo(EXIFInfo *info) {
+    TINYEXIF_STAT_TIMER(STAGE_EDIT);
+    bool result = true;
     if (info->ImageWidth) { //宽
-        editAttribute(IMAGE_WIDTH, &(info->ImageWidth), TYPE_UINT32);
+        result &= editAttribute(IMAGE_WIDTH, &(info->ImageWidth), TYPE_UINT32) != EDIT_SEGMENT_OVERFLOW;
     }
     if (info->ImageHeight) { //高
-        editAttribute(IMAGE_HEIGHT, &(info->ImageHeight), TYPE_UINT32);
+        result &= editAttribute(IMAGE_HEIGHT, &(info->ImageHeight), TYPE_UINT32) != EDIT_SEGMENT_OVERFLOW;
     }
     if (!info->Software.empty()) { // software
-        editAttribute(IMAGE_SOFTWARE, &(info->Software), TYPE_STRING);
+        result &= editAttribute(IMAGE_SOFTWARE, &(info->Software), TYPE_STRING) != EDIT_SEGMENT_OVERFLOW;
     }
     if (!info->DateTimeOriginal.empty()) {
-        editAttribute(DATETIME_ORIGINAL, &(info->DateTimeOriginal), TYPE_STRING);
+        result &= editAttribute(DATETIME_ORIGINAL, &(info->DateTimeOriginal), TYPE_STRING) != EDIT_SEGMENT_OVERFLOW;
     }
     if (info->ExposureProgram) {
-        editAttribute(EXPOSURE_PROGRAM, &(info->ExposureProgram), TYPE_UINT16);
+        result &= editAttribute(EXPOSURE_PROGRAM, &(info->ExposureProgram), TYPE_UINT16) != EDIT_SEGMENT_OVERFLOW;
     }
     if (!info->GeoLocation.GPSDateStamp.empty()) {
-        editAttribute(GEO_DATE_STAMP, &(info->GeoLocation.GPSDateStamp), TYPE_STRING);
+        result &= editAttribute(GEO_DATE_STAMP, &(info->GeoLocation.GPSDateStamp), TYPE_STRING) != EDIT_SEGMENT_OVERFLOW;
     }
     if (info->FNumber) {
-        editAttribute(IFD_FNUMBER, &(info->FNumber), TYPE_URATIONAL);
+        result &= editAttribute(IFD_FNUMBER, &(info->FNumber), TYPE_URATIONAL) != EDIT_SEGMENT_OVERFLOW;
     }
     if (info->ApertureValue) {
         double value = info->ApertureValue;
         value = log(value) / 0.5 / log(2);
-        editAttribute(IFD_APERTUREVALUE, &value, TYPE_URATIONAL);
+        result &= editAttribute(IFD_APERTUREVALUE, &value, TYPE_URATIONAL) != EDIT_SEGMENT_OVERFLOW;
     }
     
-    return true;
+    return result;
 }
 
     // 写入文件
     // 返回写入后的文件
 bool ExifWriter::writeToFile (const char *path, const char *outputPath) {
     // 源文件读取流
-    std::ifstream in (path, std::ios::in | std::ios::binary);
+    std::ifstream in;
+    {
+        TINYEXIF_STAT_TIMER(STAGE_OPEN);
+        in.open(path, std::ios::in | std::ios::binary);
+    }
     if (!in.is_open()) {
+        writeResult = EDIT_CORRUPT_DATA;
         return false;
     }
     
-    uint8_t tempBuf[512];
-    
-    //获取文件长度
-    in.seekg(0, std::ios_base::end);
-    uint64_t fileSize = in.tellg();
-    uint64_t start = 0;
-    in.seekg(start);
+    // 按照SOF中的真实尺寸修改PixelXDimension和PixelYDimension
+    if (syncPixelDimensions) {
+        EXIFStreamIStream stream(in);
+        LayoutInfo layout;
+        const bool probed = layout.probeFrom(stream, PROBE_FRAME_SIZE) == PARSE_SUCCESS;
+        in.clear();
+        in.seekg(0);
+        if (probed) {
+            ExifWriter sized(frameSized(layout.FrameWidth, layout.FrameHeight));
+            const bool result = sized.writeStream(in, outputPath);
+            writeResult = sized.writeResult;
+            return result;
+        }
+    }
+    return writeStream(in, outputPath);
+}
+
+bool ExifWriter::writeStream(std::ifstream &in, const char *outputPath) {
+    // PNG和WebP的元数据位置和文件长度需要整个文件的结构，读入内存后写入
+    uint8_t magic[12];
+    in.read((char *)magic, sizeof(magic));
+    const ContainerFormat format = SniffContainer(magic, (unsigned)in.gcount());
+    in.clear();
+    in.seekg(0);
+    if (format == CONTAINER_PNG || format == CONTAINER_WEBP) {
+        std::vector<uint8_t> data;
+        {
+            TINYEXIF_STAT_TIMER(STAGE_READ);
+            data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            TINYEXIF_STAT_ADD(STAT_BYTES_READ, data.size());
+        }
+        in.close();
+        std::vector<uint8_t> output;
+        if (!writeToBuffer(data.data(), (uint32_t)data.size(), output)) {
+            return false;
+        }
+        std::ofstream out (outputPath, std::ios::out | std::ios::binary);
+        TINYEXIF_STAT_TIMER(STAGE_WRITE);
+        TINYEXIF_STAT_ADD(STAT_BYTES_WRITTEN, output.size());
+        if (!out.is_open() || !out.write((const char *)output.data(), output.size())) {
+            writeResult = EDIT_CORRUPT_DATA;
+            return false;
+        }
+        return true;
+    }
     
-    // 跳转到APP0结尾
-    in.read((char*)tempBuf, 6);
-    uint16_t exifLen = Utils::parse16(tempBuf + 4, false);
-    start = exifLen + 4;
-    in.seekg(start);
+    // SOS之前的部分在内存中生成，检查出错误时不创建输出文件
+    FileSource source(in);
+    std::vector<uint8_t> head;
+    if ((writeResult = buildHead(source, head)) != EDIT_SUCCESS) {
+        return false;
+    }
     
     //写文件流
-    std::ofstream out (outputPath, std::ios::out | std::ios::binary);
-    if (!out.is_open()) {
-        in.close();
+    std::ofstream out;
+    {
+        TINYEXIF_STAT_TIMER(STAGE_OPEN);
+        out.open(outputPath, std::ios::out | std::ios::binary);
+    }
+    FileSink sink(out);
+    TINYEXIF_STAT_TIMER(STAGE_WRITE);
+    if (!out.is_open() || !sink.write(head.data(), (uint32_t)head.size()) || !source.copyRest(sink)) {
+        writeResult = EDIT_CORRUPT_DATA;
+        return false;
+    }
+    return true;
+}
+
+bool ExifWriter::writeToBuffer(const uint8_t *data, uint32_t len, std::vector<uint8_t> &output) {
+    if (data == NULL) {
+        writeResult = EDIT_CORRUPT_DATA;
         return false;
     }
-    out.write((char*)tempBuf, 2); //jpeg头
-    out.write((char*)buffer, bufferLen);
-    while (start < fileSize) {
-        uint64_t size = 512;
-        uint64_t remain = fileSize - start;
-        if (size > remain) {
-            size = remain;
+    
+    const ContainerFormat format = SniffContainer(data, len);
+    if (format == CONTAINER_PNG || format == CONTAINER_WEBP) {
+        MetadataLocation location;
+        if (syncPixelDimensions && location.locateIn(data, len) != PARSE_INVALID_JPEG) {
+            writeResult = frameSized(location.Width, location.Height).writeContainer(data, len, output);
+        } else {
+            writeResult = writeContainer(data, len, output);
+        }
+        return writeResult == EDIT_SUCCESS;
+    }
+    
+    if (syncPixelDimensions) {
+        LayoutInfo layout;
+        if (layout.probeFrom(data, len, PROBE_FRAME_SIZE) == PARSE_SUCCESS) {
+            ExifWriter sized(frameSized(layout.FrameWidth, layout.FrameHeight));
+            const bool result = sized.writeToBuffer(data, len, output);
+            writeResult = sized.writeResult;
+            return result;
+        }
+    }
+    
+    output.clear();
+    output.reserve(len + bufferLen);
+    BufferSource source(data, len);
+    if ((writeResult = buildHead(source, output)) != EDIT_SUCCESS) {
+        output.clear();
+        return false;
+    }
+    BufferSink sink(output);
+    return source.copyRest(sink);
+}
+
+ExifWriter ExifWriter::frameSized(uint32_t width, uint32_t height) const {
+    ExifWriter synced(*this);
+    synced.syncPixelDimensions = false;
+    if (width && height) {
+        // 只修改已有的tag，没有时editAttribute会添加到IFD0，而它们属于Exif IFD
+        uint32_t dataAreaOffset = 0;
+        if (synced.findAttributeEntry(IMAGE_WIDTH, dataAreaOffset) > 0) {
+            synced.editAttribute(IMAGE_WIDTH, &width, TYPE_UINT32);
+        }
+        if (synced.findAttributeEntry(IMAGE_HEIGHT, dataAreaOffset) > 0) {
+            synced.editAttribute(IMAGE_HEIGHT, &height, TYPE_UINT32);
+        }
+    }
+    return synced;
+}
+
+int ExifWriter::buildHead(SegmentSource &in, std::vector<uint8_t> &head) {
+    TINYEXIF_STAT_TIMER(STAGE_WRITE);
+    std::vector<uint8_t> payloads;
+    std::vector<JpegSegment> segments;
+    if (!readSegments(in, payloads, segments)) {
+        return EDIT_CORRUPT_DATA;
+    }
+    
+    // 写出任何数据之前检查：从EXIF转移出的XMP不能替换原图独立的XMP，也不能两个都保留
+    if (xmpRelocated) {
+        for (const JpegSegment &segment : segments) {
+            const uint8_t *data = payloads.data() + segment.offset;
+            if (segment.marker == JM_APP1 && isXMPSegment(data, segment.length) && !isSegmentStripped(segment.marker, data, segment.length)) {
+                return EDIT_XMP_CONFLICT;
+            }
+        }
+    }
+    
+    // Photoshop资源可能拆分在多个APP13段中，每段都以"Photoshop 3.0\0"开头，替换IPTC时拼接起来一起处理
+    std::vector<uint8_t> photoshop;
+    for (const JpegSegment &segment : segments) {
+        const uint8_t *data = payloads.data() + segment.offset;
+        if (hasIPTC && isPhotoshopSegment(segment.marker, data, segment.length) && !isSegmentStripped(segment.marker, data, segment.length)) {
+            photoshop.insert(photoshop.end(), data + (photoshop.empty() ? 0 : PHOTOSHOP_HEADER_LENGTH), data + segment.length);
+        }
+    }
+    
+    BufferSink out(head);
+    const uint8_t soi[2] = {JM_START, JM_SOI};
+    out.write(soi, 2); //jpeg头
+    
+    bool exifWritten = false;
+    bool iptcWritten = !hasIPTC || iptcData.empty(); // 清空IPTC时不需要新增APP13段
+    bool photoshopWritten = false;
+    bool relocatedWritten = !xmpRelocated || xmpSegments.empty();
+    for (const JpegSegment &segment : segments) {
+        const uint8_t marker = segment.marker;
+        const uint8_t *data = payloads.data() + segment.offset;
+        
+        // EXIF段写在APP0(JFIF)之后，原来的EXIF段被替换
+        if (!exifWritten && marker != JM_APP0) {
+            out.write(buffer, bufferLen);
+            if (!xmpRelocated && !xmpSegments.empty()) {
+                out.write(xmpSegments.data(), (uint32_t)xmpSegments.size());
+            }
+            exifWritten = true;
+        }
+        
+        // 从EXIF转移出的XMP写在所有APPn段之后，前面已经确定原图中没有独立的XMP
+        if (!relocatedWritten && (marker < JM_APP0 || marker > JM_APP15)) {
+            out.write(xmpSegments.data(), (uint32_t)xmpSegments.size());
+            relocatedWritten = true;
+        }
+        
+        // 原图中没有IPTC时，新的APP13段写在所有APPn段之后
+        if (!iptcWritten && (marker < JM_APP0 || marker > JM_APP15)) {
+            if (!writeAPP13Segment(out, NULL, 0)) {
+                return EDIT_CORRUPT_DATA;
+            }
+            iptcWritten = true;
+        }
+        
+        uint8_t header[4] = {JM_START, marker};
+        if (marker == JM_SOS || marker == JM_EOI) { // 之后是图像数据，由调用者直接复制
+            out.write(header, 2);
+            return EDIT_SUCCESS;
+        }
+        if (!segment.hasLength) { // 没有长度的标记
+            out.write(header, 2);
+            continue;
+        }
+        
+        if (marker == JM_APP1 && segment.length >= 6 && memcmp(data, "Exif\0\0", 6) == 0) {
+            continue; // 原有的EXIF段
+        }
+        if (isSegmentStripped(marker, data, segment.length)) {
+            continue;
+        }
+        if (hasIPTC && isPhotoshopSegment(marker, data, segment.length)) {
+            // 替换原有的IPTC，保留其它的Photoshop资源，全部写在第一个段的位置
+            if (!photoshopWritten && !writeAPP13Segment(out, photoshop.data(), (uint32_t)photoshop.size(), !iptcWritten)) {
+                return EDIT_CORRUPT_DATA;
+            }
+            iptcWritten = photoshopWritten = true;
+            continue;
+        }
+        Utils::convertInt16ToByteArray((uint16_t)(segment.length + 2), header + 2, false);
+        out.write(header, 4);
+        out.write(data, segment.length);
+    }
+    return EDIT_CORRUPT_DATA; // readSegments保证最后一个是SOS或EOI
+}
+
+int ExifWriter::writeContainer(const uint8_t *data, uint32_t len, std::vector<uint8_t> &output) {
+    TINYEXIF_STAT_TIMER(STAGE_WRITE);
+    MetadataLocation location;
+    if (location.locateIn(data, len) == PARSE_INVALID_JPEG) {
+        return EDIT_CORRUPT_DATA;
+    }
+    if (xmpRelocated && !stripPolicy.xmp && location.XMP != NULL) {
+        return EDIT_XMP_CONFLICT; // 与jpeg相同，不替换原图中独立的XMP
+    }
+    output.clear();
+    output.reserve(len + bufferLen + xmpPacket.size() + 64);
+    const bool result = location.Format == CONTAINER_PNG ? writePNG(data, len, output) : writeWebP(data, len, location, output);
+    return result ? EDIT_SUCCESS : EDIT_CORRUPT_DATA;
+}
+
+bool ExifWriter::writePNG(const uint8_t *data, uint32_t len, std::vector<uint8_t> &output) {
+    const bool replaceXMP = stripPolicy.xmp || !xmpPacket.empty();
+    output.insert(output.end(), data, data + 8); // PNG签名
+    
+    bool written = false;
+    uint32_t offset = 8;
+    while (offset + 12 <= len) {
+        const uint32_t size = Utils::parse32(data + offset, false);
+        if (size > len - offset - 12) {
+            return false;
         }
-        in.read((char *)tempBuf, size);
-        out.write((char *)tempBuf, size);
+        const char *type = (const char *)data + offset + 4;
+        const uint32_t chunkLength = 12 + size;
         
-        start += size;
+        // 元数据写在第一个IDAT之前
+        if (!written && (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0)) {
+            appendPNGChunk(output, "eXIf", buffer + TIFF_HEADER_START, bufferLen - TIFF_HEADER_START);
+            if (!xmpPacket.empty() && !stripPolicy.xmp) {
+                appendPNGChunk(output, "iTXt", (const uint8_t *)PNG_XMP_HEADER, sizeof(PNG_XMP_HEADER),
+                               (const uint8_t *)xmpPacket.data(), (uint32_t)xmpPacket.size());
+            }
+            written = true;
+        }
+        
+        bool dropped = memcmp(type, "eXIf", 4) == 0;
+        if (replaceXMP && memcmp(type, "iTXt", 4) == 0 && size >= 18 && memcmp(type + 4, PNG_XMP_HEADER, 18) == 0) {
+            dropped = true;
+        }
+        if (!dropped) {
+            output.insert(output.end(), data + offset, data + offset + chunkLength);
+        }
+        offset += chunkLength;
+        if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
     }
     
-    in.close();
-    out.close();
+    output.insert(output.end(), data + offset, data + len); // IEND之后的数据
+    return written;
+}
+
+bool ExifWriter::writeWebP(const uint8_t *data, uint32_t len, const MetadataLocation &location, std::vector<uint8_t> &output) {
+    // 扩展格式的VP8X必须是第一个chunk，先占位，最后再填写
+    output.insert(output.end(), data, data + 12);
+    const size_t vp8xOffset = output.size();
+    output.resize(vp8xOffset + 8 + 10);
+    
+    const uint32_t riffSize = Utils::parse32(data + 4, true);
+    const uint32_t end = riffSize < len - 8 ? riffSize + 8 : len;
+    uint8_t flags = 0;
+    bool hasVP8X = false;
+    uint32_t offset = 12;
+    while (offset + 8 <= end) {
+        const uint32_t size = Utils::parse32(data + offset + 4, true);
+        if (size > end - offset - 8) {
+            return false;
+        }
+        const char *fourcc = (const char *)data + offset;
+        const uint8_t *payload = data + offset + 8;
+        const uint32_t chunkLength = std::min(8 + size + (size & 1), end - offset);
+        offset += chunkLength;
+        
+        if (memcmp(fourcc, "VP8X", 4) == 0) {
+            flags = size > 0 ? payload[0] : 0;
+            hasVP8X = true;
+            continue;
+        }
+        if (memcmp(fourcc, "EXIF", 4) == 0 || memcmp(fourcc, "XMP ", 4) == 0) {
+            continue; // 原有的元数据，重新写在最后
+        }
+        if (memcmp(fourcc, "ALPH", 4) == 0 ||
+            (memcmp(fourcc, "VP8L", 4) == 0 && size >= 5 && (payload[4] & 0x10))) { // VP8L头中的alpha_is_used
+            flags |= hasVP8X ? 0 : VP8X_FLAG_ALPHA;
+        }
+        output.insert(output.end(), fourcc, fourcc + chunkLength);
+    }
+    if (location.Width == 0 || location.Height == 0) {
+        return false; // 没有图像数据，无法确定画布尺寸
+    }
+    
+    appendWebPChunk(output, "EXIF", buffer + TIFF_HEADER_START, bufferLen - TIFF_HEADER_START);
+    flags |= VP8X_FLAG_EXIF;
+    if (!stripPolicy.xmp && (!xmpPacket.empty() || location.XMP != NULL)) {
+        if (xmpPacket.empty()) {
+            appendWebPChunk(output, "XMP ", (const uint8_t *)location.XMP, location.XMPLength);
+        } else {
+            appendWebPChunk(output, "XMP ", (const uint8_t *)xmpPacket.data(), (uint32_t)xmpPacket.size());
+        }
+        flags |= VP8X_FLAG_XMP;
+    } else {
+        flags &= ~VP8X_FLAG_XMP;
+    }
+    
+    // VP8X：标记(1字节) + 保留(3字节) + 画布宽-1(3字节) + 画布高-1(3字节)
+    uint8_t vp8x[10] = {flags};
+    for (int i = 0; i < 3; i++) {
+        vp8x[4 + i] = (uint8_t)((location.Width - 1) >> (i * 8));
+        vp8x[7 + i] = (uint8_t)((location.Height - 1) >> (i * 8));
+    }
+    std::vector<uint8_t> chunk;
+    appendWebPChunk(chunk, "VP8X", vp8x, sizeof(vp8x));
+    std::copy(chunk.begin(), chunk.end(), output.begin() + vp8xOffset);
+    Utils::convertInt32ToByteArray((uint32_t)output.size() - 8, output.data() + 4, true);
     return true;
 }
 
-//  修改一个Tag Entry的数据
-int ExifWriter::editAttribute(int16_t tag, void *value, uint16_t dataType) {
-    unsigned offset = (TIFF_HEADER_START + TIFF_HEADER_LENGTH - 4);
-    const unsigned first_ifd_offset = Utils::parse32(buffer + offset, alignIntel);
-    offset += first_ifd_offset - 4; //数据起始于MM+002a
-    if (offset + 2 > bufferLen) {
+int ExifWriter::setIPTC(const std::vector<IPTCValue> &values) {
+    std::vector<uint8_t> data;
+    buildIPTCData(values, data);
+    
+    // "Photoshop 3.0\0" + 8BIM资源头 + 数据。和原图中的其它资源合并后超长时，写入时拆分为多个段
+    if (2 + PHOTOSHOP_HEADER_LENGTH + 12 + data.size() + 1 > APP1_MAX_LENGTH) {
+        return EDIT_SEGMENT_OVERFLOW;
+    }
+    iptcData.swap(data);
+    hasIPTC = true;
+    return EDIT_SUCCESS;
+}
+
+bool ExifWriter::writeAPP13Segment(SegmentSink &out, const uint8_t *original, uint32_t originalLength, bool withIPTC) {
+    std::vector<uint8_t> segment;
+    if (!buildAPP13Segment(original, originalLength, withIPTC ? iptcData : std::vector<uint8_t>(), segment)) {
+        return false;
+    }
+    
+    // 和原有的资源合并后超长时与Photoshop相同，资源数据依次拆分到多个段中，每段重复"Photoshop 3.0\0"
+    const uint32_t maxLength = APP1_MAX_LENGTH - 2 - PHOTOSHOP_HEADER_LENGTH;
+    uint32_t offset = PHOTOSHOP_HEADER_LENGTH;
+    do {
+        const uint32_t length = std::min(maxLength, (uint32_t)segment.size() - offset);
+        uint8_t header[4] = {JM_START, JM_APP13};
+        Utils::convertInt16ToByteArray((uint16_t)(length + PHOTOSHOP_HEADER_LENGTH + 2), header + 2, false);
+        if (!out.write(header, 4) || !out.write(segment.data(), PHOTOSHOP_HEADER_LENGTH) || !out.write(segment.data() + offset, length)) {
+            return false;
+        }
+        offset += length;
+    } while (offset < segment.size());
+    return true;
+}
+
+bool ExifWriter::isSegmentStripped(uint8_t marker, const uint8_t *payload, uint32_t len) const {
+    if (marker >= JM_APP0 && marker <= JM_APP15 && (stripPolicy.appSegments & (1 << (marker - JM_APP0)))) {
+        return true;
+    }
+    // 从EXIF转移出的XMP不替换原图的XMP段
+    if (marker == JM_APP1 && (stripPolicy.xmp || (!xmpSegments.empty() && !xmpRelocated))) {
+        return isXMPSegment(payload, len);
+    }
+    return false;
+}
+
+bool ExifWriter::isXMPSegment(const uint8_t *payload, uint32_t len) {
+    static const char xmpHeader[] = "http://ns.adobe.com/xap/1.0/";
+    static const char xmpExtensionHeader[] = "http://ns.adobe.com/xmp/extension/";
+    return (len >= sizeof(xmpHeader) && memcmp(payload, xmpHeader, sizeof(xmpHeader)) == 0) ||
+        (len >= sizeof(xmpExtensionHeader) && memcmp(payload, xmpExtensionHeader, sizeof(xmpExtensionHeader)) == 0);
+}
+
+int ExifWriter::strip(const StripPolicy &policy) {
+    TINYEXIF_STAT_TIMER(STAGE_EDIT);
+    stripPolicy = policy;
+    
+    // 数据检查
+    if (bufferLen < TIFF_HEADER_START + TIFF_HEADER_LENGTH) {
         return EDIT_CORRUPT_DATA;
     }
     
-    bool isFound = false;
+    // 查找所有的IFD：IFD0、Exif、GPS、Interop、IFD1，上级IFD总是在前面
+    std::vector<IFDLocation> ifds;
+    IFDWalker walker(buffer, bufferLen, TIFF_HEADER_START, alignIntel);
+    while (walker.nextDirectory()) {
+        const IFDDirectory &dir = walker.directory();
+        IFDLocation ifd = {dir.Offset, dir.Entries, dir.PointerTag, dir.Parent, false, 0};
+        ifds.push_back(ifd);
+    }
+    if (ifds.empty()) {
+        return EDIT_CORRUPT_DATA;
+    }
     
-    uint32_t tagEntryOffset = findTagOffset(offset, tag);
-    if (tagEntryOffset > 0) { //找到tag
-        executeModifyAttributeValue(tagEntryOffset, value, findDataAreaOffset(offset));
-        isFound = true;
-    } else {
-        uint32_t subIFDOffset = findTagOffset(offset, SUB_IFD_OFFSET);
-        if (subIFDOffset > 0) { // 在Sub IFD中再查找
-            subIFDOffset = Utils::parse32(buffer + subIFDOffset + 8, alignIntel);
-            tagEntryOffset = findTagOffset(subIFDOffset + TIFF_HEADER_START, tag);
-            if (tagEntryOffset > 0) {
-                executeModifyAttributeValue(tagEntryOffset, value, findDataAreaOffset(subIFDOffset + TIFF_HEADER_START));
-                isFound = true;
+    // 要整体删除的IFD，子IFD跟随上级IFD删除
+    auto isTagStripped = [&](uint16_t tag) {
+        return (policy.gps && tag == GPS_IFD_OFFSET) ||
+            (policy.makerNote && tag == MAKER_NOTE) ||
+            (policy.xmp && tag == XMP_PACKET) ||
+            std::find(policy.tags.begin(), policy.tags.end(), tag) != policy.tags.end();
+    };
+    for (size_t i = 1; i < ifds.size(); i++) {
+        IFDLocation &ifd = ifds[i];
+        ifd.removed = ifds[ifd.parent].removed ||
+            (ifd.pointerTag != 0 ? isTagStripped(ifd.pointerTag) : policy.thumbnail);
+    }
+    
+    // 收集要删除的数据范围
+    std::vector<ByteRange> ranges;
+    // 范围来自文件中的offset，超出buffer或覆盖TIFF Header的范围忽略
+    auto addRange = [&](uint64_t start, uint32_t length) {
+        if (length > 0 && start >= TIFF_HEADER_START + TIFF_HEADER_LENGTH && start <= bufferLen && length <= bufferLen - start) {
+            ByteRange range = {(uint32_t)start, length};
+            ranges.push_back(range);
+        }
+    };
+    for (IFDLocation &ifd : ifds) {
+        if (ifd.removed) {
+            addRange(ifd.offset, 2 + ifd.entries * TIFF_ENTRY_LENGTH + 4);
+        }
+        for (uint32_t j = 0; j < ifd.entries; j++) {
+            uint32_t entry = ifd.offset + 2 + j * TIFF_ENTRY_LENGTH;
+            uint16_t tag = Utils::parse16(buffer + entry, alignIntel);
+            if (!ifd.removed && !isTagStripped(tag)) {
+                continue;
+            }
+            if (!ifd.removed) {
+                addRange(entry, TIFF_ENTRY_LENGTH);
+                ifd.removedEntries++;
+            }
+            uint32_t valueSize = computeDataSize(Utils::parse16(buffer + entry + 2, alignIntel), Utils::parse32(buffer + entry + 4, alignIntel));
+            if (valueSize > 4) {
+                addRange((uint64_t)TIFF_HEADER_START + Utils::parse32(buffer + entry + 8, alignIntel), valueSize);
+            }
+            if (tag == THUMBNAIL_OFFSET && ifd.removed) { // 缩略图数据
+                uint32_t thumbnailLength = 0;
+                for (uint32_t k = 0; k < ifd.entries; k++) {
+                    uint32_t other = ifd.offset + 2 + k * TIFF_ENTRY_LENGTH;
+                    if (Utils::parse16(buffer + other, alignIntel) == THUMBNAIL_LENGTH) {
+                        thumbnailLength = Utils::parse32(buffer + other + 8, alignIntel);
+                    }
+                }
+                addRange((uint64_t)TIFF_HEADER_START + Utils::parse32(buffer + entry + 8, alignIntel), thumbnailLength);
             }
         }
+    }
+    if (ranges.empty()) {
+        return EDIT_SUCCESS;
+    }
+    
+    // 合并重叠的范围
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<ByteRange> merged;
+    for (const ByteRange &range : ranges) {
+        if (!merged.empty() && range.start <= merged.back().start + merged.back().length) {
+            uint32_t end = std::max(merged.back().start + merged.back().length, range.start + range.length);
+            merged.back().length = end - merged.back().start;
+        } else {
+            merged.push_back(range);
+        }
+    }
+    
+    // 删除后的新位置
+    auto mapIndex = [&](uint32_t index) {
+        uint32_t shift = 0;
+        for (const ByteRange &range : merged) {
+            if (range.start + range.length > index) {
+                break;
+            }
+            shift += range.length;
+        }
+        return index - shift;
+    };
+    auto mapOffset = [&](uint32_t offset) { // 相对TIFF Header的偏移
+        return mapIndex(offset + TIFF_HEADER_START) - TIFF_HEADER_START;
+    };
+    
+    // 在原buffer中修改保留下来的entry数量和偏移量，然后一次性拷贝
+    uint8_t bytes[4];
+    for (size_t i = 0; i < ifds.size(); i++) {
+        const IFDLocation &ifd = ifds[i];
+        if (ifd.removed) {
+            continue;
+        }
+        Utils::convertInt16ToByteArray(ifd.entries - ifd.removedEntries, bytes, alignIntel);
+        memcpy(buffer + ifd.offset, bytes, 2);
         
-        uint32_t gpsIFDOffset = findTagOffset(offset, GPS_IFD_OFFSET);
-        if (gpsIFDOffset > 0) { // 在GPS IFD中再查找
-            gpsIFDOffset = Utils::parse32(buffer + gpsIFDOffset + 8, alignIntel);
-            tagEntryOffset = findTagOffset(gpsIFDOffset + TIFF_HEADER_START, tag);
-            if (tagEntryOffset > 0) {
-                executeModifyAttributeValue(tagEntryOffset, value, findDataAreaOffset(subIFDOffset + TIFF_HEADER_START));
-                isFound = true;
+        for (uint32_t j = 0; j < ifd.entries; j++) {
+            uint32_t entry = ifd.offset + 2 + j * TIFF_ENTRY_LENGTH;
+            uint16_t tag = Utils::parse16(buffer + entry, alignIntel);
+            if (isTagStripped(tag)) {
+                continue;
+            }
+            uint32_t value = Utils::parse32(buffer + entry + 8, alignIntel);
+            uint32_t valueSize = computeDataSize(Utils::parse16(buffer + entry + 2, alignIntel), Utils::parse32(buffer + entry + 4, alignIntel));
+            if (tag == SUB_IFD_OFFSET || tag == GPS_IFD_OFFSET || tag == INTEROP_IFD_OFFSET ||
+                (tag == THUMBNAIL_OFFSET && i > 0 && ifd.pointerTag == 0) || valueSize > 4) {
+                Utils::convertInt32ToByteArray(mapOffset(value), bytes, alignIntel);
+                memcpy(buffer + entry + 8, bytes, 4);
             }
         }
+        
+        uint32_t nextOffset = ifd.offset + 2 + ifd.entries * TIFF_ENTRY_LENGTH;
+        uint32_t next = Utils::parse32(buffer + nextOffset, alignIntel);
+        if (next != 0) {
+            bool nextRemoved = false; // 下一个IFD(IFD1)整体删除时断开链接
+            for (const IFDLocation &other : ifds) {
+                if (other.pointerTag == 0 && other.parent == (int)i) {
+                    nextRemoved = other.removed;
+                }
+            }
+            Utils::convertInt32ToByteArray(nextRemoved ? 0 : mapOffset(next), bytes, alignIntel);
+            memcpy(buffer + nextOffset, bytes, 4);
+        }
     }
+    Utils::convertInt32ToByteArray(mapOffset(Utils::parse32(buffer + TIFF_HEADER_START + 4, alignIntel)), bytes, alignIntel);
+    memcpy(buffer + TIFF_HEADER_START + 4, bytes, 4);
     
-    if (!isFound) { //没有找到，需要添加此属性
-        return addAttribute(tag, value, dataType);
+    uint32_t removedLen = 0;
+    for (const ByteRange &range : merged) {
+        removedLen += range.length;
+    }
+    uint8_t *temp = new uint8_t[bufferLen - removedLen];
+    uint32_t pos = 0, newLen = 0;
+    for (const ByteRange &range : merged) {
+        memcpy(temp + newLen, buffer + pos, range.start - pos);
+        newLen += range.start - pos;
+        pos = range.start + range.length;
     }
+    memcpy(temp + newLen, buffer + pos, bufferLen - pos);
+    newLen += bufferLen - pos;
+    
+    delete [] buffer;
+    buffer = temp;
+    bufferLen = newLen;
+    
+    // 修改APP1的长度，长度总是大端
+    Utils::convertInt16ToByteArray(bufferLen - 2, bytes, false);
+    memcpy(buffer + 2, bytes, 2);
     
     return EDIT_SUCCESS;
 }
 
+void ExifWriter::setSyncPixelDimensions(bool sync) {
+    syncPixelDimensions = sync;
+}
+
+void ExifWriter::setDropThumbnailOnOverflow(bool drop) {
+    dropThumbnailOnOverflow = drop;
+}
+
+void ExifWriter::setXMP(const std::string &packet) {
+    static const char xmpHeader[] = "http://ns.adobe.com/xap/1.0/";
+    static const char xmpExtensionHeader[] = "http://ns.adobe.com/xmp/extension/";
+    // 一个APP1段最多65533个字节(不包括标记和长度)
+    const uint32_t maxStandardLength = 0xFFFF - 2 - sizeof(xmpHeader);
+    const uint32_t maxChunkLength = 0xFFFF - 2 - sizeof(xmpExtensionHeader) - 32 - 4 - 4;
+    
+    xmpSegments.clear();
+    xmpPacket = packet;
+    xmpRelocated = false;
+    if (packet.empty()) {
+        return;
+    }
+    if (packet.size() <= maxStandardLength) {
+        appendXMPSegment(xmpHeader, sizeof(xmpHeader), packet, (uint32_t)packet.size());
+        return;
+    }
+    
+    // Extended XMP不包含xpacket包装
+    std::string::size_type start = 0, end = packet.size();
+    if (packet.compare(0, 15, "<?xpacket begin") == 0) {
+        std::string::size_type pos = packet.find("?>");
+        start = pos == std::string::npos ? 0 : pos + 2;
+    }
+    std::string::size_type trailer = packet.rfind("<?xpacket end");
+    if (trailer != std::string::npos && trailer > start) {
+        end = trailer;
+    }
+    const std::string extended = packet.substr(start, end - start);
+    const std::string guid = Utils::md5Hex((const uint8_t *)extended.data(), extended.size());
+    
+    // 标准段只保留GUID
+    const std::string standard =
+        "<?xpacket begin=\"\xEF\xBB\xBF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>"
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">"
+        "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+        "<rdf:Description rdf:about=\"\" xmlns:xmpNote=\"http://ns.adobe.com/xmp/note/\" xmpNote:HasExtendedXMP=\"" + guid + "\"/>"
+        "</rdf:RDF></x:xmpmeta><?xpacket end=\"w\"?>";
+    appendXMPSegment(xmpHeader, sizeof(xmpHeader), standard, (uint32_t)standard.size());
+    
+    // 每一段：GUID + 总长度 + 本段在总数据中的偏移 + 数据
+    uint8_t bytes[4];
+    for (uint32_t offset = 0; offset < extended.size(); offset += maxChunkLength) {
+        uint32_t size = std::min<uint32_t>(maxChunkLength, (uint32_t)extended.size() - offset);
+        std::string chunk = guid;
+        Utils::convertInt32ToByteArray((uint32_t)extended.size(), bytes, false);
+        chunk.append((const char *)bytes, 4);
+        Utils::convertInt32ToByteArray(offset, bytes, false);
+        chunk.append((const char *)bytes, 4);
+        chunk.append(extended, offset, size);
+        appendXMPSegment(xmpExtensionHeader, sizeof(xmpExtensionHeader), chunk, (uint32_t)chunk.size());
+    }
+}
+
+void ExifWriter::appendXMPSegment(const char *header, uint32_t headerLen, const std::string &data, uint32_t len) {
+    uint8_t bytes[4] = {JM_START, JM_APP1};
+    Utils::convertInt16ToByteArray(2 + headerLen + len, bytes + 2, false); // 长度总是大端
+    xmpSegments.insert(xmpSegments.end(), bytes, bytes + 4);
+    xmpSegments.insert(xmpSegments.end(), header, header + headerLen);
+    xmpSegments.insert(xmpSegments.end(), data.data(), data.data() + len);
+}
+
+size_t ExifWriter::transplantTo(const std::vector<TransplantTarget> &targets, std::vector<bool> *results) {
+    if (results) {
+        results->assign(targets.size(), false);
+    }
+    
+    // 删除缩略图后的数据，第一次用到时生成
+    std::unique_ptr<ExifWriter> stripped;
+    size_t succeeded = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        const TransplantTarget &target = targets[i];
+        
+        ExifWriter *base = this;
+        if (target.stripThumbnail) {
+            if (!stripped) {
+                stripped.reset(new ExifWriter(*this));
+                StripPolicy policy = stripPolicy;
+                policy.thumbnail = true;
+                stripped->strip(policy);
+            }
+            base = stripped.get();
+        }
+        
+        bool result;
+        bool resize = target.pixelWidth || target.pixelHeight;
+        bool sync = target.syncPixelDimensions && !(target.pixelWidth && target.pixelHeight);
+        if (!resize && sync == base->syncPixelDimensions) {
+            // 没有修改，直接使用已经序列化的数据
+            result = base->writeToFile(target.inputPath.c_str(), target.outputPath.c_str());
+        } else {
+            ExifWriter writer(*base);
+            writer.syncPixelDimensions = sync;
+            if (target.pixelWidth) {
+                uint32_t width = target.pixelWidth;
+                writer.editAttribute(IMAGE_WIDTH, &width, TYPE_UINT32);
+            }
+            if (target.pixelHeight) {
+                uint32_t height = target.pixelHeight;
+                writer.editAttribute(IMAGE_HEIGHT, &height, TYPE_UINT32);
+            }
+            result = writer.writeToFile(target.inputPath.c_str(), target.outputPath.c_str());
+        }
+        
+        if (result) {
+            succeeded++;
+        }
+        if (results) {
+            (*results)[i] = result;
+        }
+    }
+    return succeeded;
+}
+
+size_t ExifWriter::transplant(const char *masterPath, const std::vector<TransplantTarget> &targets, std::vector<bool> *results) {
+    uint32_t len = 0;
+    uint8_t *data = readExifData(masterPath, len);
+    if (data == NULL) {
+        if (results) {
+            results->assign(targets.size(), false);
+        }
+        return 0;
+    }
+    
+    ExifWriter writer(data, len);
+    delete [] data;
+    return writer.transplantTo(targets, results);
+}
+
+//  修改一个Tag Entry的数据
+int ExifWriter::editAttribute(int16_t tag, void *value, uint16_t dataType) {
+    if (findFirstIFD() == 0) {
+        return EDIT_CORRUPT_DATA;
+    }
+    
+    // 文件中的类型与值不是同一种时不能修改，否则会把value当作其它类型读取
+    uint32_t dataAreaOffset = 0;
+    uint32_t tagEntryOffset = findAttributeEntry(tag, dataAreaOffset);
+    if (tagEntryOffset > 0 && valueKind(Utils::parse16(buffer + tagEntryOffset + 2, alignIntel)) != valueKind(dataType)) {
+        return EDIT_CORRUPT_DATA;
+    }
+    
+    // 修改之前检查APP1的长度，转移数据后entry的位置会变化，需要重新查找
+    if (!reserveSegmentSpace(computeEditGrowth(tagEntryOffset, value, dataType))) {
+        return EDIT_SEGMENT_OVERFLOW;
+    }
+    
+    tagEntryOffset = findAttributeEntry(tag, dataAreaOffset);
+    if (tagEntryOffset == 0) { //没有找到，需要添加此属性
+        return addAttribute(tag, value, dataType);
+    }
+    
+    return executeModifyAttributeValue(tagEntryOffset, value, dataAreaOffset);
+}
+
+uint32_t ExifWriter::findAttributeEntry(int16_t tag, uint32_t &dataAreaOffset) {
+    // 依次在IFD0、Sub IFD、GPS IFD中查找，不查找缩略图的IFD1
+    IFDWalker walker(buffer, bufferLen, TIFF_HEADER_START, alignIntel, 1);
+    while (walker.nextDirectory()) {
+        const IFDDirectory &ifd = walker.directory();
+        if (ifd.Kind != IFD_IMAGE && ifd.Kind != IFD_EXIF && ifd.Kind != IFD_GPS) {
+            continue;
+        }
+        // walker进入目录时已经检查过边界，entry和next IFD offset都在buffer内
+        for (IFDEntry entry; walker.nextEntry(entry); ) {
+            TINYEXIF_STAT_ADD(STAT_TAG_PROBES, 1);
+            if (entry.Tag == (uint16_t)tag) { //找到tag
+                dataAreaOffset = ifd.NextField + 4;
+                return entry.Offset;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+int32_t ExifWriter::computeEditGrowth(uint32_t entryOffset, void *value, uint16_t dataType) {
+    if (entryOffset > 0) { // 修改属性，只有字符串会改变长度
+        if (Utils::parse16(buffer + entryOffset + 2, alignIntel) != TYPE_STRING) {
+            return 0;
+        }
+        uint32_t componentCount = Utils::parse32(buffer + entryOffset + 4, alignIntel);
+        int32_t valueLen = (int32_t)((std::string *)value)->length() + 1;
+        if (valueLen <= 4) {
+            return 0;
+        }
+        if (componentCount <= 4) {
+            return valueLen;
+        }
+        // 原来的值超出buffer时不会修改，长度不超过buffer时相减不会溢出
+        return findValueOffset(entryOffset) == 0 ? 0 : valueLen - (int32_t)componentCount;
+    }
+    
+    // 添加属性
+    switch (dataType) {
+        case TYPE_URATIONAL:
+        case TYPE_RATIONAL:
+        case TYPE_DOUBLE:
+            return TIFF_ENTRY_LENGTH + 8;
+        case TYPE_STRING: {
+            uint32_t strLen = (uint32_t)((std::string *)value)->length();
+            return TIFF_ENTRY_LENGTH + (strLen > 4 ? strLen : 0);
+        }
+        default:
+            return TIFF_ENTRY_LENGTH;
+    }
+}
+
+bool ExifWriter::reserveSegmentSpace(int32_t growth) {
+    if (growth <= 0 || bufferLen - 2 + growth <= APP1_MAX_LENGTH) {
+        return true;
+    }
+    
+    // 在副本上转移数据，放得下时再替换，放不下时不修改当前数据。
+    // 先转移EXIF中的XMP，UserComment加到转移出的XMP中；都不丢失数据，缩略图只在允许时删除
+    ExifWriter trial(*this);
+    while (trial.bufferLen - 2 + growth > APP1_MAX_LENGTH) {
+        StripPolicy policy = trial.stripPolicy;
+        uint32_t dataAreaOffset = 0, entry = 0;
+        if (trial.xmpSegments.empty() && (entry = trial.findAttributeEntry(XMP_PACKET, dataAreaOffset)) > 0) {
+            // EXIF中的XMP，setXMP设置了XMP时不转移
+            const uint32_t xmpSize = Utils::parse32(trial.buffer + entry + 4, trial.alignIntel);
+            const uint32_t xmpOffset = trial.findValueOffset(entry);
+            if (xmpOffset == 0 || xmpSize > trial.bufferLen - xmpOffset) {
+                return false;
+            }
+            trial.setXMP(std::string((const char *)trial.buffer + xmpOffset, xmpSize));
+            trial.xmpRelocated = true;
+            policy.tags.push_back(XMP_PACKET);
+        } else if ((entry = trial.findAttributeEntry(USER_COMMENT, dataAreaOffset)) > 0 && trial.relocateUserComment(entry)) {
+            policy.tags.push_back(USER_COMMENT);
+        } else if (dropThumbnailOnOverflow && trial.thumbnailSize() > 0) {
+            policy.thumbnail = true;
+        } else {
+            return false;
+        }
+        const uint32_t lastLen = trial.bufferLen;
+        const StripPolicy lastPolicy = trial.stripPolicy;
+        if (trial.strip(policy) != EDIT_SUCCESS || trial.bufferLen >= lastLen) {
+            return false;
+        }
+        trial.stripPolicy = lastPolicy;
+    }
+    
+    *this = trial;
+    return true;
+}
+
+bool ExifWriter::relocateUserComment(uint32_t entryOffset) {
+    const uint32_t size = Utils::parse32(buffer + entryOffset + 4, alignIntel);
+    const uint32_t valueOffset = findValueOffset(entryOffset);
+    std::string comment;
+    if (valueOffset == 0 || size > bufferLen - valueOffset ||
+        !decodeUserComment(buffer + valueOffset, size, alignIntel, comment)) {
+        return false;
+    }
+    // setXMP设置的XMP本来就会替换原图的XMP，只有新生成的或者转移出的XMP需要检查冲突
+    std::string packet = xmpPacket;
+    const bool relocated = xmpRelocated || packet.empty();
+    if (!addXMPUserComment(packet, comment)) {
+        return false;
+    }
+    setXMP(packet);
+    xmpRelocated = relocated;
+    return true;
+}
+
+uint32_t ExifWriter::thumbnailSize() {
+    IFDWalker walker(buffer, bufferLen, TIFF_HEADER_START, alignIntel);
+    while (walker.nextDirectory()) {
+        if (walker.directory().Kind != IFD_THUMBNAIL) {
+            continue;
+        }
+        for (IFDEntry entry; walker.nextEntry(entry); ) {
+            if (entry.Tag == THUMBNAIL_LENGTH) {
+                // 缩略图之外IFD1本身也会被删除，至少返回1
+                return std::max<uint32_t>(Utils::parse32(buffer + entry.Offset + 8, alignIntel), 1);
+            }
+        }
+        return 0;
+    }
+    return 0;
+}
+
 int ExifWriter::addAttribute(int16_t tag, void *value, uint16_t dataType) {
     uint8_t byteValue[4];
     memset(byteValue, 0, 4);
@@ -234,6 +1439,11 @@ int ExifWriter::addAttribute(int16_t tag, void *value, uint16_t dataType) {
         return EDIT_CORRUPT_DATA;
     }
     
+    const uint32_t offset = findFirstIFD();
+    if (offset == 0) {
+        return EDIT_CORRUPT_DATA;
+    }
+    
     //  组织数据
     uint8_t entryData[TIFF_ENTRY_LENGTH];
     memset(entryData, 0, sizeof(entryData));
@@ -243,12 +1453,12 @@ int ExifWriter::addAttribute(int16_t tag, void *value, uint16_t dataType) {
     memcpy(entryData + 8, byteValue, 4);
     
     // 修改entry数量
-    uint16_t entryCount = Utils::parse16(buffer + TIFF_HEADER_START + TIFF_HEADER_LENGTH,alignIntel);
+    uint16_t entryCount = Utils::parse16(buffer + offset, alignIntel);
     Utils::convertInt16ToByteArray(entryCount + 1, byteValue, alignIntel);
-    memcpy(buffer + TIFF_HEADER_START + TIFF_HEADER_LENGTH, byteValue, 2);
+    memcpy(buffer + offset, byteValue, 2);
     
     // 将数据插入到第一个位置
-    int entryDataStart = TIFF_HEADER_START + TIFF_HEADER_LENGTH + 2;
+    int entryDataStart = offset + 2;
     expandBuffer(entryDataStart, TIFF_ENTRY_LENGTH, NULL, 0);
     memcpy(buffer + entryDataStart, entryData, TIFF_ENTRY_LENGTH);
 
@@ -258,23 +1468,17 @@ int ExifWriter::addAttribute(int16_t tag, void *value, uint16_t dataType) {
 int ExifWriter::executeAddDoubleAttribute(int16_t tag, double *value, uint16_t dataType) {
     
     // 数据检查
-    uint32_t offset = (TIFF_HEADER_START + TIFF_HEADER_LENGTH - 4);
-    const unsigned first_ifd_offset = Utils::parse32(buffer + offset, alignIntel);
-    offset += first_ifd_offset - 4; //数据起始于MM+002a
-    if (offset + 2 > bufferLen) {
+    uint32_t dataAreaOffset = 0;
+    const uint32_t offset = findFirstIFD(&dataAreaOffset);
+    if (offset == 0) {
         return EDIT_CORRUPT_DATA;
     }
     
     // 将double转换为分数
-    int numerator = 0;
-    int denominator = 0;
-    Utils::convertDoubleToFraction(*value, numerator, denominator);
     uint8_t bytes[8];
-    Utils::convertInt32ToByteArray(numerator, bytes, alignIntel);
-    Utils::convertInt32ToByteArray(denominator, bytes + 4, alignIntel);
+    Utils::convertDoubleToRationalBytes(*value, bytes, alignIntel, dataType == TYPE_RATIONAL);
     
     // 将数据写入数据区
-    uint32_t dataAreaOffset = findDataAreaOffset(offset);
     expandBuffer(dataAreaOffset, 8, bytes, 8);
     
     //  组织数据
@@ -285,13 +1489,13 @@ int ExifWriter::executeAddDoubleAttribute(int16_t tag, double *value, uint16_t d
     Utils::convertInt32ToByteArray(1, entryData + 4, alignIntel);
     Utils::convertInt32ToByteArray(dataAreaOffset - TIFF_HEADER_START, entryData + 8, alignIntel);
     
-    // 修改entry数量
-    uint16_t entryCount = Utils::parse16(buffer + TIFF_HEADER_START + TIFF_HEADER_LENGTH,alignIntel);
+    // 修改entry数量，写入数据区后IFD0的位置不变
+    uint16_t entryCount = Utils::parse16(buffer + offset, alignIntel);
     Utils::convertInt16ToByteArray(entryCount + 1, bytes, alignIntel);
-    memcpy(buffer + TIFF_HEADER_START + TIFF_HEADER_LENGTH, bytes, 2);
+    memcpy(buffer + offset, bytes, 2);
     
     // 将数据插入到第一个位置
-    int entryDataStart = TIFF_HEADER_START + TIFF_HEADER_LENGTH + 2;
+    int entryDataStart = offset + 2;
     expandBuffer(entryDataStart, TIFF_ENTRY_LENGTH, entryData, TIFF_ENTRY_LENGTH);
     
     return EDIT_SUCCESS;
@@ -304,18 +1508,15 @@ int ExifWriter::executeAddStringAttribute(int16_t tag, std::string *value, uint1
     }
     
     // 数据检查
-    uint32_t offset = (TIFF_HEADER_START + TIFF_HEADER_LENGTH - 4);
-    const unsigned first_ifd_offset = Utils::parse32(buffer + offset, alignIntel);
-    offset += first_ifd_offset - 4; //数据起始于MM+002a
-    if (offset + 2 > bufferLen) {
+    uint32_t dataAreaOffset = 0;
+    const uint32_t offset = findFirstIFD(&dataAreaOffset);
+    if (offset == 0) {
         return EDIT_CORRUPT_DATA;
     }
     
     // 长度大于4时，需要将数据写入数据区
     uint32_t strLen = (uint32_t)value->length();
-    uint32_t dataAreaOffset = 0;
     if (strLen > 4) {
-        dataAreaOffset = findDataAreaOffset(offset);
         expandBuffer(dataAreaOffset, strLen, (uint8_t *)(value->c_str()), strLen);
     }
     
@@ -331,44 +1532,44 @@ int ExifWriter::executeAddStringAttribute(int16_t tag, std::string *value, uint1
         memcpy(entryData + 8, (uint8_t *)value->c_str(), strLen);
     }
     
-    // 修改entry数量
-    uint16_t entryCount = Utils::parse16(buffer + TIFF_HEADER_START + TIFF_HEADER_LENGTH, alignIntel);
+    // 修改entry数量，写入数据区后IFD0的位置不变
+    uint16_t entryCount = Utils::parse16(buffer + offset, alignIntel);
     uint8_t bytes[2];
     Utils::convertInt16ToByteArray(entryCount + 1, bytes, alignIntel);
-    memcpy(buffer + TIFF_HEADER_START + TIFF_HEADER_LENGTH, bytes, 2);
+    memcpy(buffer + offset, bytes, 2);
     
     // 将数据插入到第一个位置
-    int entryDataStart = TIFF_HEADER_START + TIFF_HEADER_LENGTH + 2;
+    int entryDataStart = offset + 2;
     expandBuffer(entryDataStart, TIFF_ENTRY_LENGTH, entryData, TIFF_ENTRY_LENGTH);
     
     return EDIT_SUCCESS;
 }
 
-uint32_t ExifWriter::findTagOffset(uint32_t offset, int16_t tag) {
-    int num_entries = Utils::parse16(buffer + offset, alignIntel);
-    if (offset + 6 + 12 * num_entries > bufferLen) {
+uint32_t ExifWriter::findFirstIFD(uint32_t *dataAreaOffset) {
+    IFDWalker walker(buffer, bufferLen, TIFF_HEADER_START, alignIntel, 1);
+    if (!walker.nextDirectory() || walker.directory().Kind != IFD_IMAGE) {
         return 0;
     }
-    
-    offset += 2;
-    for (int i = 0; i < num_entries; i++) {
-        int16_t curTag = Utils::parse16(buffer + offset, alignIntel);
-        if (tag == curTag) {
-            return offset;
-        }
-        offset += 12;
+    if (dataAreaOffset != NULL) {
+        *dataAreaOffset = walker.directory().NextField + 4;
     }
-    
-    return 0;
+    return walker.directory().Offset;
 }
 
-uint32_t ExifWriter::findDataAreaOffset(uint32_t ifdDirectoryOffset) {
-    int num_entries = Utils::parse16(buffer + ifdDirectoryOffset, alignIntel);
-    return ifdDirectoryOffset + 2 + 12 * num_entries + 4;
+uint32_t ExifWriter::findValueOffset(uint32_t offset) {
+    uint32_t size = computeDataSize(Utils::parse16(buffer + offset + 2, alignIntel), Utils::parse32(buffer + offset + 4, alignIntel));
+    if (size <= 4) {
+        return offset + 8;
+    }
+    uint64_t valueOffset = (uint64_t)TIFF_HEADER_START + Utils::parse32(buffer + offset + 8, alignIntel);
+    if (valueOffset < TIFF_HEADER_START + TIFF_HEADER_LENGTH || valueOffset + size > bufferLen) {
+        return 0;
+    }
+    return (uint32_t)valueOffset;
 }
 
 // 修改某个Entry的值
-void ExifWriter::executeModifyAttributeValue(uint32_t offset, void *value, uint32_t dataAreaOffset) {
+int ExifWriter::executeModifyAttributeValue(uint32_t offset, void *value, uint32_t dataAreaOffset) {
     uint16_t dataType = Utils::parse16(buffer + offset + 2, alignIntel);
     switch (dataType) {
         case TYPE_UINT8:
@@ -377,26 +1578,29 @@ void ExifWriter::executeModifyAttributeValue(uint32_t offset, void *value, uint3
         case TYPE_INT16:
         case TYPE_UINT32:
         case TYPE_INT32:
-            executeModifyAttributeIntValue(offset, (uint32_t *)value, dataAreaOffset);
-            break;
+            return executeModifyAttributeIntValue(offset, (uint32_t *)value, dataAreaOffset);
             
         case TYPE_STRING:
-            executeModifyAttributeStringValue(offset, (std::string *)value, dataAreaOffset);
-            break;
+            return executeModifyAttributeStringValue(offset, (std::string *)value, dataAreaOffset);
             
         case TYPE_URATIONAL:
         case TYPE_RATIONAL:
         case TYPE_FLOAT:
         case TYPE_DOUBLE:
-            executeModifyAttributeDoubleValue(offset, (double *)value, dataAreaOffset);
-            break;
+            return executeModifyAttributeDoubleValue(offset, (double *)value, dataAreaOffset);
             
         default:
-            break;
+            return EDIT_SUCCESS;
     }
 }
 
-void ExifWriter::executeModifyAttributeIntValue(uint32_t offset, uint32_t *value, uint32_t dataAreaOffset) {
+int ExifWriter::executeModifyAttributeIntValue(uint32_t offset, uint32_t *value, uint32_t dataAreaOffset) {
+    // 有多个值时修改第一个
+    uint32_t valueOffset = findValueOffset(offset);
+    if (valueOffset == 0) {
+        return EDIT_CORRUPT_DATA;
+    }
+    
     uint8_t byteValue[4];
     memset(byteValue, 0, 4);
     
@@ -409,12 +1613,21 @@ void ExifWriter::executeModifyAttributeIntValue(uint32_t offset, uint32_t *value
         Utils::convertInt32ToByteArray(*value, byteValue, alignIntel);
     }
     
-    memcpy(buffer + offset + 8, byteValue, 4 * sizeof(uint8_t)); //内存拷贝
+    if (valueOffset == offset + 8) {
+        memcpy(buffer + valueOffset, byteValue, 4 * sizeof(uint8_t)); //内存拷贝
+    } else {
+        memcpy(buffer + valueOffset, byteValue, computeDataSize(dataType, 1));
+    }
+    return EDIT_SUCCESS;
 }
 
-void ExifWriter::executeModifyAttributeDoubleValue(uint32_t offset, double *value, uint32_t dataAreaOffset) {
+int ExifWriter::executeModifyAttributeDoubleValue(uint32_t offset, double *value, uint32_t dataAreaOffset) {
     uint16_t dataType = Utils::parse16(buffer + offset + 2, alignIntel);
-    if (dataType == TYPE_FLOAT) { // float类型的，直接写入data位置
+    if (dataType == TYPE_FLOAT) { // float类型的，写入第一个值的位置
+        uint32_t valueOffset = findValueOffset(offset);
+        if (valueOffset == 0) {
+            return EDIT_CORRUPT_DATA;
+        }
         uint8_t byteValue[4];
         union {
             uint32_t i;
@@ -422,72 +1635,80 @@ void ExifWriter::executeModifyAttributeDoubleValue(uint32_t offset, double *valu
         } i2f;
         i2f.f = (float) (*value);
         Utils::convertInt32ToByteArray(i2f.i, byteValue, alignIntel);
-        memcpy(buffer + offset + 8, byteValue, 4 * sizeof(uint8_t)); //内存拷贝
+        memcpy(buffer + valueOffset, byteValue, 4 * sizeof(uint8_t)); //内存拷贝
     } else if (dataType == TYPE_DOUBLE) { // 不支持double
-        return;
+        return EDIT_SUCCESS;
     } else if (dataType == TYPE_URATIONAL || dataType == TYPE_RATIONAL) {
-        int numerator = 0;
-        int denominator = 0;
-        Utils::convertDoubleToFraction(*value, numerator, denominator);
-        uint8_t bytes[8];
-        Utils::convertInt32ToByteArray(numerator, bytes, alignIntel);
-        Utils::convertInt32ToByteArray(denominator, bytes + 4, alignIntel);
+        uint32_t contentOffset = findValueOffset(offset);
+        if (contentOffset == 0 || contentOffset == offset + 8) { // 没有值时也没有数据区
+            return EDIT_CORRUPT_DATA;
+        }
+        // 值没有变化时保留原来的分子分母，不重新编码
+        const bool isSigned = dataType == TYPE_RATIONAL;
+        if (Utils::parse32(buffer + contentOffset + 4, alignIntel) != 0 &&
+            Utils::parseRational(buffer + contentOffset, alignIntel, isSigned) == *value) {
+            return EDIT_SUCCESS;
+        }
         
-        uint32_t contentOffset = Utils::parse32(buffer + offset + 8, alignIntel) + TIFF_HEADER_START;
+        uint8_t bytes[8];
+        Utils::convertDoubleToRationalBytes(*value, bytes, alignIntel, isSigned);
         memcpy(buffer + contentOffset, bytes, 8);
-    } else {
-        return;
     }
+    return EDIT_SUCCESS;
 }
 
-void ExifWriter::executeModifyAttributeStringValue(uint32_t offset, std::string *value, uint32_t dataAreaOffset) {
+int ExifWriter::executeModifyAttributeStringValue(uint32_t offset, std::string *value, uint32_t dataAreaOffset) {
     uint32_t componentCount = Utils::parse32(buffer + offset + 4, alignIntel);
     int32_t valueLen = (int32_t)value->length() + 1;
     
+    // 修改之前检查原来的值和数据区的位置
+    uint32_t contentOffset = findValueOffset(offset);
+    if (contentOffset == 0 || (componentCount <= 4 && valueLen > 4 && dataAreaOffset > bufferLen)) {
+        return EDIT_CORRUPT_DATA;
+    }
+    
     // 修改components
     uint8_t byteValue[4];
     Utils::convertInt32ToByteArray(valueLen, byteValue, alignIntel);
     memcpy(buffer + offset + 4, byteValue, 4);
     
-    if (componentCount <= 4) { // 数据直接写在了data区
-        if (valueLen <= 4) { // 新值也小于4，直接在data内写
-            memcpy(buffer + offset + 8, value->c_str(), valueLen);
-            memset(buffer + offset + 8 + valueLen, 0, 1);
-        } else { // 大于4个，需要在Data area区域扩展
-            expandBuffer(dataAreaOffset, valueLen, NULL, 0);
-            
-            // 修改data的地址为offset地址
-            uint8_t conentOffset[4];
-            Utils::convertInt32ToByteArray(dataAreaOffset - TIFF_HEADER_START, conentOffset, alignIntel);
-            memcpy(buffer + offset + 8, conentOffset, 4);
-            
-            // 修改value内容
-            memcpy(buffer + dataAreaOffset, value->c_str(), valueLen);
-        }
+    if (valueLen <= 4) { // 新值不超过4个字节，直接写在data内，原来在数据区的值不用修改
+        memset(buffer + offset + 8, 0, 4);
+        memcpy(buffer + offset + 8, value->c_str(), valueLen);
+    } else if (componentCount <= 4) { // 原来的值在data内，需要在Data area区域扩展
+        expandBuffer(dataAreaOffset, valueLen, NULL, 0);
+        
+        // 修改data的地址为offset地址
+        uint8_t conentOffset[4];
+        Utils::convertInt32ToByteArray(dataAreaOffset - TIFF_HEADER_START, conentOffset, alignIntel);
+        memcpy(buffer + offset + 8, conentOffset, 4);
+        
+        // 修改value内容
+        memcpy(buffer + dataAreaOffset, value->c_str(), valueLen);
     } else {
-        if (valueLen <= 4) { // 新值长度不足4，不用改数据，直接写入data
-            memcpy(buffer + offset + 8, value->c_str(), valueLen);
-            memset(buffer + offset + valueLen, 0, 1);
-        } else {
-            uint32_t contentOffset = Utils::parse32(buffer + offset + 8, alignIntel) + TIFF_HEADER_START;
-            int32_t expandSize = valueLen - componentCount;
-            expandBuffer(contentOffset, expandSize, NULL, 0);
-            
-            // 修改value的值
-            memcpy(buffer + contentOffset, value->c_str(), valueLen);
-        }
+        int32_t expandSize = valueLen - componentCount;
+        expandBuffer(contentOffset + componentCount, expandSize, NULL, 0); // 在原来的值之后扩展，值本身的位置不变
+        
+        // 修改value的值
+        memcpy(buffer + contentOffset, value->c_str(), valueLen);
     }
+    return EDIT_SUCCESS;
 }
 
 void ExifWriter::expandBuffer(uint32_t start, int32_t expandSize, uint8_t *fillData, uint32_t fillDataSize) {
     if (expandSize == 0 || start > bufferLen) {
         return;
     } else {
+        if (expandSize < 0 && (uint32_t)-expandSize > start) {
+            return;
+        }
+        TINYEXIF_STAT_ADD(STAT_EXPAND_BUFFER, 1);
+        TINYEXIF_STAT_ADD(STAT_BYTES_MOVED, bufferLen + std::min(expandSize, 0));
         uint8_t *temp = new uint8_t[bufferLen + expandSize];
         memset(temp, 0, bufferLen + expandSize);
-        memcpy(temp, buffer, start);
+        memcpy(temp, buffer, expandSize > 0 ? start : start + expandSize); // 长度为负数时删除start之前的数据
         memcpy(temp + start + expandSize, buffer + start, bufferLen - start);
-        if (fillData != NULL) {
+        if (fillData != NULL && expandSize > 0) {
             memcpy(temp + start, fillData, fmin(expandSize, fillDataSize));
         }
         
@@ -496,77 +1717,78 @@ void ExifWriter::expandBuffer(uint32_t start, int32_t expandSize, uint8_t *fillD
         bufferLen += expandSize;
     }
     
-    // 修改data是offset的Entry
-    int offset = TIFF_HEADER_START + TIFF_HEADER_LENGTH;
-    increaseTagOffsetData(offset, start, expandSize);
+    // 修改data是offset的Entry，start及之后的数据都移动了
+    increaseTagOffsetData(start, expandSize);
     
-    // 修改APP0的长度
+    // 修改APP1的长度，长度总是大端，在reserveSegmentSpace中已经保证不会超过APP1_MAX_LENGTH
     uint8_t byteData[2];
-    uint16_t app0DataLen = Utils::parse16(buffer + 2, alignIntel);
-    app0DataLen += expandSize;
-    Utils::convertInt16ToByteArray(app0DataLen, byteData, alignIntel);
+    Utils::convertInt16ToByteArray(bufferLen - 2, byteData, false);
     memcpy(buffer + 2, byteData, 2);
 }
 
-void ExifWriter::increaseTagOffsetData(uint32_t offset, uint32_t startIndex, int32_t increaseSize) {
-    int num_entries = Utils::parse16(buffer + offset, alignIntel);
-    offset += 2;
-    for (int i = 0; i < num_entries; i++) {
-        int16_t curTag = Utils::parse16(buffer + offset, alignIntel);
-        if (curTag == (int16_t) SUB_IFD_OFFSET || curTag == (int16_t)GPS_IFD_OFFSET) { // sub idf or gps ifd
-            uint32_t value = Utils::parse32(buffer + offset + 8, alignIntel);
-            if (value > startIndex) {
-                value += increaseSize;
-                executeModifyAttributeIntValue(offset, &value, 0);
-            }
-            increaseTagOffsetData(value + TIFF_HEADER_START, startIndex, increaseSize);
-        } else {
-            uint16_t dataType = Utils::parse16(buffer + offset + 2, alignIntel);
-            uint32_t components = Utils::parse32(buffer + offset + 4, alignIntel);
-            uint32_t valueSize = computeDataSize(dataType, components);
-            if (valueSize > 4) {
-                uint32_t value = Utils::parse32(buffer + offset + 8, alignIntel);
-                if (value + TIFF_HEADER_START > startIndex) {
-                    value += increaseSize;
-                    executeModifyAttributeIntValue(offset, &value, 0);
-                }
+void ExifWriter::increaseTagOffsetData(uint32_t startIndex, int32_t increaseSize) {
+    // IFDWalker在进入子IFD时才读取指向它的offset，这里先修改的offset会被用来查找子IFD
+    IFDWalker walker(buffer, bufferLen, TIFF_HEADER_START, alignIntel);
+    uint8_t bytes[4];
+    while (walker.nextDirectory()) {
+        TINYEXIF_STAT_ADD(STAT_OFFSET_FIXUPS, 1);
+        IFDEntry entry;
+        while (walker.nextEntry(entry)) {
+            bool isOffset = entry.Tag == SUB_IFD_OFFSET || entry.Tag == GPS_IFD_OFFSET || entry.Tag == INTEROP_IFD_OFFSET ||
+                entry.Tag == THUMBNAIL_OFFSET || entry.Size > 4;
+            uint32_t value = Utils::parse32(buffer + entry.Offset + 8, alignIntel);
+            if (isOffset && value + TIFF_HEADER_START >= startIndex) { // value相对TIFF Header，偏移总是4个字节
+                Utils::convertInt32ToByteArray(value + increaseSize, bytes, alignIntel);
+                memcpy(buffer + entry.Offset + 8, bytes, 4);
             }
         }
         
-        offset += 12;
+        // 下一个IFD，IFD0之后是缩略图IFD1
+        const uint32_t nextField = walker.directory().NextField;
+        uint32_t next = Utils::parse32(buffer + nextField, alignIntel);
+        if (next != 0 && next + TIFF_HEADER_START >= startIndex) {
+            Utils::convertInt32ToByteArray(next + increaseSize, bytes, alignIntel);
+            memcpy(buffer + nextField, bytes, 4);
+        }
     }
 }
 
 uint32_t ExifWriter::computeDataSize(uint16_t dataType, uint32_t components) {
+    uint64_t unit = 0;
     switch (dataType) {
         case TYPE_UINT8: //unsigned byte
         case TYPE_STRING: //ascii strings
         case TYPE_INT8: // signed byte
         case TYPE_UNDEFINE: //undefined
-            return components;
+            unit = 1;
+            break;
             
         case TYPE_UINT16: //unsigned short
         case TYPE_INT16: //signed short
-            return 2 * components;
+            unit = 2;
+            break;
             
         case TYPE_UINT32: //unsigned long
         case TYPE_INT32: //signed long
         case TYPE_FLOAT: //single float
-            return 4 * components;
+            unit = 4;
+            break;
             
         case TYPE_URATIONAL: //unsigned rational
         case TYPE_RATIONAL: //signed rational
         case TYPE_DOUBLE: //double float
-            return 8 * components;
+            unit = 8;
+            break;
             
         default:
             break;
     }
     
-    return 0;
+    return (uint32_t)std::min<uint64_t>(unit * components, UINT32_MAX);
 }
 
 uint8_t* ExifWriter::readExifData(const char *imagePath, uint32_t &len) {
+    TINYEXIF_STAT_TIMER(STAGE_READ);
     // 源文件读取流
     std::ifstream in (imagePath, std::ios::in | std::ios::binary);
     if (!in.is_open()) {
@@ -575,32 +1797,82 @@ uint8_t* ExifWriter::readExifData(const char *imagePath, uint32_t &len) {
     
     uint8_t header[4];
     
-    // 跳转到APP0结尾
-    in.read((char*)header, 4);
-    if (header[0] != JM_START || header[1] != JM_SOI || header[2] != JM_START || header[3] != JM_APP1) {
-        // 头部4个字节不是FFD8 + FFE1，表示这个文件不是图片或者不包含EXIF信息
+    in.read((char*)header, 2);
+    if (!in || header[0] != JM_START || header[1] != JM_SOI) {
+        // 不是jpeg图片，PNG和WebP中的EXIF包装成APP1段
+        in.clear();
+        in.seekg(0);
+        std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
         in.close();
-        return NULL;
+        TINYEXIF_STAT_ADD(STAT_BYTES_READ, file.size());
+        
+        std::vector<uint8_t> exifData;
+        if (!readExifData(file.data(), (uint32_t)file.size(), exifData)) {
+            return NULL;
+        }
+        len = (uint32_t)exifData.size();
+        uint8_t *data = new uint8_t[len];
+        memcpy(data, exifData.data(), len);
+        return data;
     }
     
-    uint8_t lenData[2];
-    in.read((char *)lenData, 2);
-    uint16_t exifLen = Utils::parse16(lenData, false);
-    if (exifLen <= 0) {
+    // 逐段查找EXIF所在的APP1，前面可能有APP0(JFIF)等其它段
+    uint16_t exifLen = 0;
+    std::streamoff exifStart = 0;
+    while (in.read((char*)header, 4)) {
+        if (header[0] != JM_START || header[1] == JM_SOS || header[1] == JM_EOI) {
+            break;
+        }
+        uint16_t sectionLength = Utils::parse16(header + 2, false);
+        if (sectionLength < 2) {
+            break;
+        }
+        if (header[1] == JM_APP1 && sectionLength >= 8) {
+            char exifHeader[6];
+            in.read(exifHeader, 6);
+            if (in && memcmp(exifHeader, "Exif\0\0", 6) == 0) {
+                exifLen = sectionLength;
+                exifStart = (std::streamoff)in.tellg() - 10;
+                break;
+            }
+            in.seekg(sectionLength - 8, std::ios::cur);
+        } else {
+            in.seekg(sectionLength - 2, std::ios::cur);
+        }
+    }
+    if (exifLen == 0) {
+        // 不包含EXIF信息
         in.close();
         return NULL;
     }
     
     len = exifLen + 2;
     uint8_t *data = new uint8_t[len];
-    in.seekg(2);
+    in.seekg(exifStart);
     if (!in.read((char *)data, len)) {
+        delete [] data;
         in.close();
         return NULL;
     }
+    TINYEXIF_STAT_ADD(STAT_BYTES_READ, len);
     
     in.close();
     
     return data;
 }
+
+bool ExifWriter::readExifData(const uint8_t *data, uint32_t len, std::vector<uint8_t> &exifData) {
+    MetadataLocation location;
+    if (location.locateIn(data, len) != PARSE_SUCCESS || location.TIFF == NULL ||
+        location.Format == CONTAINER_TIFF || 2 + 6 + location.TIFFLength > APP1_MAX_LENGTH) {
+        return false;
+    }
+    exifData.resize(TIFF_HEADER_START + location.TIFFLength);
+    exifData[0] = JM_START;
+    exifData[1] = JM_APP1;
+    Utils::convertInt16ToByteArray((uint16_t)(exifData.size() - 2), exifData.data() + 2, false);
+    memcpy(exifData.data() + 4, "Exif\0\0", 6);
+    memcpy(exifData.data() + TIFF_HEADER_START, location.TIFF, location.TIFFLength);
+    return true;
+}
 }
@@ -13,6 +13,7 @@
 #include <fstream>  // std::ifstream
 #include <vector>   // std::vector
 #include "TinyEXIF.h"
+#include "TinyExifIPTC.hpp"
 
 
 // Jpeg图片格式说明：https://www.media.mit.edu/pia/Research/deepview/exif.html
@@ -30,30 +31,108 @@ namespace TinyEXIF {
 #define TIFF_HEADER_START 10
 #define TIFF_HEADER_LENGTH 8
 #define TIFF_ENTRY_LENGTH 12
+#define APP1_MAX_LENGTH 0xFFFF // APP1段的最大长度，包括长度本身的2个字节
 
 enum ExifEditCode {
     EDIT_SUCCESS           = 0, // 修改成功
-    EDIT_CORRUPT_DATA      = 1 // 数据错误
+    EDIT_CORRUPT_DATA      = 1, // 数据错误
+    EDIT_SEGMENT_OVERFLOW  = 2, // 修改后APP1段超过64K，转移EXIF中的XMP和UserComment后仍然放不下，没有做任何修改
+    EDIT_XMP_CONFLICT      = 3  // 写入时：EXIF中的数据已转移到独立的XMP，而原图有自己的XMP，没有写出任何数据
 };
 
+/// 元数据删除策略，用于ExifWriter::strip
+struct TINYEXIF_LIB StripPolicy {
+    bool gps = false;               // 删除GPS IFD
+    bool makerNote = false;         // 删除MakerNote(0x927c)
+    bool xmp = false;               // 删除XMP：EXIF中的0x02bc以及APP1中的XMP段
+    bool thumbnail = false;         // 删除IFD1及缩略图
+    std::vector<uint16_t> tags;     // 其它要删除的tag，在所有IFD中查找；删除指向子IFD的tag时整个子IFD一起删除
+    uint16_t appSegments = 0;       // 写入时要删除的APPn段，第n位表示APPn，例如(1 << 13)表示APP13(IPTC)；不影响本writer写入的EXIF段
+};
+
+/// EXIF移植的目标，用于ExifWriter::transplant
+struct TINYEXIF_LIB TransplantTarget {
+    std::string inputPath;              // 派生图片(缩放后的图片)地址
+    std::string outputPath;             // 输出的图片地址
+    uint32_t pixelWidth = 0;            // 新的PixelXDimension，0表示不修改
+    uint32_t pixelHeight = 0;           // 新的PixelYDimension，0表示不修改
+    bool syncPixelDimensions = false;   // 按照派生图片SOF中的尺寸修改，pixelWidth和pixelHeight优先
+    bool stripThumbnail = false;        // 删除缩略图
+};
+
+class SegmentSource;
+class SegmentSink;
+
 class TINYEXIF_LIB ExifWriter {
 public:
     /// 无参构造函数
     ExifWriter();
     /// Exif的原有数据
     ExifWriter(const uint8_t* originData, uint32_t len);
+    /// 拷贝构造函数，复制exif数据
+    ExifWriter(const ExifWriter &other);
+    /// 赋值，复制exif数据
+    ExifWriter& operator = (const ExifWriter &other);
     /// 析构函数
     ~ExifWriter();
     
     /// 增加exif info信息
     /// @param info Exif信息
+    /// @return 有属性因为APP1段超长被拒绝时返回false，其它属性仍然会写入
     bool addExifInfo(EXIFInfo *info);
 
-    /// 读取一个文件，修改其exif后，输出到指定文件
-    /// @param path 读取jpeg图片地址
+    /// 读取一个文件，修改其exif后，输出到指定文件。支持jpeg、PNG和WebP，
+    /// PNG和WebP写入eXIf/EXIF chunk和XMP chunk，不支持IPTC；不支持TIFF文件。
+    /// 先在内存中检查并生成jpeg的SOS之前的部分(PNG和WebP是整个文件)，检查出错误时不会创建输出文件，
+    /// 错误码见lastWriteResult
+    /// @param path 读取图片地址
     /// @param outputPath 输出的图片地址
     bool writeToFile (const char *path, const char *outputPath);
     
+    /// 读取一个内存中的图片(jpeg、PNG或WebP)，修改其exif后，输出到output
+    /// @param data 图片数据
+    /// @param len 数据长度
+    /// @param output 输出的图片数据
+    bool writeToBuffer(const uint8_t *data, uint32_t len, std::vector<uint8_t> &output);
+    
+    /// 上一次writeToFile/writeToBuffer的结果：成功时为EDIT_SUCCESS；写出数据之前检查出的冲突为
+    /// EDIT_XMP_CONFLICT；其它错误(源图损坏、读写失败)为EDIT_CORRUPT_DATA
+    int lastWriteResult() const { return writeResult; }
+    
+    /// 按照策略删除元数据。EXIF中的内容立即删除，所有的偏移量只重新计算一次；
+    /// 整个APPn段在writeToFile/writeToBuffer复制图片时跳过
+    /// @param policy 删除策略
+    int strip(const StripPolicy &policy);
+    
+    /// 写入文件时，是否按照图片SOF中的真实尺寸修改PixelXDimension和PixelYDimension。
+    /// 只修改原有的tag，修改的是这次写入的副本，同一个writer可以写入尺寸不同的图片
+    /// @param sync 是否同步，默认不同步
+    void setSyncPixelDimensions(bool sync);
+    
+    /// 修改使APP1段超过64K时，转移EXIF中的XMP和UserComment后仍然放不下，是否允许删除缩略图。
+    /// 默认不允许，这时修改返回EDIT_SEGMENT_OVERFLOW
+    /// @param drop 是否允许删除
+    void setDropThumbnailOnOverflow(bool drop);
+    
+    /// 设置XMP，写入时替换原图中的XMP段。超过一个APP1段容量的XMP按照Extended XMP
+    /// 拆分为多个段，标准段中只保留指向它的xmpNote:HasExtendedXMP
+    /// @param packet XMP数据，为空时保留原图的XMP
+    void setXMP(const std::string &packet);
+    
+    /// 设置IPTC数据，写入时在同一次复制中替换原图APP13段中的IPTC(8BIM 0x0404)，
+    /// 其它的Photoshop资源保留；原图没有APP13段时新增一个。原图的资源拆分在多个APP13段中时拼接后替换，
+    /// 合并后超过一个段的长度时同样拆分为多个段
+    /// @param values dataset列表，为空时删除原图中的IPTC
+    /// @return 数据超过一个APP13段的长度时返回EDIT_SEGMENT_OVERFLOW
+    int setIPTC(const std::vector<IPTCValue> &values);
+    
+    /// 把当前的exif数据写入多个派生图片。没有修改的目标直接使用当前的数据，
+    /// 需要删除缩略图的目标共用一份删除后的数据，只有修改尺寸的目标才会复制一次数据
+    /// @param targets 移植目标
+    /// @param results 每个目标是否成功，可以传NULL
+    /// @return 成功的数量
+    size_t transplantTo(const std::vector<TransplantTarget> &targets, std::vector<bool> *results = NULL);
+    
 private:
     // 存储exif数据的buffer
     uint8_t *buffer;
@@ -61,10 +140,94 @@ private:
     uint32_t bufferLen = 0;
     // 数据对齐方式，是大端还是小端。intel表示大端
     bool alignIntel = false;
+    // 写入文件时是否按照SOF修改图片尺寸
+    bool syncPixelDimensions = false;
+    // 写入时要跳过的段
+    StripPolicy stripPolicy;
+    // 写入的XMP段，包括标记和长度
+    std::vector<uint8_t> xmpSegments;
+    // 写入的XMP，PNG和WebP中不需要拆分
+    std::string xmpPacket;
+    // xmpPacket由EXIF中转移出的数据生成(0x02bc或UserComment)，不是setXMP设置的。
+    // 原图有独立的XMP时不能替换它，写入前返回EDIT_XMP_CONFLICT
+    bool xmpRelocated = false;
+    // APP1超长时是否允许删除缩略图
+    bool dropThumbnailOnOverflow = false;
+    // 上一次写入的结果
+    int writeResult = EDIT_SUCCESS;
+    // 写入的IPTC数据(8BIM 0x0404资源的内容)
+    std::vector<uint8_t> iptcData;
+    // 是否修改了IPTC
+    bool hasIPTC = false;
     
     // 初始化原始数据
     void initOriginExifData();
     
+    /// 读取jpeg中SOS之前的所有段，生成输出中SOS之前的部分(包括SOS标记)：替换原有的EXIF段，
+    /// 跳过要删除的段。先检查源图中与修改冲突的段，之后的数据由调用者直接复制
+    /// @param in 源数据，返回时位置在SOS标记之后
+    /// @param head 输出的数据，追加在后面
+    /// @return EDIT_SUCCESS、EDIT_XMP_CONFLICT或EDIT_CORRUPT_DATA
+    int buildHead(SegmentSource &in, std::vector<uint8_t> &head);
+    
+    /// 从打开的源文件逐段复制到outputPath，writeToFile同步尺寸之后的部分
+    /// @param in 源文件，位置在开头
+    /// @param outputPath 输出的图片地址
+    bool writeStream(std::ifstream &in, const char *outputPath);
+    
+    /// 写入PNG或WebP图片
+    /// @param data 图片数据
+    /// @param len 数据长度
+    /// @param output 输出的图片数据
+    /// @return EDIT_SUCCESS、EDIT_XMP_CONFLICT或EDIT_CORRUPT_DATA
+    int writeContainer(const uint8_t *data, uint32_t len, std::vector<uint8_t> &output);
+    
+    /// 逐个复制PNG chunk：删除原有的eXIf和XMP，新的chunk写在第一个IDAT之前，CRC重新计算
+    /// @param data 图片数据
+    /// @param len 数据长度
+    /// @param output 输出的图片数据
+    bool writePNG(const uint8_t *data, uint32_t len, std::vector<uint8_t> &output);
+    
+    /// 逐个复制WebP chunk：EXIF和XMP写在最后，简单格式(VP8/VP8L)转换为扩展格式(VP8X)，
+    /// 修改VP8X的标记和RIFF的长度
+    /// @param data 图片数据
+    /// @param len 数据长度
+    /// @param location 图片中的元数据位置和画布尺寸
+    /// @param output 输出的图片数据
+    bool writeWebP(const uint8_t *data, uint32_t len, const MetadataLocation &location, std::vector<uint8_t> &output);
+    
+    /// 写入APP13段，超过一个段的长度时拆分为多个段
+    /// @param out 输出
+    /// @param original 原图的APP13段数据，多个段时是拼接后的数据，没有时传NULL
+    /// @param originalLength 原图的APP13段长度
+    /// @param withIPTC 是否写入新的IPTC数据
+    bool writeAPP13Segment(SegmentSink &out, const uint8_t *original, uint32_t originalLength, bool withIPTC = true);
+    
+    /// 判断一个段在写入时是否需要删除
+    /// @param marker 段的标记
+    /// @param payload 段的数据，不包括标记和长度
+    /// @param len 段的数据长度
+    bool isSegmentStripped(uint8_t marker, const uint8_t *payload, uint32_t len) const;
+    
+    /// 是否是XMP或Extended XMP的APP1段
+    /// @param payload 段数据，不包括标记和长度
+    /// @param len 段的数据长度
+    static bool isXMPSegment(const uint8_t *payload, uint32_t len);
+    
+    /// 添加一个APP1段到xmpSegments
+    /// @param header 段的标识，包括结尾的'\0'
+    /// @param headerLen 标识长度
+    /// @param data 段数据
+    /// @param len 段数据长度
+    void appendXMPSegment(const char *header, uint32_t headerLen, const std::string &data, uint32_t len);
+    
+    /// 按照图片的真实尺寸(jpeg的SOF、PNG的IHDR、WebP的VP8X)修改已有的PixelXDimension和PixelYDimension，
+    /// 在副本上修改，只用于这一次写入，writer本身不变
+    /// @param width 宽，0表示未知
+    /// @param height 高，0表示未知
+    /// @return 修改后的副本，不再同步尺寸
+    ExifWriter frameSized(uint32_t width, uint32_t height) const;
+    
     /// 添加属性
     /// @param tag  属性Tag
     /// @param value  属性值
@@ -77,6 +240,33 @@ private:
     /// @param dataType 属性值类型，在JpegMarks.h中查找
     int editAttribute(int16_t tag, void *value, uint16_t dataType);
     
+    /// 查找属性的entry，依次在IFD0、Sub IFD、GPS IFD中查找
+    /// @param tag 属性Tag
+    /// @param dataAreaOffset 输出属性所在IFD的数据区起始index
+    /// @return entry起始index，没有找到时返回0
+    uint32_t findAttributeEntry(int16_t tag, uint32_t &dataAreaOffset);
+    
+    /// 计算修改或添加属性后buffer增加的长度
+    /// @param entryOffset 属性的entry，0表示添加属性
+    /// @param value 属性值
+    /// @param dataType 属性值类型
+    int32_t computeEditGrowth(uint32_t entryOffset, void *value, uint16_t dataType);
+    
+    /// 保证APP1段还能增加growth个字节。放不下时先把EXIF中的XMP(0x02bc)转移到独立的XMP，再把UserComment
+    /// 加到其中，只在原图没有独立的XMP时写入(见xmpRelocated)；仍然放不下时，
+    /// 允许的情况下删除缩略图(见setDropThumbnailOnOverflow)；最终放不下时不做任何修改
+    /// @param growth 增加的长度
+    /// @return 是否能放下
+    bool reserveSegmentSpace(int32_t growth);
+    
+    /// 把UserComment从EXIF转移到xmpPacket的exif:UserComment，只转移ASCII、Unicode和未指定编码的值
+    /// @param entryOffset UserComment的entry起始index
+    /// @return 是否转移，没有删除EXIF中的tag
+    bool relocateUserComment(uint32_t entryOffset);
+    
+    /// 缩略图(IFD1)的数据长度，没有缩略图时返回0
+    uint32_t thumbnailSize();
+    
     /// 扩展Buffer，当插入属性或修改属性需要扩大exif区长度时，扩展buffer长度
     /// @param start  扩展起始index
     /// @param expandSize  扩展byte数量
@@ -84,11 +274,11 @@ private:
     /// @param fillDataSize 写入数据长度
     void expandBuffer(uint32_t start, int32_t expandSize, uint8_t *fillData, uint32_t fillDataSize);
     
-    /// 增加各属性的offset值，这个函数一般与expandBuffer配合使用，当扩展了buffer后，entry数据的offset等数据也要跟着改变
-    /// @param offset 遍历entry的起始index
+    /// 增加各属性的offset值，这个函数一般与expandBuffer配合使用，当扩展了buffer后，entry数据的offset等数据也要跟着改变。
+    /// 用IFDWalker遍历所有的IFD(IFD0、Exif、GPS、Interop、IFD1)
     /// @param startIndex  扩展数据的起始index，一般当前offeset大于此值时才需要修改offset
     /// @param increaseSize 增加数据长度
-    void increaseTagOffsetData(uint32_t offset, uint32_t startIndex, int32_t increaseSize);
+    void increaseTagOffsetData(uint32_t startIndex, int32_t increaseSize);
     
     /// 执行添加double类型的属性，它实际是addAttribute的扩展
     /// @param tag 属性Tag
@@ -102,47 +292,66 @@ private:
     /// @param dataType 属性类型，在JpegMarks.h中查找
     int executeAddStringAttribute(int16_t tag, std::string *value, uint16_t dataType);
     
-    /// 查询 某个属性的起始index
-    /// @param offset 查找起始index
-    /// @param tag 属性Tag
-    uint32_t findTagOffset(uint32_t offset, int16_t tag);
+    /// IFD0的起始index，添加的属性写在IFD0中
+    /// @param dataAreaOffset 不为NULL时输出IFD0之后数据区的起始index
+    /// @return IFD0不存在或超出buffer时返回0
+    uint32_t findFirstIFD(uint32_t *dataAreaOffset = NULL);
     
-    /// 查找数据区的起始index
-    /// @param ifdDirectoryOffset IFD区的起始index
-    uint32_t findDataAreaOffset(uint32_t ifdDirectoryOffset);
+    /// 属性值的起始index，值不超过4个字节时在entry内，否则是entry中的offset指向的位置
+    /// @param offset 属性起始index
+    /// @return 值超出buffer或者覆盖了TIFF Header时返回0
+    uint32_t findValueOffset(uint32_t offset);
     
     /// 执行修改属性值
     /// @param offset 属性起始index
     /// @param value 属性值
     /// @param dataAreaOffset 数据区起始index
-    void executeModifyAttributeValue(uint32_t offset, void *value, uint32_t dataAreaOffset);
+    /// @return 值的位置超出buffer时返回EDIT_CORRUPT_DATA，不做任何修改
+    int executeModifyAttributeValue(uint32_t offset, void *value, uint32_t dataAreaOffset);
     
     /// 执行修改整数类型属性的值，它实际是executeModifyAttributeValue的执行分支
     /// @param offset 属性起始Index
     /// @param value 属性值
     /// @param dataAreaOffset 数据区起始index
-    void executeModifyAttributeIntValue(uint32_t offset, uint32_t *value, uint32_t dataAreaOffset);
+    /// @return 值的位置超出buffer时返回EDIT_CORRUPT_DATA，不做任何修改
+    int executeModifyAttributeIntValue(uint32_t offset, uint32_t *value, uint32_t dataAreaOffset);
     
     /// 执行修改小数类型属性的值，它实际是executeModifyAttributeValue的执行分支
     /// @param offset 属性起始Index
     /// @param value 属性值
     /// @param dataAreaOffset 数据区起始index
-    void executeModifyAttributeDoubleValue(uint32_t offset, double *value, uint32_t dataAreaOffset);
+    /// @return 值的位置超出buffer时返回EDIT_CORRUPT_DATA，不做任何修改
+    int executeModifyAttributeDoubleValue(uint32_t offset, double *value, uint32_t dataAreaOffset);
     
     /// 执行修改字符串类型属性的值，它实际是executeModifyAttributeValue的执行分支
     /// @param offset 属性起始Index
     /// @param value 属性值
     /// @param dataAreaOffset 数据区起始index
-    void executeModifyAttributeStringValue(uint32_t offset, std::string *value, uint32_t dataAreaOffset);
+    /// @return 值的位置超出buffer时返回EDIT_CORRUPT_DATA，不做任何修改
+    int executeModifyAttributeStringValue(uint32_t offset, std::string *value, uint32_t dataAreaOffset);
     
 public:
     
-    /// 读取一个Jpeg图片的exif数据
-    /// @param imagePath jpeg图片地址
+    /// 读取一个图片的exif数据，PNG和WebP中的EXIF包装成APP1段返回
+    /// @param imagePath 图片地址
     /// @param len exif数据长度
     static uint8_t* readExifData(const char *imagePath, uint32_t &len);
     
-    /// 计算一个数据的长度
+    /// 从内存中的图片(jpeg、PNG或WebP)读取exif数据，包装成APP1段
+    /// @param data 图片数据
+    /// @param len 数据长度
+    /// @param exifData 输出的exif数据，可以用来构造ExifWriter
+    /// @return 没有EXIF或者超过一个APP1段的长度时返回false
+    static bool readExifData(const uint8_t *data, uint32_t len, std::vector<uint8_t> &exifData);
+    
+    /// 把母图的exif完整地移植到多个派生图片，母图只读取一次
+    /// @param masterPath 母图地址
+    /// @param targets 移植目标
+    /// @param results 每个目标是否成功，可以传NULL
+    /// @return 成功的数量
+    static size_t transplant(const char *masterPath, const std::vector<TransplantTarget> &targets, std::vector<bool> *results = NULL);
+    
+    /// 计算一个数据的长度，超过uint32_t时返回UINT32_MAX
     /// @param dataType 数据类型
     /// @param components component的数量
     static uint32_t computeDataSize(uint16_t dataType, uint32_t components);
@@ -7,6 +7,9 @@
 
 #include <stdio.h>
 #include <iostream> // std::cout
+#include <cstring>
+#include <cmath>
+#include <algorithm>
 
 #include "Utils.h"
 
@@ -82,7 +85,7 @@ std::string parseString(const uint8_t* buf,
         if (value[num_components-1] == '\0')
             value.resize(num_components-1);
     } else
-    if (base+data+num_components <= len) {
+    if (base <= len && data <= len-base && num_components <= len-base-data) {
         const char* const sz((const char*)buf+base+data);
         unsigned num(0);
         while (num < num_components && sz[num] != '\0')
@@ -94,6 +97,37 @@ std::string parseString(const uint8_t* buf,
     return value;
 }
 
+const char* parseStringRef(const uint8_t* buf,
+    unsigned num_components,
+    unsigned entry,
+    unsigned base,
+    unsigned len,
+    bool intel,
+    unsigned &length) {
+    length = 0;
+    if (num_components == 0) {
+        return NULL;
+    }
+    if (num_components <= 4) {
+        const char* const sz((const char*)buf+entry);
+        length = num_components;
+        if (sz[length-1] == '\0')
+            --length;
+        return sz;
+    }
+    const unsigned data = parse32(buf+entry, intel);
+    if (base > len || data > len-base || num_components > len-base-data)
+        return NULL;
+    const char* const sz((const char*)buf+base+data);
+    unsigned num(0);
+    while (num < num_components && sz[num] != '\0')
+        ++num;
+    while (num && sz[num-1] == ' ')
+        --num;
+    length = num;
+    return sz;
+}
+
 void convertInt32ToByteArray(uint32_t value, uint8_t *result, bool intel) {
     if (intel) {
         result[3] = (uint8_t)(value >> 24);
@@ -122,6 +156,116 @@ void convertInt8ToByteArray(uint8_t value, uint8_t *result, bool intel) {
     result[0] = (uint8_t)(value & 0xFF);
 }
 
+// MD5 (RFC 1321)
+static void md5Block(uint32_t state[4], const uint8_t *block) {
+    static const uint32_t K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+    static const uint8_t R[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+    };
+    
+    uint32_t M[16];
+    for (int i = 0; i < 16; i++) {
+        M[i] = parse32(block + i * 4, true);
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f, g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+        uint32_t temp = d;
+        d = c;
+        c = b;
+        uint32_t x = a + f + K[i] + M[g];
+        b = b + ((x << R[i]) | (x >> (32 - R[i])));
+        a = temp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+std::string md5Hex(const uint8_t *data, size_t len) {
+    uint32_t state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    
+    size_t offset = 0;
+    for (; offset + 64 <= len; offset += 64) {
+        md5Block(state, data + offset);
+    }
+    
+    // 最后一块：补1和0，最后8个字节是数据的bit长度
+    uint8_t block[128] = {0};
+    size_t rest = len - offset;
+    memcpy(block, data + offset, rest);
+    block[rest] = 0x80;
+    size_t blockLen = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        block[blockLen - 8 + i] = (uint8_t)(bits >> (i * 8));
+    }
+    md5Block(state, block);
+    if (blockLen == 128) {
+        md5Block(state, block + 64);
+    }
+    
+    static const char *digits = "0123456789ABCDEF";
+    std::string result(32, '0');
+    for (int i = 0; i < 16; i++) {
+        uint8_t byte = (uint8_t)(state[i / 4] >> ((i % 4) * 8));
+        result[i * 2] = digits[byte >> 4];
+        result[i * 2 + 1] = digits[byte & 0x0f];
+    }
+    return result;
+}
+
+// CRC-32的查找表
+struct CRC32Table {
+    uint32_t values[256];
+    CRC32Table() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            values[n] = c;
+        }
+    }
+};
+
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc) {
+    static const CRC32Table table; // 局部静态变量的初始化是线程安全的
+    
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 void printByteArrayByHex(uint8_t *data, uint32_t len) {
     uint32_t index = 0;
     while (index < len) {
@@ -139,36 +283,86 @@ void printByteArrayByHex(uint8_t *data, uint32_t len) {
     std::cout << std::endl << std::endl;
 }
 
-void convertDoubleToFraction(double data, int &numerator, int &denominator) {
-
-    for (int j = 10;  ;j *= 10) {
-        double fractional_part = data * j - floor(data * j);
-        if (fractional_part < 0.00001 || j > 100000) {
-            numerator = (int)(data  * j);
-            denominator = j;
-            break;
-        }
-    }
-    
-    if (denominator == 0 || numerator == 0) {
+// 连分数求x(x >= 0)的最佳有理近似，分子不超过maxNumerator，分母不超过maxDenominator。
+// 每一步的渐进分数都是当前分母范围内的最佳近似，超出范围时再比较一次中间分数
+static void approximateFraction(double x, uint64_t maxNumerator, uint64_t maxDenominator,
+                                uint64_t &numerator, uint64_t &denominator) {
+    if (!(x > 0)) { // 0、负数和NaN
         numerator = 0;
-        denominator = 0;
+        denominator = 1;
+        return;
+    }
+    if (x >= (double)maxNumerator) {
+        numerator = maxNumerator;
+        denominator = 1;
         return;
     }
     
-    // 简化分数
-    int min = numerator;
-    int max = denominator;
-    while (true) {
-        int mod = max % min;
-        if (mod == 0) {
+    // h/k是当前的渐进分数，h2/k2是前一个
+    uint64_t h = 1, k = 0, h2 = 0, k2 = 1;
+    double r = x;
+    for (int i = 0; i < 64; i++) { // double的连分数展开很快就会结束，这里只是保证有界
+        const double a = floor(r);
+        // 保证分子分母都不超过范围的最大项
+        uint64_t limit = UINT64_MAX;
+        if (h > 0) {
+            limit = std::min(limit, (maxNumerator - h2) / h);
+        }
+        if (k > 0) {
+            limit = std::min(limit, (maxDenominator - k2) / k);
+        }
+        if (a > (double)limit) {
+            // 中间分数(limit*h+h2)/(limit*k+k2)有可能比当前的渐进分数更接近
+            if (limit > 0) {
+                const uint64_t sh = limit * h + h2, sk = limit * k + k2;
+                if (fabs((double)sh / sk - x) < fabs((double)h / k - x)) {
+                    h = sh;
+                    k = sk;
+                }
+            }
             break;
         }
         
-        max = min;
-        min = mod;
+        const uint64_t ai = (uint64_t)a;
+        const uint64_t nh = ai * h + h2, nk = ai * k + k2;
+        h2 = h;
+        k2 = k;
+        h = nh;
+        k = nk;
+        if (r == a || (double)h / k == x) { // 已经精确
+            break;
+        }
+        r = 1 / (r - a);
+    }
+    numerator = h;
+    denominator = k;
+}
+
+void convertDoubleToRational(double data, uint32_t &numerator, uint32_t &denominator) {
+    uint64_t n, d;
+    approximateFraction(data, UINT32_MAX, UINT32_MAX, n, d);
+    numerator = (uint32_t)n;
+    denominator = (uint32_t)d;
+}
+
+void convertDoubleToSRational(double data, int32_t &numerator, int32_t &denominator) {
+    uint64_t n, d;
+    approximateFraction(fabs(data), INT32_MAX, INT32_MAX, n, d);
+    numerator = data < 0 ? -(int32_t)n : (int32_t)n;
+    denominator = (int32_t)d;
+}
+
+void convertDoubleToRationalBytes(double data, uint8_t *result, bool intel, bool isSigned) {
+    uint32_t numerator, denominator;
+    if (isSigned) {
+        int32_t n, d;
+        convertDoubleToSRational(data, n, d);
+        numerator = (uint32_t)n;
+        denominator = (uint32_t)d;
+    } else {
+        convertDoubleToRational(data, numerator, denominator);
     }
-    numerator /= min;
-    denominator /= min;
+    convertInt32ToByteArray(numerator, result, intel);
+    convertInt32ToByteArray(denominator, result + 4, intel);
 }
 }
@@ -47,6 +47,23 @@ std::string parseString(const uint8_t* buf,
     unsigned len,
     bool intel);
 
+/// 解析字符串，不拷贝数据，返回的指针指向buf内部
+/// @param buf byte数组
+/// @param num_components 字符数量
+/// @param entry entry中4字节数据的位置，字符数量不超过4时字符串直接存放在这里
+/// @param base TIFF Header的起始位置
+/// @param len buf的长度
+/// @param intel 对齐方式，大端还是小端。intel使用的是大端
+/// @param length 输出字符串长度，去掉了结尾的'\0'和空格，与parseString结果一致
+/// @return 字符串起始指针，数据越界时返回NULL
+const char* parseStringRef(const uint8_t* buf,
+    unsigned num_components,
+    unsigned entry,
+    unsigned base,
+    unsigned len,
+    bool intel,
+    unsigned &length);
+
 /// 将int转转换为byte数组
 /// @param value  int
 /// @param result 要存储到的byte数组
@@ -66,11 +83,36 @@ void convertInt16ToByteArray(uint16_t value, uint8_t *result, bool intel);
 void convertInt8ToByteArray(uint8_t value, uint8_t *result, bool intel);
 
 
-/// 将double转换为分数
+/// 将double转换为无符号分数(RATIONAL)，用连分数求分子分母都不超过uint32的最佳近似，
+/// 1/3等有限分数可以精确表示。0和负数转换为0/1，超出范围时取最大值
 /// @param data  double
 /// @param numerator 分子
-/// @param denominator 分母
-void convertDoubleToFraction(double data, int &numerator, int &denominator);
+/// @param denominator 分母，总是大于0
+void convertDoubleToRational(double data, uint32_t &numerator, uint32_t &denominator);
+
+/// 将double转换为有符号分数(SRATIONAL)，分子分母都在int32范围内
+/// @param data  double
+/// @param numerator 分子，与data同号
+/// @param denominator 分母，总是大于0
+void convertDoubleToSRational(double data, int32_t &numerator, int32_t &denominator);
+
+/// 将double转换为rational的8个字节(分子 + 分母)，与parseRational相反
+/// @param data  double
+/// @param result 要存储到的byte数组
+/// @param intel 对齐方式
+/// @param isSigned 是否为有符号的SRATIONAL
+void convertDoubleToRationalBytes(double data, uint8_t *result, bool intel, bool isSigned);
+
+/// 计算MD5，返回32位大写十六进制字符串，用于Extended XMP的GUID
+/// @param data 数据
+/// @param len 数据长度
+std::string md5Hex(const uint8_t *data, size_t len);
+
+/// 计算CRC-32(ISO 3309，PNG chunk使用的CRC)，可以分多次计算
+/// @param data 数据
+/// @param len 数据长度
+/// @param crc 前面数据的CRC，第一次为0
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
 
 /// 将byte[]使用十六进制打印
 /// @param data byte[] byte数组指针
@@ -12,12 +12,21 @@
 #endif
 #include "TinyEXIF.h"
 #include "TinyExifWriter.hpp"
+#include "TinyExifJson.hpp"
+#include "TinyExifCrawler.hpp"
+#include "TinyExifPipeline.hpp"
 #include "Utils.h"
 
 #include <iostream> // std::cout
 #include <fstream>  // std::ifstream
 #include <vector>   // std::vector
 #include <iomanip>  // std::setprecision
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 class EXIFStreamFile : public TinyEXIF::EXIFStream {
 public:
@@ -73,10 +82,157 @@ void testModifyExif(const char** argv) {
     writer.writeToFile(argv[2], argv[3]);
 }
 
+static bool readFile(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+        return false;
+    const std::streamoff size = in.tellg();
+    if (size <= 0 || (uint64_t)size > UINT32_MAX)
+        return false;
+    data.resize((size_t)size);
+    in.seekg(0);
+    return (bool)in.read((char*)data.data(), size);
+}
+
+/// 输出JSON Lines的一批文件
+struct JsonBatch {
+    size_t index;                   // --ordered时的输出顺序
+    std::vector<std::string> paths;
+};
+
+/// 输出JSON Lines
+/// TinyEXIF --json [--fields=Make,Model,...] [--ordered] [--threads=N] [--filter=extension|jpeg|image|all] <file or directory>...
+/// Crawler遍历目录，找到的文件按批放入队列，解析线程取出后解析，整批写到stdout。
+/// 每个解析线程使用自己的EXIFInfo、读文件的buffer和输出的buffer；
+/// --ordered时先列出所有文件并按地址排序，各批按顺序输出
+static int dumpJson(int argc, const char** argv) {
+    TinyEXIF::JsonLineWriter writer;
+    TinyEXIF::CrawlConfig crawlConfig;
+    std::vector<std::string> roots;
+    bool ordered = false;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--fields=", 9) == 0) {
+            if (!writer.selectFields(argv[i] + 9)) {
+                std::cerr << "error: unknown field in '" << argv[i] + 9 << "', available fields:";
+                for (const std::string& name : TinyEXIF::JsonLineWriter::fieldNames())
+                    std::cerr << " " << name;
+                std::cerr << "\n";
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--ordered") == 0) {
+            ordered = true;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threadCount = std::max(1, atoi(argv[i] + 10));
+        } else if (strcmp(argv[i], "--filter=all") == 0) {
+            crawlConfig.filter = TinyEXIF::CRAWL_ALL_FILES;
+        } else if (strcmp(argv[i], "--filter=extension") == 0) {
+            crawlConfig.filter = TinyEXIF::CRAWL_IMAGE_EXTENSIONS;
+        } else if (strcmp(argv[i], "--filter=jpeg") == 0) {
+            crawlConfig.filter = TinyEXIF::CRAWL_JPEG_SIGNATURE;
+        } else if (strcmp(argv[i], "--filter=image") == 0) {
+            crawlConfig.filter = TinyEXIF::CRAWL_IMAGE_SIGNATURE;
+        } else {
+            roots.push_back(argv[i]);
+        }
+    }
+    if (roots.empty()) {
+        std::cerr << "Usage: TinyEXIF --json [--fields=Make,Model,...] [--ordered] [--threads=N] [--filter=extension|jpeg|image|all] <file or directory>...\n";
+        return -1;
+    }
+    crawlConfig.threads = threadCount;
+    crawlConfig.batchSize = 256;
+
+    typedef std::unique_ptr<JsonBatch> BatchPtr;
+    TinyEXIF::BoundedQueue<BatchPtr> queue(threadCount * 2);
+    std::thread crawling([&] {
+        TinyEXIF::Crawler crawler(crawlConfig);
+        size_t index = 0;
+        if (ordered) {
+            std::vector<std::string> files = crawler.collect(roots);
+            std::sort(files.begin(), files.end());
+            for (size_t begin = 0; begin < files.size(); begin += crawlConfig.batchSize) {
+                BatchPtr batch(new JsonBatch());
+                batch->index = index++;
+                batch->paths.assign(files.begin() + begin, files.begin() + std::min(files.size(), begin + crawlConfig.batchSize));
+                queue.push(batch);
+            }
+        } else {
+            std::mutex mutex;
+            crawler.crawl(roots, [&](std::vector<std::string>& paths) {
+                BatchPtr batch(new JsonBatch());
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batch->index = index++;
+                }
+                batch->paths.swap(paths);
+                queue.push(batch);
+            });
+        }
+        queue.close();
+    });
+
+    std::mutex outputMutex;
+    std::map<size_t, std::string> finished; // --ordered时已完成但还不能输出的批
+    size_t nextOutput = 0;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread([&] {
+            TinyEXIF::EXIFInfo info;
+            std::vector<uint8_t> data;
+            std::string output;
+            BatchPtr batch;
+            while (queue.pop(batch)) {
+                for (const std::string& path : batch->paths) {
+                    int code = TinyEXIF::PARSE_INVALID_JPEG;
+                    if (readFile(path, data)) {
+                        code = info.parseFromContainer(data.data(), (unsigned)data.size());
+                    } else {
+                        info.clear();
+                    }
+                    writer.write(path, info, code, output);
+                }
+
+                std::lock_guard<std::mutex> lock(outputMutex);
+                if (!ordered) {
+                    fwrite(output.data(), 1, output.size(), stdout);
+                    output.clear();
+                    continue;
+                }
+                if (batch->index == nextOutput) {
+                    fwrite(output.data(), 1, output.size(), stdout);
+                    output.clear();
+                    nextOutput++;
+                } else {
+                    finished[batch->index].swap(output);
+                }
+                // 输出等待中的批，并取回已输出的buffer，下一批不用重新分配
+                for (std::map<size_t, std::string>::iterator it = finished.begin(); it != finished.end() && it->first == nextOutput; it = finished.erase(it)) {
+                    fwrite(it->second.data(), 1, it->second.size(), stdout);
+                    nextOutput++;
+                    if (it->second.capacity() > output.capacity()) {
+                        output.swap(it->second);
+                        output.clear();
+                    }
+                }
+            }
+        }));
+    }
+    crawling.join();
+    for (std::thread& thread : threads)
+        thread.join();
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, const char** argv)
 {
+    if (argc >= 2 && strcmp(argv[1], "--json") == 0) {
+        return dumpJson(argc - 2, argv + 2);
+    }
     if (argc < 2) {
         std::cout << "Usage: TinyEXIF <image_file>\n";
+        std::cout << "       TinyEXIF --json [--fields=Make,Model,...] [--ordered] [--threads=N] [--filter=extension|jpeg|image|all] <file or directory>...\n";
         return -1;
     }
     
@@ -103,6 +259,10 @@ int main(int argc, const char** argv)
     // print extracted metadata
     if (imageEXIF.ImageWidth || imageEXIF.ImageHeight)
         std::cout << "ImageResolution " << imageEXIF.ImageWidth << "x" << imageEXIF.ImageHeight << " pixels" << "\n";
+    if (imageEXIF.Fields & TinyEXIF::FIELD_FRAME)
+        std::cout << "FrameSize " << imageEXIF.Frame.Width << "x" << imageEXIF.Frame.Height << " pixels, " << (int)imageEXIF.Frame.Components << " components, " << (imageEXIF.Frame.Progressive ? "progressive" : "baseline") << "\n";
+    if (imageEXIF.Fields & TinyEXIF::FIELD_EXTENDED_XMP)
+        std::cout << "ExtendedXMP " << imageEXIF.ExtendedXMP.size() << " bytes, GUID " << imageEXIF.ExtendedXMPGUID << "\n";
     if (imageEXIF.RelatedImageWidth || imageEXIF.RelatedImageHeight)
         std::cout << "RelatedImageResolution " << imageEXIF.RelatedImageWidth << "x" << imageEXIF.RelatedImageHeight << " pixels" << "\n";
     if (!imageEXIF.ImageDescription.empty())
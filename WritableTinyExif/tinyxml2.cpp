@@ -2129,6 +2129,8 @@ XMLDocument::XMLDocument( bool processEntities, Whitespace whitespaceMode ) :
     _errorStr(),
     _errorLineNum( 0 ),
     _charBuffer( 0 ),
+    _charBufferSize( 0 ),
+    _retainMemory( false ),
     _parseCurLineNum( 0 ),
 	_parsingDepth(0),
     _unlinked(),
@@ -2144,6 +2146,7 @@ XMLDocument::XMLDocument( bool processEntities, Whitespace whitespaceMode ) :
 
 XMLDocument::~XMLDocument()
 {
+    _retainMemory = false;
     Clear();
 }
 
@@ -2173,8 +2176,11 @@ void XMLDocument::Clear()
 #endif
     ClearError();
 
-    delete [] _charBuffer;
-    _charBuffer = 0;
+    if ( !_retainMemory ) {
+        delete [] _charBuffer;
+        _charBuffer = 0;
+        _charBufferSize = 0;
+    }
 	_parsingDepth = 0;
 
 #if 0
@@ -2339,8 +2345,7 @@ XMLError XMLDocument::LoadFile( FILE* fp )
     }
 
     const size_t size = static_cast<size_t>(filelength);
-    TIXMLASSERT( _charBuffer == 0 );
-    _charBuffer = new char[size+1];
+    ReserveCharBuffer( size+1 );
     const size_t read = fread( _charBuffer, 1, size, fp );
     if ( read != size ) {
         SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
@@ -2395,8 +2400,7 @@ XMLError XMLDocument::Parse( const char* p, size_t len )
     if ( len == static_cast<size_t>(-1) ) {
         len = strlen( p );
     }
-    TIXMLASSERT( _charBuffer == 0 );
-    _charBuffer = new char[ len+1 ];
+    ReserveCharBuffer( len+1 );
     memcpy( _charBuffer, p, len );
     _charBuffer[len] = 0;
 
@@ -2479,6 +2483,19 @@ const char* XMLDocument::ErrorName() const
     return ErrorIDToName(_errorID);
 }
 
+
+char* XMLDocument::ReserveCharBuffer( size_t size )
+{
+    // A retained buffer large enough for the new document is reused as is
+    if ( !_charBuffer || _charBufferSize < size ) {
+        delete [] _charBuffer;
+        _charBuffer = new char[size];
+        _charBufferSize = size;
+    }
+    return _charBuffer;
+}
+
+
 void XMLDocument::Parse()
 {
     TIXMLASSERT( NoChildren() ); // Clear() must have been called previously
@@ -95,6 +95,11 @@ distribution.
 #endif
 
 
+#ifdef TINYEXIF_STATS
+// WritableTinyExif: MemPoolT reports its allocations to TinyExifStats
+namespace TinyEXIF { namespace Stats { void countXMLAllocation( bool newBlock ); } }
+#endif
+
 /* Versioning, past 1.0.14:
 	http://semver.org/
 */
@@ -372,6 +377,9 @@ public:
     }
 
     virtual void* Alloc() {
+#ifdef TINYEXIF_STATS
+        TinyEXIF::Stats::countXMLAllocation( !_root );
+#endif
         if ( !_root ) {
             // Need a new block.
             Block* block = new Block();
@@ -1803,6 +1811,20 @@ public:
         _writeBOM = useBOM;
     }
 
+    /** Sets whether Clear() keeps the memory of the document (WritableTinyExif).
+        When set, the character buffer and the blocks of the node pools
+        survive Clear() and the next Parse() of a document that fits reuses
+        them, so a document reused for many small documents stops allocating.
+        Turning it off releases the character buffer on the next Clear();
+        the pool blocks are released by the destructor.
+    */
+    void SetRetainMemory( bool retain ) {
+        _retainMemory = retain;
+    }
+    bool RetainMemory() const {
+        return _retainMemory;
+    }
+
     /** Return the root element of DOM. Equivalent to FirstChildElement().
         To get the first node, use FirstChild().
     */
@@ -1874,7 +1896,10 @@ public:
     void DeleteNode( XMLNode* node );
 
     void ClearError() {
-        SetError(XML_SUCCESS, 0, 0);
+        // Reset in place instead of formatting a success message, which allocated on every Parse()
+        _errorID = XML_SUCCESS;
+        _errorLineNum = 0;
+        _errorStr.Reset();
     }
 
     /// Return true if there was an error parsing the document.
@@ -1938,6 +1963,8 @@ private:
     mutable StrPair	_errorStr;
     int             _errorLineNum;
     char*			_charBuffer;
+    size_t			_charBufferSize;
+    bool			_retainMemory;
     int				_parseCurLineNum;
 	int				_parsingDepth;
 	// Memory tracking does add some overhead.
@@ -1956,6 +1983,7 @@ private:
 	static const char* _errorNames[XML_ERROR_COUNT];
 
     void Parse();
+    char* ReserveCharBuffer( size_t size );
 
     void SetError( XMLError error, int lineNum, const char* format, ... );
 
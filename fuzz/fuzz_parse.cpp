@@ -0,0 +1,24 @@
+//
+//  fuzz_parse.cpp
+//  WritableTinyExif
+//
+// libFuzzer入口：解析整个图片。jpeg走parseFrom，同一份数据再按容器
+// (PNG、WebP、TIFF)和零拷贝的view方式各解析一次，最后解析APP13中的IPTC
+
+#include <stddef.h>
+#include <stdint.h>
+#include "TinyEXIF.h"
+#include "TinyExifIPTC.hpp"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size > UINT32_MAX) {
+        return 0;
+    }
+    TinyEXIF::EXIFInfo info;
+    info.parseFrom(data, (unsigned)size);
+    info.parseFromContainer(data, (unsigned)size);
+    info.parseViewFrom(data, (unsigned)size);
+    TinyEXIF::IPTCInfo iptc;
+    iptc.parseFrom(data, (unsigned)size);
+    return 0;
+}
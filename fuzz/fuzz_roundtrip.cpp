@@ -0,0 +1,68 @@
+//
+//  fuzz_roundtrip.cpp
+//  WritableTinyExif
+//
+// libFuzzer入口：解析、修改、写回、再解析。输入是一个图片，
+// 最后一个字节选择这次的删除策略和是否替换XMP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "TinyEXIF.h"
+#include "TinyExifWriter.hpp"
+
+using namespace TinyEXIF;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size == 0 || size > UINT32_MAX) {
+        return 0;
+    }
+    EXIFInfo info;
+    if (info.parseFromContainer(data, (unsigned)size) != PARSE_SUCCESS) {
+        return 0;
+    }
+
+    // 没有EXIF时writer从空的EXIF开始
+    std::vector<uint8_t> exifData;
+    ExifWriter writer;
+    if (ExifWriter::readExifData(data, (uint32_t)size, exifData)) {
+        writer = ExifWriter(exifData.data(), (uint32_t)exifData.size());
+    }
+
+    const uint8_t selector = data[size - 1];
+    StripPolicy policy;
+    policy.gps = (selector & 0x01) != 0;
+    policy.makerNote = (selector & 0x02) != 0;
+    policy.xmp = (selector & 0x04) != 0;
+    policy.thumbnail = (selector & 0x08) != 0;
+    if (selector & 0x0f) {
+        writer.strip(policy);
+    }
+
+    EXIFInfo edit;
+    edit.Software = info.Software + " fuzz";
+    edit.DateTimeOriginal = "2021:06:15 12:00:00";
+    edit.ExposureProgram = 2;
+    edit.GeoLocation.GPSDateStamp = "2021:06:15";
+    edit.FNumber = 2.8;
+    edit.ApertureValue = 2.8;
+    writer.setDropThumbnailOnOverflow((selector & 0x80) != 0);
+    if (selector & 0x10) {
+        // 足够长的字符串，APP1放不下时转移EXIF中的XMP和UserComment，允许时删除缩略图
+        edit.Software.append(64 * 1024 - 512, 's');
+    }
+    writer.addExifInfo(&edit);
+    if (selector & 0x20) {
+        writer.setXMP(info.ExtendedXMP.empty() ? std::string("<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"/>") : info.ExtendedXMP);
+    }
+    writer.setSyncPixelDimensions((selector & 0x40) != 0);
+
+    std::vector<uint8_t> output;
+    if (!writer.writeToBuffer(data, (uint32_t)size, output) || output.size() > UINT32_MAX) {
+        return 0;
+    }
+    EXIFInfo reparsed;
+    reparsed.parseFromContainer(output.data(), (unsigned)output.size());
+    return 0;
+}
@@ -0,0 +1,18 @@
+//
+//  fuzz_xmp.cpp
+//  WritableTinyExif
+//
+// libFuzzer入口：解析一个XMP packet(不带APP1的标识)
+
+#include <stddef.h>
+#include <stdint.h>
+#include "TinyEXIF.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size > UINT32_MAX) {
+        return 0;
+    }
+    TinyEXIF::EXIFInfo info;
+    info.parseFromXMPSegmentXML((const char *)data, (unsigned)size);
+    return 0;
+}
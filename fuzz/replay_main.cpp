@@ -0,0 +1,51 @@
+//
+//  replay_main.cpp
+//  WritableTinyExif
+//
+// 没有libFuzzer的编译器(gcc)使用的main：把参数中的文件或目录下的文件
+// 依次交给LLVMFuzzerTestOneInput执行一次，用于回放语料和复现崩溃
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static void replayFile(const std::string &path) {
+    std::ifstream in (path.c_str(), std::ios::in | std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    printf("%s (%zu bytes)\n", path.c_str(), data.size());
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0) {
+            fprintf(stderr, "cannot open %s\n", argv[i]);
+            return 1;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            replayFile(argv[i]);
+            continue;
+        }
+        DIR *dir = opendir(argv[i]);
+        if (dir == NULL) {
+            fprintf(stderr, "cannot open %s\n", argv[i]);
+            return 1;
+        }
+        for (struct dirent *entry; (entry = readdir(dir)) != NULL; ) {
+            const std::string path = std::string(argv[i]) + "/" + entry->d_name;
+            if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                replayFile(path);
+            }
+        }
+        closedir(dir);
+    }
+    return 0;
+}